@@ -0,0 +1,30 @@
+// ByteSource/ByteSink on top of an Arduino Stream, for connecting the SLCAN core to Serial.
+
+#ifndef stream_port_h_included
+#define stream_port_h_included
+
+#include "main.h"
+#include "byte_stream.h"
+
+class StreamPort : public ByteSource, public ByteSink {
+  Stream* stream;
+
+public:
+  StreamPort(Stream* s) : stream(s) {}
+
+  int available() override {
+    return stream->available();
+  }
+  int read() override {
+    return stream->read();
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    return stream->write(buf, len);
+  }
+  int available_for_write() override {
+    return stream->availableForWrite();
+  }
+  using ByteSink::write;
+};
+
+#endif // !stream_port_h_included
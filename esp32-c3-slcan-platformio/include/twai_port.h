@@ -0,0 +1,82 @@
+// CanPort on top of the ESP-IDF TWAI driver.
+
+#ifndef twai_port_h_included
+#define twai_port_h_included
+
+#include "main.h"
+#include "can_port.h"
+
+// Default depth of the driver's queues.  The RX queue bridges the time until CAN-RX gets to
+// run; behind it the frame ring (RX_RING_LEN) takes up longer stalls.  The S3 has RAM to
+// spare, the C3 less so.
+#if CONFIG_IDF_TARGET_ESP32S3
+#define TWAI_RX_QUEUE_LEN   256
+#define TWAI_TX_QUEUE_LEN   64
+#else
+#define TWAI_RX_QUEUE_LEN   64
+#define TWAI_TX_QUEUE_LEN   16
+#endif
+
+// The queues may take at most this share of the free internal RAM.
+#define TWAI_QUEUE_RAM_DIVISOR  4
+
+// How long start() waits for a bus-off recovery under way to end before it can reinstall the
+// driver.  Recovery takes 128 runs of 11 recessive bits: 141 ms at 10 kbit/s.
+#define TWAI_RECOVERY_WAIT_MS   300
+
+// The driver is left installed when the port is stopped, and only reinstalled on start() if
+// the mode, timing or filter differ from the installed ones; otherwise start() and stop()
+// are just twai_start() and twai_stop().  The TWAI driver takes the timing and filter only at
+// install time, so changing either still costs a reinstall.  Nothing is printed: failures
+// are returned to the caller, and the driver's error code is kept in `last_error`.
+
+class TwaiPort : public CanPort {
+  twai_general_config_t g_config;
+  twai_timing_config_t t_config;
+  twai_filter_config_t f_config;
+  bool installed = false;
+  bool queues_changed = false;
+  uint32_t installs = 0;                      // Driver installs so far, the status epoch
+
+  // Held by CAN-RX while it is inside twai_receive() and by start()/stop() while they
+  // install or remove the driver.
+  SemaphoreHandle_t lock = nullptr;
+
+  // Notified when the driver has been started, so it can stop waiting for that.
+  TaskHandle_t receiver = nullptr;
+
+  volatile bool running = false;
+
+  bool is_installed_as(twai_mode_t mode, const twai_timing_config_t& timing,
+                       const twai_filter_config_t& filter);
+  bool uninstall();
+
+public:
+  // Result of the last driver call that failed.
+  esp_err_t last_error = ESP_OK;
+
+  // Must be called once before the port is used.
+  void begin(gpio_num_t tx_io, gpio_num_t rx_io, TaskHandle_t rx_task);
+
+  bool start(twai_mode_t mode, const twai_timing_config_t& timing,
+             const twai_filter_config_t& filter) override;
+  void stop() override;
+  bool is_running() override {
+    return running;
+  }
+  bool transmit(const twai_message_t& msg, uint32_t timeout_ms) override;
+  bool receive(twai_message_t* msg, uint32_t timeout_ms) override;
+  bool set_queue_lengths(uint32_t rx_len, uint32_t tx_len) override;
+  void get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) override;
+  uint32_t read_alerts() override;
+  bool initiate_recovery() override;
+  bool resume() override;
+  bool get_status(twai_status_info_t* info) override;
+  uint32_t status_epoch() override {
+    return installs;
+  }
+  int64_t now_us() override;
+  void delay_ms(uint32_t ms) override;
+};
+
+#endif // !twai_port_h_included
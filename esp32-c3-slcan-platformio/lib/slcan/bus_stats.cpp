@@ -0,0 +1,57 @@
+// Per-ID statistics and bus load of the received traffic.
+
+#include "bus_stats.h"
+#include "can_bits.h"
+#include "slcan.h"
+
+void BusStats::clear(int64_t now_us) {
+  table.clear();
+  window_start_us = now_us;
+  window_bits = 0;
+  start_us = now_us;
+  bits = 0;
+  frames = 0;
+  overflows = 0;
+  peak_bits_per_s = 0;
+}
+
+void BusStats::add(const twai_message_t& msg, int64_t rx_us) {
+  uint32_t len = can_frame_bits(&msg);
+  bits += len;
+  frames++;
+
+  // A window closes with the first frame after it, so one that saw no frames at all is taken
+  // together with the next.
+  if (rx_us - window_start_us >= BUS_STATS_WINDOW_US) {
+    uint32_t rate = (uint64_t)window_bits * 1000000 / (rx_us - window_start_us);
+    if (rate > peak_bits_per_s)
+      peak_bits_per_s = rate;
+    window_start_us = rx_us;
+    window_bits = 0;
+  }
+  window_bits += len;
+
+  uint32_t key = msg.identifier | (msg.extd ? RX_FRAME_EXTD : 0) | (msg.rtr ? RX_FRAME_RTR : 0);
+  bool added;
+  BusStatsEntry* e = table.insert(key, &added);
+  if (!e) {
+    overflows++;
+    return;
+  }
+  if (added) {
+    e->frames = 0;
+    e->min_gap_us = UINT32_MAX;
+    e->max_gap_us = 0;
+    e->gap_sum_us = 0;
+  } else {
+    uint32_t gap = (uint32_t)rx_us - e->last_us;
+    if (gap < e->min_gap_us)
+      e->min_gap_us = gap;
+    if (gap > e->max_gap_us)
+      e->max_gap_us = gap;
+    e->gap_sum_us += gap;
+  }
+  e->frames++;
+  e->last_us = rx_us;
+  e->dlc = msg.data_length_code;
+}
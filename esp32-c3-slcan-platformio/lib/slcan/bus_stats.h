@@ -0,0 +1,72 @@
+// Per-ID statistics and bus load of the received traffic.
+//
+// For every ID seen, a hash table (see id_table.h) keeps the frame count, the last DLC and
+// the shortest, longest and mean time between frames.  The bit times of all frames, stuff
+// bits included (see can_bits.h), add up to the bus load, which is also taken over one second
+// windows to find the peak.  Together they characterise a bus without it having to be
+// recorded on the host.
+//
+// Only CAN-RX may call add() and clear(); others ask it to clear (see the `u` command).
+// Others read the table and the totals and may see slightly stale values.
+
+#ifndef bus_stats_h_included
+#define bus_stats_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+#include "id_table.h"
+
+// Slots in the table, a power of two.  It is kept at most 3/4 full; frames of IDs that do not
+// fit only count towards the totals.
+#define BUS_STATS_SLOTS       512
+#define BUS_STATS_IDS         (BUS_STATS_SLOTS * 3 / 4)
+
+// Length of the windows the peak load is taken over.
+#define BUS_STATS_WINDOW_US   1000000
+
+// One ID's statistics.
+struct BusStatsEntry {
+  uint32_t key;               // ID and flags as in RxFrame::id_flags
+  uint32_t frames;
+  uint32_t last_us;           // Low 32 bits of the receive time of the last frame
+  uint32_t min_gap_us;        // Between two frames; UINT32_MAX until there are two
+  uint32_t max_gap_us;
+  uint64_t gap_sum_us;        // Over frames - 1 gaps
+  uint8_t dlc;                // Of the last frame
+};
+
+class BusStats {
+  IdTable<BusStatsEntry, BUS_STATS_SLOTS> table;
+
+  int64_t window_start_us = 0;
+  uint32_t window_bits = 0;
+
+public:
+  int64_t start_us = 0;       // When clear() was called
+  uint64_t bits = 0;          // Bit times of all frames
+  uint32_t frames = 0;
+  uint32_t overflows = 0;     // Frames of IDs that found no room
+  uint32_t peak_bits_per_s = 0;
+
+  BusStats() {
+    clear(0);
+  }
+
+  // Start over at `now_us`.
+  void clear(int64_t now_us);
+
+  // Count `msg`, received at `rx_us`.
+  void add(const twai_message_t& msg, int64_t rx_us);
+
+  size_t ids() const {
+    return table.size();
+  }
+
+  // The statistics in slot `slot` (0 to BUS_STATS_SLOTS - 1), or nullptr if it is unused.
+  const BusStatsEntry* slot(size_t slot) const {
+    return table.slot(slot);
+  }
+};
+
+#endif // !bus_stats_h_included
@@ -0,0 +1,59 @@
+// Bus-off detection and recovery.
+
+#include "bus_supervisor.h"
+
+void BusSupervisor::reset() {
+  state = BUS_ACTIVE;
+  next_backoff_ms = backoff_ms;
+  last_poll_us = 0;
+  stable_since_us = 0;
+}
+
+void BusSupervisor::poll(CanPort* port, int64_t now_us) {
+  if (now_us - last_poll_us < BUS_SUPERVISOR_POLL_US)
+    return;
+  last_poll_us = now_us;
+
+  uint32_t alerts = port->read_alerts();
+  seen |= alerts;
+
+  if (alerts & TWAI_ALERT_BUS_OFF) {
+    state = BUS_OFF;
+    bus_offs++;
+    if (now_us - stable_since_us > (int64_t)BUS_SUPERVISOR_STABLE_MS * 1000)
+      next_backoff_ms = backoff_ms;
+    recover_at_us = now_us + (int64_t)next_backoff_ms * 1000;
+    uint32_t max_ms = backoff_ms > BUS_SUPERVISOR_BACKOFF_MAX_MS ? backoff_ms
+                                                                 : BUS_SUPERVISOR_BACKOFF_MAX_MS;
+    next_backoff_ms = next_backoff_ms > max_ms / 2 ? max_ms : next_backoff_ms * 2;
+  } else if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+    // The controller is stopped after recovery and has to be started again.
+    if (port->resume())
+      recoveries++;
+    state = BUS_ACTIVE;
+    stable_since_us = now_us;
+  } else if (state != BUS_OFF && state != BUS_RECOVERING) {
+    if (alerts & TWAI_ALERT_ERR_PASS)
+      state = BUS_PASSIVE;
+    else if (alerts & TWAI_ALERT_ABOVE_ERR_WARN)
+      state = BUS_WARNING;
+    else if (alerts & TWAI_ALERT_ERR_ACTIVE)
+      state = BUS_ACTIVE;
+  }
+
+  if (state == BUS_OFF && backoff_ms > 0 && now_us >= recover_at_us) {
+    if (port->initiate_recovery())
+      state = BUS_RECOVERING;
+  }
+}
+
+const char* BusSupervisor::state_name(BusState state) {
+  switch (state) {
+    case BUS_ACTIVE: return "active";
+    case BUS_WARNING: return "warning";
+    case BUS_PASSIVE: return "passive";
+    case BUS_OFF: return "bus_off";
+    case BUS_RECOVERING: return "recovering";
+  }
+  return "?";
+}
@@ -0,0 +1,66 @@
+// Bus-off detection and recovery.
+//
+// Driven by the controller's alerts: tracks the error state, and after bus-off starts the
+// recovery sequence on its own once a backoff has passed, doubling the backoff each time
+// the controller goes bus-off again soon after.  Alerts are also latched until the host
+// reads them, so short excursions still show up in `F`.
+
+#ifndef bus_supervisor_h_included
+#define bus_supervisor_h_included
+
+#include <atomic>
+#include <stdint.h>
+#include "can_port.h"
+
+// Alerts the controller must be told to raise.
+#define BUS_SUPERVISOR_ALERTS  (TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_ABOVE_ERR_WARN   \
+                                | TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF         \
+                                | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_RX_QUEUE_FULL)
+
+// Backoff before the first recovery, and the most it grows to; a longer one set by the host
+// stays as it is.
+#define BUS_SUPERVISOR_BACKOFF_MS      100
+#define BUS_SUPERVISOR_BACKOFF_MAX_MS  5000
+
+// After this long without bus-off the backoff starts from the beginning again.
+#define BUS_SUPERVISOR_STABLE_MS       10000
+
+// How often alerts are read at most.
+#define BUS_SUPERVISOR_POLL_US         1000
+
+enum BusState {
+  BUS_ACTIVE,
+  BUS_WARNING,              // An error counter is above 96
+  BUS_PASSIVE,              // An error counter is above 127
+  BUS_OFF,                  // Waiting for the backoff, or for the host with automatic recovery off
+  BUS_RECOVERING,           // Recovery sequence running
+};
+
+class BusSupervisor {
+  int64_t last_poll_us = 0;
+  int64_t recover_at_us = 0;
+  int64_t stable_since_us = 0;
+  uint32_t next_backoff_ms = BUS_SUPERVISOR_BACKOFF_MS;
+
+public:
+  // Backoff before the first recovery; 0 leaves recovery to the host.  Set by the host side.
+  uint32_t backoff_ms = BUS_SUPERVISOR_BACKOFF_MS;
+
+  BusState state = BUS_ACTIVE;
+  uint32_t bus_offs = 0;
+  uint32_t recoveries = 0;
+
+  // Alerts seen since the host last took them.
+  std::atomic<uint32_t> seen{0};
+
+  // Call when the controller is (re)started, before it runs.
+  void reset();
+
+  // Read and act on alerts.  Call often on the receiving task; returns at once if it was
+  // called less than BUS_SUPERVISOR_POLL_US ago.
+  void poll(CanPort* port, int64_t now_us);
+
+  static const char* state_name(BusState state);
+};
+
+#endif // !bus_supervisor_h_included
@@ -0,0 +1,63 @@
+// Abstract byte streams between the bridge and the host.
+//
+// The SLCAN core only talks to the host through these, so it does not depend on the
+// Arduino Stream classes and can run against anything that moves bytes.
+
+#ifndef byte_stream_h_included
+#define byte_stream_h_included
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class ByteSource {
+public:
+  virtual ~ByteSource() {}
+
+  // Number of bytes that can be read without waiting.
+  virtual int available() = 0;
+
+  // Next byte, or -1 if there is none.
+  virtual int read() = 0;
+};
+
+class ByteSink {
+public:
+  virtual ~ByteSink() {}
+
+  // Write up to `len` bytes, returning how many were taken.  May block.
+  virtual size_t write(const uint8_t* buf, size_t len) = 0;
+
+  // Number of bytes that can be written without blocking.
+  virtual int available_for_write() = 0;
+
+  // Convenience formatting, in the manner of Arduino's Print.
+
+  size_t write(const char* buf, size_t len) {
+    return write((const uint8_t*)buf, len);
+  }
+
+  size_t print(const char* s) {
+    return write(s, strlen(s));
+  }
+
+  size_t println(const char* s = "") {
+    return print(s) + write("\r\n", 2);
+  }
+
+  size_t printf(const char* fmt, ...) __attribute__ ((format (printf, 2, 3))) {
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0) {
+      return 0;
+    }
+    return write(buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+  }
+};
+
+#endif // !byte_stream_h_included
@@ -0,0 +1,84 @@
+// Length on the wire of classic CAN frames.
+
+#include "can_bits.h"
+
+// Bits from SOF up to and including the CRC are subject to stuffing and are collected in
+// `bits`, most significant first, so the stuff bits can be counted exactly.
+struct BitSeq {
+  uint8_t bits[16] = {};
+  uint32_t n = 0;
+
+  void put(uint32_t value, uint32_t count) {
+    for (uint32_t i = count; i > 0; i--) {
+      if ((value >> (i - 1)) & 1) {
+        bits[n >> 3] |= 0x80 >> (n & 7);
+      }
+      n++;
+    }
+  }
+
+  uint32_t get(uint32_t i) const {
+    return (bits[i >> 3] >> (7 - (i & 7))) & 1;
+  }
+};
+
+static uint16_t crc15(const BitSeq& seq) {
+  uint16_t crc = 0;
+  for (uint32_t i = 0; i < seq.n; i++) {
+    uint32_t next = seq.get(i) ^ ((crc >> 14) & 1);
+    crc = (crc << 1) & 0x7FFF;
+    if (next) {
+      crc ^= 0x4599;
+    }
+  }
+  return crc;
+}
+
+uint32_t can_frame_bits(const twai_message_t* msg) {
+  BitSeq seq;
+  uint32_t dlc = msg->data_length_code;
+  uint32_t len = dlc > TWAI_FRAME_MAX_DLC ? TWAI_FRAME_MAX_DLC : dlc;
+
+  seq.put(0, 1);                                              // SOF
+  if (msg->extd) {
+    seq.put(msg->identifier >> 18, 11);                       // Base ID
+    seq.put(1, 1);                                            // SRR
+    seq.put(1, 1);                                            // IDE
+    seq.put(msg->identifier, 18);                             // ID extension
+    seq.put(msg->rtr, 1);                                     // RTR
+    seq.put(0, 2);                                            // r1, r0
+  } else {
+    seq.put(msg->identifier, 11);
+    seq.put(msg->rtr, 1);                                     // RTR
+    seq.put(0, 2);                                            // IDE, r0
+  }
+  seq.put(dlc, 4);
+  if (!msg->rtr) {
+    for (uint32_t i = 0; i < len; i++) {
+      seq.put(msg->data[i], 8);
+    }
+  }
+  seq.put(crc15(seq), 15);
+
+  // A stuff bit follows every run of five equal bits, and itself starts a new run.
+  uint32_t stuff = 0;
+  uint32_t run = 1;
+  uint32_t last = seq.get(0);
+  for (uint32_t i = 1; i < seq.n; i++) {
+    uint32_t b = seq.get(i);
+    if (b == last) {
+      run++;
+    } else {
+      run = 1;
+      last = b;
+    }
+    if (run == 5) {
+      stuff++;
+      last = !last;
+      run = 1;
+    }
+  }
+
+  // CRC delimiter, ACK slot, ACK delimiter, EOF and intermission are never stuffed.
+  return seq.n + stuff + 1 + 1 + 1 + 7 + 3;
+}
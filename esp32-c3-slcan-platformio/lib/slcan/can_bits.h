@@ -0,0 +1,14 @@
+// Length on the wire of classic CAN frames.
+
+#ifndef can_bits_h_included
+#define can_bits_h_included
+
+#include <stdint.h>
+#include "driver/twai.h"
+
+// Number of bit times `msg` occupies on the bus, from start of frame through the end of the
+// interframe space, including the stuff bits it actually needs.  Error frames and overload
+// frames are not accounted for.
+uint32_t can_frame_bits(const twai_message_t* msg);
+
+#endif // !can_bits_h_included
@@ -0,0 +1,72 @@
+// Abstract CAN controller as seen by the SLCAN core.
+//
+// On the device this is the TWAI driver (see twai_port.h); anything else that can send and
+// receive twai_message_t, such as a simulated bus, can stand in for it.
+
+#ifndef can_port_h_included
+#define can_port_h_included
+
+#include <stdint.h>
+#include "driver/twai.h"
+
+// Queue one frame for transmission without waiting for room.  Returns false if it was not
+// queued.  The periodic transmit table (tx_scheduler.h) and ISO-TP (isotp.h) send through
+// one of these, so the channel's mode and the counters apply to their frames as they do to
+// the host's.
+typedef bool (*CanTransmitFn)(const twai_message_t& msg);
+
+class CanPort {
+public:
+  virtual ~CanPort() {}
+
+  // Bring the controller onto the bus with the given settings.  Returns false on failure,
+  // in which case the port is left closed.
+  virtual bool start(twai_mode_t mode, const twai_timing_config_t& timing,
+                     const twai_filter_config_t& filter) = 0;
+
+  // Take the controller off the bus.
+  virtual void stop() = 0;
+
+  virtual bool is_running() = 0;
+
+  // Queue `msg` for transmission, waiting up to `timeout_ms` for room in the TX queue.
+  // Returns false if it was not queued.
+  virtual bool transmit(const twai_message_t& msg, uint32_t timeout_ms) = 0;
+
+  // Wait up to `timeout_ms` for a received frame.  Returns false if none arrived.
+  virtual bool receive(twai_message_t* msg, uint32_t timeout_ms) = 0;
+
+  // Set the depth of the controller's RX and TX queues from the next start() on.  Returns
+  // false if the port cannot afford them.
+  virtual bool set_queue_lengths(uint32_t rx_len, uint32_t tx_len) = 0;
+  virtual void get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) = 0;
+
+  // Alerts (TWAI_ALERT_*) raised since the last call, without waiting.  0 when not running.
+  virtual uint32_t read_alerts() = 0;
+
+  // Start the bus-off recovery sequence.  Returns false if the controller is not bus-off.
+  virtual bool initiate_recovery() = 0;
+
+  // Start the controller again after recovery has completed.
+  virtual bool resume() = 0;
+
+  // Controller state and error counters.  Returns false if they are not available, eg
+  // because the port is not running.
+  virtual bool get_status(twai_status_info_t* info) = 0;
+
+  // Changes whenever the counters in get_status() start over from zero, as they do when the
+  // TWAI driver is reinstalled; counts taken before then do not compare with later ones.  A
+  // port whose counters never start over keeps this default.
+  virtual uint32_t status_epoch() {
+    return 0;
+  }
+
+  // Microseconds on a free-running clock.  All timestamps and deadlines in the core are
+  // taken from here, so a simulated port brings its own notion of time.
+  virtual int64_t now_us() = 0;
+
+  // Block the calling task for `ms` milliseconds of the same clock.
+  virtual void delay_ms(uint32_t ms) = 0;
+};
+
+#endif // !can_port_h_included
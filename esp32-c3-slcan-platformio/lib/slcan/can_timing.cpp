@@ -0,0 +1,85 @@
+// CAN bit timing for the TWAI controller.
+
+#include "can_timing.h"
+
+static uint32_t abs_diff(uint32_t a, uint32_t b) {
+  return a > b ? a - b : b - a;
+}
+
+bool can_timing_calc(uint32_t bitrate, uint32_t sample_point, twai_timing_config_t* timing) {
+  if (bitrate == 0 || sample_point == 0 || sample_point >= 1000)
+    return false;
+
+  twai_timing_config_t best = {};
+  bool found = false;
+  uint64_t best_error = 0;
+  uint32_t best_sp_error = 0;
+
+  // Try every bit length, longest first so that ties go to the finest resolution.
+  for (uint32_t tq = CAN_TIMING_TQ_MAX; tq >= CAN_TIMING_TQ_MIN; tq--) {
+    // Nearest even prescaler.
+    uint64_t per_bit = (uint64_t)bitrate * tq;
+    uint32_t brp = ((CAN_TIMING_CLOCK_HZ + per_bit) / (2 * per_bit)) * 2;
+    if (brp < CAN_TIMING_BRP_MIN || brp > CAN_TIMING_BRP_MAX)
+      continue;
+
+    // Sample point at the end of TSEG1, after the one quantum sync segment.
+    uint32_t tseg2 = (tq * (1000 - sample_point) + 500) / 1000;
+    if (tseg2 < 1)
+      tseg2 = 1;
+    if (tseg2 > CAN_TIMING_TSEG2_MAX)
+      tseg2 = CAN_TIMING_TSEG2_MAX;
+    uint32_t tseg1 = tq - 1 - tseg2;
+    if (tseg1 > CAN_TIMING_TSEG1_MAX) {
+      tseg1 = CAN_TIMING_TSEG1_MAX;
+      tseg2 = tq - 1 - tseg1;
+      if (tseg2 > CAN_TIMING_TSEG2_MAX)
+        continue;
+    }
+    if (tseg1 < 1)
+      continue;
+
+    // Error in ppm of the bitrate; exact rational arithmetic, no floating point.
+    uint64_t actual_x = (uint64_t)CAN_TIMING_CLOCK_HZ * 1000000;
+    uint64_t wanted_x = (uint64_t)bitrate * brp * tq * 1000000;
+    uint64_t error = (actual_x > wanted_x ? actual_x - wanted_x : wanted_x - actual_x)
+                     / ((uint64_t)brp * tq * bitrate);
+    uint32_t sp_error = abs_diff((1 + tseg1) * 1000 / tq, sample_point);
+
+    if (!found || error < best_error || (error == best_error && sp_error < best_sp_error)) {
+      found = true;
+      best_error = error;
+      best_sp_error = sp_error;
+      best.brp = brp;
+      best.tseg_1 = tseg1;
+      best.tseg_2 = tseg2;
+      best.sjw = tseg2 < CAN_TIMING_SJW_MAX ? tseg2 : CAN_TIMING_SJW_MAX;
+      best.triple_sampling = false;
+    }
+  }
+  if (!found || best_error > CAN_TIMING_MAX_ERROR_PPM)
+    return false;
+  *timing = best;
+  return true;
+}
+
+// The SJA1000 quantum is 2 * (BRP + 1) cycles of the 16 MHz crystal, ie 10 * (BRP + 1)
+// cycles of the 80 MHz APB clock, which is always even.  The segment fields hold the
+// length minus one.
+
+void can_timing_from_btr(uint8_t btr0, uint8_t btr1, twai_timing_config_t* timing) {
+  timing->brp = 10 * ((btr0 & 0x3F) + 1);
+  timing->sjw = (btr0 >> 6) + 1;
+  timing->tseg_1 = (btr1 & 0x0F) + 1;
+  timing->tseg_2 = ((btr1 >> 4) & 0x07) + 1;
+  timing->triple_sampling = btr1 >> 7;
+}
+
+uint32_t can_timing_bitrate(const twai_timing_config_t& timing) {
+  uint32_t cycles = timing.brp * (1 + timing.tseg_1 + timing.tseg_2);
+  return (CAN_TIMING_CLOCK_HZ + cycles / 2) / cycles;
+}
+
+uint32_t can_timing_sample_point(const twai_timing_config_t& timing) {
+  return (1 + timing.tseg_1) * 1000 / (1 + timing.tseg_1 + timing.tseg_2);
+}
@@ -0,0 +1,44 @@
+// CAN bit timing for the TWAI controller.
+//
+// Works out the prescaler and segment lengths for arbitrary bitrates and sample points,
+// and translates SJA1000 BTR0/BTR1 register values as sent by Lawicel `s`.
+
+#ifndef can_timing_h_included
+#define can_timing_h_included
+
+#include <stdint.h>
+#include "driver/twai.h"
+
+// TWAI source clock (APB) and the controller's limits.  The prescaler must be even.
+#define CAN_TIMING_CLOCK_HZ   80000000
+#define CAN_TIMING_BRP_MIN    2
+#define CAN_TIMING_BRP_MAX    16384
+#define CAN_TIMING_TSEG1_MAX  16
+#define CAN_TIMING_TSEG2_MAX  8
+#define CAN_TIMING_SJW_MAX    4
+
+// Quanta per bit.  More quanta give a finer sample point, fewer reach more bitrates.
+#define CAN_TIMING_TQ_MIN     8
+#define CAN_TIMING_TQ_MAX     25
+
+// Sample point used when none is given, in 1/1000 of a bit (CiA 301 recommends 87.5%).
+#define CAN_TIMING_SAMPLE_POINT  875
+
+// Largest bitrate error accepted, in parts per million.  CAN tolerates about 1.5% between
+// two nodes; half a percent leaves the rest to the oscillators.
+#define CAN_TIMING_MAX_ERROR_PPM 5000
+
+// Find the timing closest to `bitrate` and, among those, to `sample_point` (1/1000 of a
+// bit).  Returns false, leaving *timing alone, if no timing is within
+// CAN_TIMING_MAX_ERROR_PPM.
+bool can_timing_calc(uint32_t bitrate, uint32_t sample_point, twai_timing_config_t* timing);
+
+// Translate SJA1000 bus timing registers, which Lawicel adapters interpret for a 16 MHz
+// crystal, into the same timing on the TWAI controller.  The translation is exact.
+void can_timing_from_btr(uint8_t btr0, uint8_t btr1, twai_timing_config_t* timing);
+
+// The bitrate and the sample point (1/1000 of a bit) a timing actually gives.
+uint32_t can_timing_bitrate(const twai_timing_config_t& timing);
+uint32_t can_timing_sample_point(const twai_timing_config_t& timing);
+
+#endif // !can_timing_h_included
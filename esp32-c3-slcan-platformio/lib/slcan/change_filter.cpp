@@ -0,0 +1,45 @@
+// On-change forwarding of received frames.
+
+#include "change_filter.h"
+#include <string.h>
+
+void ChangeFilter::clear() {
+  table.clear();
+  overflows = 0;
+  total_suppressed = 0;
+}
+
+bool ChangeFilter::pass(const RxFrame& frame, uint32_t heartbeat_us) {
+  bool added;
+  Entry* e = table.insert(frame.id_flags, &added);
+  if (!e) {
+    overflows++;
+    return true;
+  }
+
+  size_t len = frame.id_flags & RX_FRAME_RTR ? 0 : frame.dlc;
+  if (len > TWAI_FRAME_MAX_DLC)
+    len = TWAI_FRAME_MAX_DLC;
+
+  if (added) {
+    e->suppressed = 0;
+  } else if (e->dlc == frame.dlc && memcmp(e->data, frame.data, len) == 0
+             && (heartbeat_us == 0 || frame.rx_us - e->sent_us < heartbeat_us)) {
+    e->suppressed++;
+    total_suppressed++;
+    return false;
+  }
+
+  e->sent_us = frame.rx_us;
+  e->dlc = frame.dlc;
+  memcpy(e->data, frame.data, len);
+  return true;
+}
+
+bool ChangeFilter::suppressed(uint32_t id_flags, uint32_t* count) const {
+  const Entry* e = table.find(id_flags);
+  if (!e)
+    return false;
+  *count = e->suppressed;
+  return true;
+}
@@ -0,0 +1,62 @@
+// On-change forwarding of received frames.
+//
+// Most frames repeat unchanged many times a second.  This keeps the last payload sent for
+// each ID in a hash table (see id_table.h) and lets a frame through only if its DLC, data or
+// RTR flag differ from that, or if the heartbeat interval has passed since the ID was last
+// sent, so the host still sees that it is alive.  Frames held back are counted per ID.
+//
+// Only CAN-RX may call pass() and clear(); others ask it to clear (see the `o` command).
+// Others may call suppressed() and the counts, and get slightly stale values.
+
+#ifndef change_filter_h_included
+#define change_filter_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "id_table.h"
+#include "slcan.h"
+
+// Slots in the table, a power of two.  It is kept at most 3/4 full; frames of IDs that do not
+// fit are always passed.
+#define CHANGE_FILTER_SLOTS   1024
+#define CHANGE_FILTER_IDS     (CHANGE_FILTER_SLOTS * 3 / 4)
+
+class ChangeFilter {
+  struct Entry {
+    uint32_t key;             // RxFrame::id_flags
+    uint32_t sent_us;         // RxFrame::rx_us of the last frame passed
+    uint32_t suppressed;
+    uint8_t dlc;
+    uint8_t data[TWAI_FRAME_MAX_DLC];
+  };
+
+  IdTable<Entry, CHANGE_FILTER_SLOTS> table;
+
+public:
+  // Frames passed because their ID found no room.
+  uint32_t overflows = 0;
+
+  // All frames held back since the last clear().
+  uint32_t total_suppressed = 0;
+
+  ChangeFilter() {
+    clear();
+  }
+
+  // Forget all IDs.
+  void clear();
+
+  // Should `frame` go to the host?  `heartbeat_us` is the longest an ID may go unsent, 0 for
+  // no limit.
+  bool pass(const RxFrame& frame, uint32_t heartbeat_us);
+
+  // Frames of the ID in `id_flags` (see RxFrame) held back.  Returns false if the ID has not
+  // been seen.
+  bool suppressed(uint32_t id_flags, uint32_t* count) const;
+
+  size_t ids() const {
+    return table.size();
+  }
+};
+
+#endif // !change_filter_h_included
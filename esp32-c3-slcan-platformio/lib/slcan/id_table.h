@@ -0,0 +1,95 @@
+// Open addressing hash table keyed by CAN ID.
+//
+// The software filter and the per-ID state kept on CAN-RX (change_filter.h, rate_limiter.h,
+// bus_stats.h) all look up every received frame's ID, so they share this table: linear
+// probing over a power of two number of slots, kept at most 3/4 full so probes stay short.
+// Entries are only ever removed all at once, so no deleted markers are needed.
+//
+// The table is not thread safe; its users say which task may call what.
+
+#ifndef id_table_h_included
+#define id_table_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Key of an unused slot.  Neither a 29-bit ID nor an RxFrame::id_flags can be this.
+#define ID_TABLE_EMPTY  0xFFFFFFFF
+
+// Slot of `key` in a table of 2^bits slots.  Fibonacci hashing: the top bits of the product
+// are well mixed even for keys that differ only in their low bits, as the IDs of a block of
+// related messages do.
+static inline size_t id_hash(uint32_t key, unsigned bits) {
+  return (key * 2654435761u) >> (32 - bits);
+}
+
+// A table of SLOTS entries, a power of two.  Entry must have a `uint32_t key` member; the
+// rest of it is the user's, and is left as it was when a key is added.
+template<typename Entry, size_t SLOTS>
+class IdTable {
+  static_assert(SLOTS >= 2 && (SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+  static constexpr unsigned log2(size_t n) {
+    return n == 1 ? 0 : 1 + log2(n / 2);
+  }
+
+  Entry entries[SLOTS];
+  size_t used = 0;
+
+  // The slot holding `key`, or the unused one where it would go.
+  size_t probe(uint32_t key) const {
+    size_t i = id_hash(key, log2(SLOTS));
+    while (entries[i].key != key && entries[i].key != ID_TABLE_EMPTY)
+      i = (i + 1) & (SLOTS - 1);
+    return i;
+  }
+
+public:
+  // Keys the table takes.
+  static const size_t CAPACITY = SLOTS * 3 / 4;
+
+  IdTable() {
+    clear();
+  }
+
+  // Remove all keys.
+  void clear() {
+    for (size_t i = 0; i < SLOTS; i++)
+      entries[i].key = ID_TABLE_EMPTY;
+    used = 0;
+  }
+
+  // The entry of `key`, or nullptr if it is not in the table.
+  const Entry* find(uint32_t key) const {
+    const Entry& e = entries[probe(key)];
+    return e.key == key ? &e : nullptr;
+  }
+
+  // The entry of `key`, which is added if it is not in the table yet; *added tells which.
+  // Returns nullptr if the key would have to be added and the table is full.
+  Entry* insert(uint32_t key, bool* added) {
+    Entry& e = entries[probe(key)];
+    *added = e.key != key;
+    if (*added) {
+      if (used >= CAPACITY)
+        return nullptr;
+      used++;
+      e.key = key;
+    }
+    return &e;
+  }
+
+  size_t size() const {
+    return used;
+  }
+
+  // The entry in slot `slot` (0 to SLOTS - 1), or nullptr if it is unused.  Walking the slots
+  // visits every key once, in no particular order.
+  const Entry* slot(size_t slot) const {
+    if (slot >= SLOTS || entries[slot].key == ID_TABLE_EMPTY)
+      return nullptr;
+    return &entries[slot];
+  }
+};
+
+#endif // !id_table_h_included
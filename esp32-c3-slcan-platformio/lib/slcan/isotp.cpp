@@ -0,0 +1,271 @@
+// ISO-TP (ISO 15765-2) transport on the device.
+
+#include "isotp.h"
+#include <string.h>
+
+// Protocol control information, the high nibble of the first byte.
+#define PCI_SF  0x00          // Single frame
+#define PCI_FF  0x10          // First frame
+#define PCI_CF  0x20          // Consecutive frame
+#define PCI_FC  0x30          // Flow control
+
+// Flow status of a flow control frame.
+#define FC_CTS    0           // Continue to send
+#define FC_WAIT   1
+#define FC_OVFLW  2
+
+// How soon to try again when the controller's TX queue is full.
+#define ISOTP_RETRY_US  250
+
+// STmin as sent in a flow control frame, in microseconds.  Reserved values mean the longest.
+static uint32_t st_min_us(uint8_t st) {
+  if (st <= 0x7F)
+    return st * 1000u;
+  if (st >= 0xF1 && st <= 0xF9)
+    return (st - 0xF0) * 100u;
+  return 127000;
+}
+
+bool IsoTp::send_frame(const uint8_t* data, size_t len) {
+  twai_message_t msg = {};
+  msg.identifier = config.tx_id;
+  msg.extd = config.ext;
+  memcpy(msg.data, data, len);
+  if (config.pad >= 0) {
+    memset(msg.data + len, config.pad, TWAI_FRAME_MAX_DLC - len);
+    len = TWAI_FRAME_MAX_DLC;
+  }
+  msg.data_length_code = len;
+  return transmit(msg);
+}
+
+bool IsoTp::send_fc(uint8_t status) {
+  uint8_t fc[3] = {(uint8_t)(PCI_FC | status), config.block_size, config.st_min};
+  return send_frame(fc, sizeof(fc));
+}
+
+void IsoTp::tx_fail(IsoTpError error) {
+  tx_state = TX_IDLE;
+  errors++;
+  listener->on_error(error, true);
+}
+
+void IsoTp::configure(const IsoTpConfig& settings) {
+  abort();
+  config = settings;
+}
+
+bool IsoTp::send(const uint8_t* pdu, size_t len, int64_t now_us) {
+  uint8_t frame[TWAI_FRAME_MAX_DLC];
+
+  if (tx_state != TX_IDLE || len == 0 || len > ISOTP_MAX_PDU)
+    return false;
+
+  if (len <= 7) {
+    frame[0] = PCI_SF | len;
+    memcpy(&frame[1], pdu, len);
+    if (!send_frame(frame, len + 1)) {
+      tx_fail(ISOTP_ERR_TX);
+      return true;
+    }
+    pdus_sent++;
+    listener->on_sent();
+    return true;
+  }
+
+  frame[0] = PCI_FF | (len >> 8);
+  frame[1] = len & 0xFF;
+  memcpy(&frame[2], pdu, 6);
+  tx_pdu = pdu;
+  tx_len = len;
+  tx_pos = 6;
+  tx_sn = 1;
+  tx_waits = 0;
+  tx_state = TX_WAIT_FC;
+  tx_deadline = now_us + ISOTP_TIMEOUT_US;
+  if (!send_frame(frame, sizeof(frame)))
+    tx_fail(ISOTP_ERR_TX);
+  return true;
+}
+
+void IsoTp::on_fc(const uint8_t* data, size_t len, int64_t now_us) {
+  if (tx_state != TX_WAIT_FC || len < 3)
+    return;
+
+  switch (data[0] & 0x0F) {
+    case FC_CTS:
+      tx_block_size = data[1];
+      tx_block_left = data[1];
+      tx_st_us = st_min_us(data[2]);
+      tx_waits = 0;
+      tx_state = TX_SENDING;
+      tx_deadline = now_us;
+      break;
+    case FC_WAIT:
+      if (++tx_waits > ISOTP_MAX_WAIT)
+        tx_fail(ISOTP_ERR_WAIT);
+      else
+        tx_deadline = now_us + ISOTP_TIMEOUT_US;
+      break;
+    case FC_OVFLW:
+      tx_fail(ISOTP_ERR_OVERFLOW);
+      break;
+    default:
+      // Flow statuses 3-F are reserved; the transfer is given up at once.
+      tx_fail(ISOTP_ERR_FLOW_STATUS);
+      break;
+  }
+}
+
+void IsoTp::on_cf(const uint8_t* data, size_t len, int64_t now_us) {
+  if (!rx_active)
+    return;
+
+  if ((data[0] & 0x0F) != rx_sn) {
+    rx_active = false;
+    errors++;
+    listener->on_error(ISOTP_ERR_SEQUENCE, false);
+    return;
+  }
+
+  size_t n = len - 1;
+  if (n > rx_len - rx_pos)
+    n = rx_len - rx_pos;
+  memcpy(&rx_pdu[rx_pos], &data[1], n);
+  rx_pos += n;
+  rx_sn = (rx_sn + 1) & 0x0F;
+
+  if (rx_pos == rx_len) {
+    rx_active = false;
+    pdus_received++;
+    listener->on_pdu(rx_pdu, rx_len);
+    return;
+  }
+
+  rx_deadline = now_us + ISOTP_TIMEOUT_US;
+  if (config.block_size && --rx_block_left == 0) {
+    rx_block_left = config.block_size;
+    send_fc(FC_CTS);
+  }
+}
+
+void IsoTp::on_frame(const twai_message_t& msg, int64_t now_us) {
+  const uint8_t* data = msg.data;
+  size_t len = msg.data_length_code;
+  if (len == 0 || len > TWAI_FRAME_MAX_DLC)
+    return;
+
+  switch (data[0] & 0xF0) {
+    case PCI_SF: {
+      size_t n = data[0] & 0x0F;
+      if (n == 0 || n > len - 1)
+        return;
+      // A new PDU ends the one being received.
+      if (rx_active) {
+        rx_active = false;
+        errors++;
+        listener->on_error(ISOTP_ERR_SEQUENCE, false);
+      }
+      pdus_received++;
+      listener->on_pdu(&data[1], n);
+      break;
+    }
+    case PCI_FF: {
+      size_t n = (data[0] & 0x0F) << 8 | data[1];
+      if (len < TWAI_FRAME_MAX_DLC || n < 8)
+        return;
+      if (rx_active) {
+        rx_active = false;
+        errors++;
+        listener->on_error(ISOTP_ERR_SEQUENCE, false);
+      }
+      if (n > ISOTP_MAX_PDU) {
+        send_fc(FC_OVFLW);
+        return;
+      }
+      memcpy(rx_pdu, &data[2], 6);
+      rx_len = n;
+      rx_pos = 6;
+      rx_sn = 1;
+      rx_block_left = config.block_size;
+      rx_active = true;
+      rx_deadline = now_us + ISOTP_TIMEOUT_US;
+      send_fc(FC_CTS);
+      break;
+    }
+    case PCI_CF:
+      on_cf(data, len, now_us);
+      break;
+    case PCI_FC:
+      on_fc(data, len, now_us);
+      break;
+  }
+}
+
+uint32_t IsoTp::poll(int64_t now_us) {
+  if (rx_active && now_us >= rx_deadline) {
+    rx_active = false;
+    errors++;
+    listener->on_error(ISOTP_ERR_TIMEOUT_CF, false);
+  }
+
+  if (tx_state == TX_WAIT_FC && now_us >= tx_deadline)
+    tx_fail(ISOTP_ERR_TIMEOUT_FC);
+
+  // With a short STmin several frames may be due; send them until the controller's queue
+  // is full, and then come back shortly.  tx_deadline only moves on with progress, so a
+  // controller that stays full runs into the timeout.
+  int64_t stall_until = tx_deadline + ISOTP_TIMEOUT_US;
+  while (tx_state == TX_SENDING && now_us >= tx_deadline) {
+    uint8_t frame[TWAI_FRAME_MAX_DLC];
+    size_t n = tx_len - tx_pos;
+    if (n > 7)
+      n = 7;
+    frame[0] = PCI_CF | tx_sn;
+    memcpy(&frame[1], &tx_pdu[tx_pos], n);
+    if (!send_frame(frame, n + 1)) {
+      if (now_us >= stall_until) {
+        tx_fail(ISOTP_ERR_TX);
+        break;
+      }
+      uint32_t wait_us = stall_until - now_us;
+      return wait_us < ISOTP_RETRY_US ? wait_us : ISOTP_RETRY_US;
+    }
+    tx_pos += n;
+    tx_sn = (tx_sn + 1) & 0x0F;
+
+    if (tx_pos == tx_len) {
+      tx_state = TX_IDLE;
+      pdus_sent++;
+      listener->on_sent();
+    } else if (tx_block_size && --tx_block_left == 0) {
+      tx_state = TX_WAIT_FC;
+      tx_deadline = now_us + ISOTP_TIMEOUT_US;
+    } else {
+      // STmin is the least time between two frames, so it counts from this one.
+      tx_deadline = now_us + tx_st_us;
+      stall_until = tx_deadline + ISOTP_TIMEOUT_US;
+      if (tx_st_us > 0)
+        break;
+    }
+  }
+
+  int64_t next = 0;
+  if (tx_state != TX_IDLE)
+    next = tx_deadline;
+  if (rx_active && (next == 0 || rx_deadline < next))
+    next = rx_deadline;
+  if (next == 0)
+    return 0;
+  return next > now_us ? next - now_us : 1;
+}
+
+void IsoTp::abort() {
+  if (tx_state != TX_IDLE)
+    tx_fail(ISOTP_ERR_ABORTED);
+  if (rx_active) {
+    rx_active = false;
+    errors++;
+    listener->on_error(ISOTP_ERR_ABORTED, false);
+  }
+}
@@ -0,0 +1,133 @@
+// ISO-TP (ISO 15765-2) transport on the device.
+//
+// Splits PDUs of up to 4095 bytes into a first frame and consecutive frames and reassembles
+// them, with the flow control of both sides handled here: the block size and STmin the
+// receiver asks for are kept to, and our own are sent in flow control frames as soon as a
+// first frame or a block has come in.  One channel, with normal addressing on classic CAN:
+// frames go out with one ID and come in with another.
+//
+// The engine is not thread safe; everything is called from the one task that runs it (see
+// xfer_schedule()).  Results go to an IsoTpListener.
+
+#ifndef isotp_h_included
+#define isotp_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+#include "can_port.h"
+
+// Longest PDU; the 12-bit length of a classic first frame.
+#define ISOTP_MAX_PDU       4095
+
+// How long to wait for a flow control frame (N_Bs) or a consecutive frame (N_Cr).
+#define ISOTP_TIMEOUT_US    1000000
+
+// Flow control frames asking to wait that are accepted in a row (N_WFTmax).
+#define ISOTP_MAX_WAIT      10
+
+// Reasons for IsoTpListener::on_error().
+enum IsoTpError {
+  ISOTP_ERR_TIMEOUT_FC = 1,   // No flow control frame in time (N_Bs)
+  ISOTP_ERR_TIMEOUT_CF = 2,   // No consecutive frame in time (N_Cr)
+  ISOTP_ERR_SEQUENCE = 3,     // Consecutive frame out of sequence
+  ISOTP_ERR_OVERFLOW = 4,     // The receiver cannot take the PDU, or it is too long for us
+  ISOTP_ERR_WAIT = 5,         // Too many flow control waits
+  ISOTP_ERR_TX = 6,           // The controller would not send a frame
+  ISOTP_ERR_ABORTED = 7,      // The channel was closed or reconfigured
+  ISOTP_ERR_FLOW_STATUS = 8,  // Flow control frame with a reserved flow status
+};
+
+struct IsoTpConfig {
+  uint32_t tx_id;             // ID of the frames we send
+  uint32_t rx_id;             // ID of the frames we receive
+  bool ext;                   // Both are extended IDs
+  uint8_t block_size;         // Asked of the sender, 0 = no limit
+  uint8_t st_min;             // Asked of the sender, encoded as in the flow control frame
+  int16_t pad;                // Fill byte for short frames, -1 = send them short
+};
+
+class IsoTpListener {
+public:
+  virtual ~IsoTpListener() {}
+
+  virtual void on_pdu(const uint8_t* pdu, size_t len) = 0;
+  virtual void on_sent() = 0;
+  virtual void on_error(IsoTpError error, bool tx) = 0;
+};
+
+class IsoTp {
+  enum TxState { TX_IDLE, TX_WAIT_FC, TX_SENDING };
+
+  IsoTpConfig config = {0, 0, false, 0, 0, -1};
+  IsoTpListener* listener = nullptr;
+  CanTransmitFn transmit = nullptr;
+
+  // Sending
+  TxState tx_state = TX_IDLE;
+  const uint8_t* tx_pdu = nullptr;
+  size_t tx_len = 0;
+  size_t tx_pos = 0;
+  uint8_t tx_sn = 0;
+  uint8_t tx_block_left = 0;  // Consecutive frames until the next flow control, 0 = no limit
+  uint8_t tx_block_size = 0;
+  uint32_t tx_st_us = 0;
+  uint8_t tx_waits = 0;
+  int64_t tx_deadline = 0;    // Next consecutive frame, or N_Bs expiry
+
+  // Receiving
+  bool rx_active = false;
+  uint8_t rx_pdu[ISOTP_MAX_PDU];
+  size_t rx_len = 0;
+  size_t rx_pos = 0;
+  uint8_t rx_sn = 0;
+  uint8_t rx_block_left = 0;
+  int64_t rx_deadline = 0;    // N_Cr expiry
+
+  bool send_frame(const uint8_t* data, size_t len);
+  bool send_fc(uint8_t status);
+  void tx_fail(IsoTpError error);
+  void on_fc(const uint8_t* data, size_t len, int64_t now_us);
+  void on_cf(const uint8_t* data, size_t len, int64_t now_us);
+
+public:
+  uint32_t pdus_sent = 0;
+  uint32_t pdus_received = 0;
+  uint32_t errors = 0;
+
+  // Send frames through `send` and report to `results`.
+  void begin(CanTransmitFn send, IsoTpListener* results) {
+    transmit = send;
+    listener = results;
+  }
+
+  // Take new settings; a transfer in progress is aborted.
+  void configure(const IsoTpConfig& settings);
+
+  const IsoTpConfig& settings() const {
+    return config;
+  }
+
+  // Start sending `len` bytes at `pdu`, which must stay put until on_sent() or on_error()
+  // with `tx` set.  Returns false if a PDU is being sent or `len` is 0 or too long.
+  bool send(const uint8_t* pdu, size_t len, int64_t now_us);
+
+  // A frame with the receive ID came in.
+  void on_frame(const twai_message_t& msg, int64_t now_us);
+
+  // Send what is due and check the timeouts.  Returns the microseconds until it should be
+  // called again, or 0 if there is nothing to wait for.
+  uint32_t poll(int64_t now_us);
+
+  // Give up on the transfers in progress.
+  void abort();
+
+  bool sending() const {
+    return tx_state != TX_IDLE;
+  }
+  bool receiving() const {
+    return rx_active;
+  }
+};
+
+#endif // !isotp_h_included
@@ -0,0 +1,57 @@
+// Per-ID rate limit on received frames.
+
+#include "rate_limiter.h"
+
+bool RateLimiter::add_rule(uint32_t code, uint32_t mask, bool ext, uint32_t interval_us) {
+  uint32_t limit = ext ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK;
+  if (code > limit || mask > limit || rule_count == RATE_LIMITER_RULES)
+    return false;
+  // RTR frames are limited along with the data frames of their ID.
+  rules[rule_count++] = {(code & mask) | (ext ? RX_FRAME_EXTD : 0), mask | RX_FRAME_EXTD,
+                         interval_us};
+  return true;
+}
+
+void RateLimiter::clear_ids() {
+  table.clear();
+  dropped = 0;
+  overflows = 0;
+}
+
+bool RateLimiter::pass(const RxFrame& frame) {
+  const Rule* rule = nullptr;
+  for (size_t r = 0; r < rule_count; r++) {
+    if ((frame.id_flags & rules[r].mask) == rules[r].code) {
+      rule = &rules[r];
+      break;
+    }
+  }
+  if (!rule)
+    return true;
+
+  bool added;
+  Entry* e = table.insert(frame.id_flags & ~RX_FRAME_RTR, &added);
+  if (!e) {
+    overflows++;
+    return true;
+  }
+  if (!added && frame.rx_us - e->passed_us < rule->interval_us) {
+    dropped++;
+    return false;
+  }
+  e->passed_us = frame.rx_us;
+  return true;
+}
+
+void RateLimiter::describe(ByteSink& out) const {
+  for (size_t r = 0; r < rule_count; r++) {
+    const Rule& rule = rules[r];
+    unsigned long hz = rule.interval_us ? 1000000 / rule.interval_us : 0;
+    if (rule.code & RX_FRAME_EXTD)
+      out.printf(" e%08lX,%08lX,%lu", (unsigned long)(rule.code & TWAI_EXTD_ID_MASK),
+                 (unsigned long)(rule.mask & TWAI_EXTD_ID_MASK), hz);
+    else
+      out.printf(" s%03lX,%03lX,%lu", (unsigned long)rule.code,
+                 (unsigned long)(rule.mask & TWAI_EXTD_ID_MASK), hz);
+  }
+}
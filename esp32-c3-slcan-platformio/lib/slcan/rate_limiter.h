@@ -0,0 +1,79 @@
+// Per-ID rate limit on received frames.
+//
+// Rules give the shortest interval between frames of the IDs matching an ID code/mask.  For
+// each such ID the receive time of the last frame passed is kept in a hash table (see
+// id_table.h), and frames arriving sooner after it are dropped, so a 1 kHz frame limited to
+// 10 Hz reaches the host as every hundredth one.  IDs no rule matches pass untouched.
+//
+// Only CAN-RX may call pass() and clear_ids(); others ask it to clear (see the `d` command).
+// The rules may only change while it does not call pass().
+
+#ifndef rate_limiter_h_included
+#define rate_limiter_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "byte_stream.h"
+#include "id_table.h"
+#include "slcan.h"
+
+// Rules; the first one matching an ID applies.
+#define RATE_LIMITER_RULES    8
+
+// Slots in the table, a power of two.  It is kept at most 3/4 full; frames of IDs that do not
+// fit are passed.
+#define RATE_LIMITER_SLOTS    512
+#define RATE_LIMITER_IDS      (RATE_LIMITER_SLOTS * 3 / 4)
+
+class RateLimiter {
+  struct Rule {
+    uint32_t code;            // On RxFrame::id_flags
+    uint32_t mask;
+    uint32_t interval_us;
+  };
+
+  struct Entry {
+    uint32_t key;             // RxFrame::id_flags without RX_FRAME_RTR
+    uint32_t passed_us;       // RxFrame::rx_us of the last frame passed
+  };
+
+  Rule rules[RATE_LIMITER_RULES];
+  size_t rule_count = 0;
+
+  IdTable<Entry, RATE_LIMITER_SLOTS> table;
+
+public:
+  uint32_t dropped = 0;       // Frames dropped since the last clear_ids()
+  uint32_t overflows = 0;     // Frames passed because their ID found no room
+
+  RateLimiter() {
+    clear_ids();
+  }
+
+  // Limit standard or extended IDs whose bits under `mask` equal those of `code` to one frame
+  // every `interval_us`.  Returns false if the ID is out of range or there is no room.
+  bool add_rule(uint32_t code, uint32_t mask, bool ext, uint32_t interval_us);
+
+  void clear_rules() {
+    rule_count = 0;
+  }
+
+  // Forget all IDs.
+  void clear_ids();
+
+  // Should `frame` go to the host?
+  bool pass(const RxFrame& frame);
+
+  size_t rules_used() const {
+    return rule_count;
+  }
+
+  size_t ids() const {
+    return table.size();
+  }
+
+  // Print the rules to `out` in the form of the commands that set them.
+  void describe(ByteSink& out) const;
+};
+
+#endif // !rate_limiter_h_included
@@ -0,0 +1,147 @@
+// Lock-free single-producer single-consumer ring buffer.
+//
+// Used to join the CAN and serial tasks without locks.  Exactly one task may call push()
+// and exactly one (other) task may call pop().  This header depends only on the C++
+// standard library so that it also builds on the host.
+
+#ifndef ring_buffer_h_included
+#define ring_buffer_h_included
+
+#include <atomic>
+#include <stddef.h>
+
+// A ring of N elements of T.  N must be a power of two.  Elements are copied in and out.
+
+template<typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+  // Invariant: tail <= head <= tail + N (modulo wrap of size_t)
+  // `head` is only written by the producer, `tail` only by the consumer.
+  T items[N];
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+
+public:
+  static constexpr size_t capacity() {
+    return N;
+  }
+
+  // Number of elements currently queued.  Exact only when called from the producer or
+  // the consumer; from anywhere else it is a snapshot.
+  size_t length() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  bool is_empty() const {
+    return length() == 0;
+  }
+
+  bool is_full() const {
+    return length() >= N;
+  }
+
+  // Producer side.  Returns false, and does nothing, if the ring is full.
+  bool push(const T& value) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      return false;
+    }
+    items[h & (N - 1)] = value;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.  Returns false, and leaves *value alone, if the ring is empty.
+  bool pop(T* value) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t) {
+      return false;
+    }
+    *value = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.  Discard everything currently queued.
+  void clear() {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+};
+
+// The same ring over memory handed in at run time, for buffers too large to be static (such
+// as one in PSRAM).  Until attach() has been called it has no room at all.
+
+template<typename T>
+class SpscSpanRing {
+  T* items = nullptr;
+  size_t mask = 0;                            // Capacity - 1; capacity is a power of two
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+
+public:
+  // Use the largest power of two number of elements that fits in `len` bytes at `mem`.  Must
+  // be called before the producer and the consumer start.
+  void attach(void* mem, size_t len) {
+    size_t n = len / sizeof(T);
+    size_t cap = 1;
+    while (cap * 2 <= n)
+      cap *= 2;
+    items = n ? (T*)mem : nullptr;
+    mask = cap - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    return items ? mask + 1 : 0;
+  }
+
+  size_t length() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  bool is_empty() const {
+    return length() == 0;
+  }
+
+  bool push(const T& value) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (!items || h - tail.load(std::memory_order_acquire) > mask) {
+      return false;
+    }
+    items[h & mask] = value;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T* value) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t) {
+      return false;
+    }
+    *value = items[t & mask];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  void clear() {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  // Position just past the newest element, for discard_to().  Any task may read it.
+  size_t end() const {
+    return head.load(std::memory_order_acquire);
+  }
+
+  // Consumer side.  Discard the elements pushed before `pos`, a position read with end(), so
+  // that a task other than the consumer can have the ring cleared as it stood at that point.
+  // Elements pushed since stay, and a position already passed does nothing.
+  void discard_to(size_t pos) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if ((ptrdiff_t)(pos - t) > 0)
+      tail.store(pos, std::memory_order_release);
+  }
+};
+
+#endif // !ring_buffer_h_included
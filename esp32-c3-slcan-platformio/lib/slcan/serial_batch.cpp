@@ -0,0 +1,129 @@
+// Coalescing output stage for bus-to-host traffic.
+
+#include "serial_batch.h"
+
+void SerialBatch::begin(ByteSink* output) {
+  out = output;
+  blocks[0].len = blocks[1].len = 0;
+  blocks[0].frames = blocks[1].frames = 0;
+  filling = &blocks[0];
+  draining = nullptr;
+  drained = 0;
+  tx_space_max = out->available_for_write();
+}
+
+void SerialBatch::add_frame(const char* line, size_t len, uint32_t now_us) {
+  if (filling->len + len > SERIAL_BATCH_BLOCK) {
+    flush();
+  }
+  append((const uint8_t*)line, len, now_us);
+  filling->frames++;
+}
+
+int SerialBatch::available_for_write() {
+  return 2 * SERIAL_BATCH_BLOCK - filling->len - (draining ? draining->len - drained : 0);
+}
+
+size_t SerialBatch::write(const uint8_t* buf, size_t len) {
+  size_t left = len;
+  while (left > 0) {
+    size_t room = SERIAL_BATCH_BLOCK - filling->len;
+    if (room == 0) {
+      flush();
+      continue;
+    }
+    size_t n = left < room ? left : room;
+    append(buf, n, last_us);
+    buf += n;
+    left -= n;
+  }
+  return len;
+}
+
+void SerialBatch::append(const uint8_t* buf, size_t len, uint32_t now_us) {
+  last_us = now_us;
+  if (filling->len == 0) {
+    first_us = now_us;
+  }
+  memcpy(&filling->data[filling->len], buf, len);
+  filling->len += len;
+}
+
+void SerialBatch::flush() {
+  if (filling->len == 0) {
+    return;
+  }
+
+  // Both blocks are in use; the driver sets the pace.
+  drain_all();
+
+  uint32_t frames = filling->frames;
+  if (frames > 0) {
+    int bucket = 0;
+    while (bucket < SERIAL_BATCH_BUCKETS - 1 && frames >> (bucket + 1)) {
+      bucket++;
+    }
+    stats.flushes++;
+    stats.frames += frames;
+    stats.last_frames = frames;
+    if (frames > stats.max_frames) {
+      stats.max_frames = frames;
+    }
+    stats.histogram[bucket]++;
+  }
+
+  draining = filling;
+  drained = 0;
+  filling = (filling == &blocks[0]) ? &blocks[1] : &blocks[0];
+  filling->len = 0;
+  filling->frames = 0;
+  drain_some();
+}
+
+void SerialBatch::drain_some() {
+  if (draining == nullptr) {
+    return;
+  }
+  int space = out->available_for_write();
+  if (space <= 0) {
+    return;
+  }
+  size_t left = draining->len - drained;
+  size_t n = (size_t)space < left ? space : left;
+  drained += out->write(&draining->data[drained], n);
+  if (drained >= draining->len) {
+    draining = nullptr;
+  }
+}
+
+void SerialBatch::drain_all() {
+  while (draining != nullptr) {
+    size_t n = out->write(&draining->data[drained], draining->len - drained);
+    drained += n;
+    // A driver that accepts nothing even when blocking (eg no host attached) loses the rest.
+    if (n == 0) {
+      stats.dropped_bytes += draining->len - drained;
+      draining = nullptr;
+    } else if (drained >= draining->len) {
+      draining = nullptr;
+    }
+  }
+}
+
+bool SerialBatch::tx_idle() {
+  // The FIFO size is not exposed, so take the most free space ever seen to mean empty.
+  int space = out->available_for_write();
+  if (space > tx_space_max) {
+    tx_space_max = space;
+  }
+  return draining == nullptr && space >= tx_space_max;
+}
+
+bool SerialBatch::poll(uint32_t now_us) {
+  last_us = now_us;
+  drain_some();
+  if (filling->len > 0 && (now_us - first_us >= deadline_us || tx_idle())) {
+    flush();
+  }
+  return filling->len > 0 || draining != nullptr;
+}
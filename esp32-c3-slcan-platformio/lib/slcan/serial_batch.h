@@ -0,0 +1,82 @@
+// Coalescing output stage for bus-to-host traffic.
+//
+// Encoded lines are collected in one of two blocks while the other one is being handed to
+// the serial driver.  The filling block is flushed when the next line does not fit, when its
+// oldest line has waited `deadline_us`, or as soon as the driver's TX FIFO runs empty.  On a
+// quiet bus every frame therefore still goes out at once, while on a busy bus the output is
+// sent in large writes that fill whole USB packets.
+
+#ifndef serial_batch_h_included
+#define serial_batch_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "byte_stream.h"
+
+// Bytes per block, a multiple of the 64 byte full-speed USB bulk packet.
+#define SERIAL_BATCH_BLOCK 512
+
+// Default flush deadline.
+#define SERIAL_BATCH_DEADLINE_US 1000
+
+// Number of buckets in the frames-per-flush histogram: 1, 2-3, 4-7, 8-15, 16-31, 32+.
+#define SERIAL_BATCH_BUCKETS 6
+
+struct SerialBatchStats {
+  uint32_t flushes;                          // Blocks handed to the driver
+  uint32_t frames;                           // Frames in those blocks
+  uint32_t last_frames;                      // Frames in the latest block
+  uint32_t max_frames;                       // Most frames in any one block
+  uint32_t histogram[SERIAL_BATCH_BUCKETS];  // Flushes by number of frames, see above
+  uint32_t dropped_bytes;                    // Output the driver would not take
+};
+
+class SerialBatch : public ByteSink {
+  struct Block {
+    uint8_t data[SERIAL_BATCH_BLOCK];
+    size_t len;
+    uint32_t frames;
+  };
+
+  ByteSink* out = nullptr;
+  Block blocks[2];
+  Block* filling = &blocks[0];
+  Block* draining = nullptr;   // nullptr when nothing is waiting for the driver
+  size_t drained = 0;          // Bytes of *draining already written
+  uint32_t first_us = 0;       // When the first line went into *filling
+  uint32_t last_us = 0;        // Latest time passed in by the caller
+  int tx_space_max = 0;        // Largest available_for_write() seen, ie an empty TX FIFO
+
+  void append(const uint8_t* buf, size_t len, uint32_t now_us);
+  void drain_some();
+  void drain_all();
+  bool tx_idle();
+
+public:
+  uint32_t deadline_us = SERIAL_BATCH_DEADLINE_US;
+  SerialBatchStats stats = {};
+
+  void begin(ByteSink* output);
+
+  // Add one complete line holding one frame.  A line is never split across blocks.
+  void add_frame(const char* line, size_t len, uint32_t now_us);
+
+  // Raw bytes (command replies and the like).  These are not counted as frames.
+  size_t write(const uint8_t* buf, size_t len) override;
+  int available_for_write() override;
+  using ByteSink::write;
+
+  // Hand the filling block to the driver now, waiting for the previous one if necessary.
+  void flush();
+
+  // Push pending output towards the driver without blocking, and flush the filling block
+  // if its deadline has passed or the driver has gone idle.  Returns true if output is still
+  // pending, ie the caller should call again soon.
+  bool poll(uint32_t now_us);
+
+  void reset_stats() {
+    stats = {};
+  }
+};
+
+#endif // !serial_batch_h_included
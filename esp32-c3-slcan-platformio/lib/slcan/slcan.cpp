@@ -0,0 +1,2318 @@
+// SLCAN (Lawicel) protocol core.
+
+#include "slcan.h"
+#include <atomic>
+#include <stdlib.h>
+#include "bus_stats.h"
+#include "bus_supervisor.h"
+#include "change_filter.h"
+#include "can_timing.h"
+#include "isotp.h"
+#include "rate_limiter.h"
+#include "ring_buffer.h"
+#include "serial_batch.h"
+#include "slcan_binary.h"
+#include "slcan_decode.h"
+#include "slcan_encode.h"
+#include "sw_filter.h"
+#include "trigger.h"
+#include "tx_scheduler.h"
+
+// Pipelined transmit: with a nonzero window, t/T/r/R are not acked one by one but counted,
+// and a `w<queued>,<refused>` report is sent after every `ack_window` of them.
+static uint32_t ack_window = 0;
+static uint32_t window_ok = 0;
+static uint32_t window_failed = 0;
+
+// default values
+bool slcan     = true;
+bool cr        = false;
+uint8_t timestamp = 0;      // 0 = off, 1 = 16-bit ms (Z1), 2 = 32-bit us (Z2)
+const char NEW_LINE = '\r';
+
+twai_timing_config_t t_config = TWAI_TIMING_CONFIG_10KBITS();
+twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+SlcanCounters slcan_counters;
+
+// Exact set of IDs to pass to the host (see the `f` command).  Only changed while the
+// channel is closed, when CAN-RX does not look at it.
+static SwFilter sw_filter;
+
+static CanPort* port;
+static ByteSource* tty_in;
+
+// Frames received from the bus (CAN-RX -> serial-TX)
+static SpscRing<RxFrame, RX_RING_LEN> rx_ring;
+
+// Frames recorded for a later dump (CAN-RX -> serial-TX), see the `c` command.
+static SpscSpanRing<RxFrame> capture_ring;
+
+// Periodic transmission (see the `p` command).  The scheduler belongs to the timer; serial-RX
+// keeps its own copy of the settings and sends changed slots through tx_updates.
+static TxScheduler tx_scheduler;
+static TxSlotConfig tx_slots[TX_SCHED_SLOTS];
+static SpscRing<TxSlotUpdate, 64> tx_updates;
+
+// ISO-TP (see the `i` command).  The engine belongs to the timer, like the scheduler.
+// CAN-RX diverts frames with the receive ID in isotp_rx_key to it through isotp_frames, and
+// serial-RX sends it settings and PDUs through isotp_requests.  A PDU to send is collected
+// in isotp_tx_pdu, which belongs to the engine while isotp_tx_busy is set.  Results go to
+// serial-TX through isotp_out as records of a type byte, a 16-bit length and the data, and
+// are counted in isotp_records once complete.
+enum IsoTpRequestType { ISOTP_REQ_CONFIG, ISOTP_REQ_SEND, ISOTP_REQ_ABORT };
+
+struct IsoTpRequest {
+  IsoTpRequestType type;
+  IsoTpConfig config;
+  uint16_t len;
+};
+
+static const uint32_t ISOTP_OFF = 0xFFFFFFFF;     // Not a valid key
+
+static IsoTp isotp;
+static IsoTpConfig isotp_config = {0x7E0, 0x7E8, false, 0, 0, -1};   // serial-RX's copy
+static std::atomic<uint32_t> isotp_rx_key{ISOTP_OFF};
+static SpscRing<twai_message_t, 64> isotp_frames;
+static SpscRing<IsoTpRequest, 8> isotp_requests;
+static uint8_t isotp_tx_pdu[ISOTP_MAX_PDU];
+static size_t isotp_tx_len = 0;
+static std::atomic<bool> isotp_tx_busy{false};
+static SpscRing<uint8_t, ISOTP_OUT_LEN> isotp_out;
+static std::atomic<uint32_t> isotp_records{0};
+
+// Passes the engine's results on to serial-TX; runs on the timer.
+class IsoTpOut : public IsoTpListener {
+  void record(char type, const uint8_t* data, size_t len) {
+    if (isotp_out.capacity() - isotp_out.length() < 3 + len) {
+      slcan_counters.isotp_result_drops++;
+      return;
+    }
+    isotp_out.push(type);
+    isotp_out.push(len & 0xFF);
+    isotp_out.push(len >> 8);
+    for (size_t i = 0; i < len; i++)
+      isotp_out.push(data[i]);
+    isotp_records++;
+    wake = true;
+  }
+
+public:
+  bool wake = false;
+
+  void on_pdu(const uint8_t* pdu, size_t len) override {
+    record('r', pdu, len);
+  }
+  void on_sent() override {
+    isotp_tx_busy = false;
+    record('t', nullptr, 0);
+  }
+  void on_error(IsoTpError error, bool tx) override {
+    uint8_t code = error;
+    if (tx)
+      isotp_tx_busy = false;
+    record(tx ? 'e' : 'E', &code, 1);
+  }
+};
+
+static IsoTpOut isotp_results;
+
+// Command replies (serial-RX -> serial-TX)
+static SpscRing<uint8_t, REPLY_RING_LEN> reply_ring;
+
+// Replies to host commands are produced on the serial-RX task but must reach the host through
+// the serial-TX task, or they would interleave with received frames.  Bytes are staged in
+// reply_ring and only become visible to serial-TX once commit() is called, so a reply always
+// goes out as one unit between two frames.
+//
+// The sink also carries switches between ASCII and binary output (see the `x` command): a
+// switch takes effect on serial-TX exactly after the reply bytes written before it, so the
+// ack of `x1` is still ASCII and everything after it is binary.
+class ReplySink : public ByteSink {
+  static const size_t NO_SWITCH = ~(size_t)0;
+
+  size_t pushed = 0;                          // Producer only
+  std::atomic<size_t> committed{0};
+  size_t drained = 0;                         // Consumer only
+  std::atomic<size_t> switch_at{NO_SWITCH};
+  bool switch_binary = false;
+
+  void drain_to(ByteSink& out, size_t limit) {
+    uint8_t chunk[SLCAN_BIN_MAX_TEXT];
+    uint8_t record[SLCAN_BIN_MAX_RECORD];
+    while (drained != limit) {
+      size_t len = 0;
+      while (len < sizeof(chunk) && drained != limit && reply_ring.pop(&chunk[len])) {
+        len++;
+        drained++;
+      }
+      if (len == 0) break;
+      if (binary_out)
+        out.write(record, slcan_bin_encode_text(chunk, len, record));
+      else
+        out.write(chunk, len);
+    }
+  }
+
+public:
+  // Output format on serial-TX, only ever written by serial-TX.
+  bool binary_out = false;
+
+  size_t write(const uint8_t* buf, size_t len) override {
+    for (size_t i = 0; i < len; i++) {
+      if (!reply_ring.push(buf[i])) {
+        slcan_counters.reply_drops += len - i;
+        break;
+      }
+      pushed++;
+    }
+    return len;
+  }
+  int available_for_write() override {
+    return REPLY_RING_LEN - reply_ring.length();
+  }
+  using ByteSink::write;
+
+  // Producer side: publish everything written since the last commit.  Returns false if there
+  // was nothing to publish.
+  bool commit() {
+    if (pushed == committed.load(std::memory_order_relaxed)) return false;
+    committed.store(pushed, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side: true while a switch has not been carried out by serial-TX yet.
+  bool switching() {
+    return switch_at.load(std::memory_order_acquire) != NO_SWITCH;
+  }
+
+  // Producer side: switch the output format once everything written so far has been sent.
+  // Only one switch may be pending at a time.
+  void switch_output(bool binary) {
+    switch_binary = binary;
+    switch_at.store(pushed, std::memory_order_release);
+  }
+
+  // Consumer side: copy all committed bytes to `out`, as text records in binary mode.
+  // Returns false if there were none.
+  bool drain(ByteSink& out) {
+    size_t limit = committed.load(std::memory_order_acquire);
+    if (limit == drained) return false;
+    size_t at = switch_at.load(std::memory_order_acquire);
+    if (at != NO_SWITCH && at - drained <= limit - drained) {
+      drain_to(out, at);
+      binary_out = switch_binary;
+      switch_at.store(NO_SWITCH, std::memory_order_release);
+    }
+    drain_to(out, limit);
+    return true;
+  }
+};
+
+static ReplySink reply;
+
+// Coalesces everything serial-TX sends; only serial-TX may touch it.
+static SerialBatch tty_out;
+
+void slcan_ack();
+void slcan_nack();
+void slcan_ack_tx(bool ok);
+void changeAckWindow(const char *buf);
+void changeCANFilter(const char *buf, bool mask);
+void changeCANSpeed(const char *buf);
+void changeCANTiming(const char *buf);
+void changeCANBitrate(const char *buf);
+void autoBaud(const char *buf);
+void changeRecovery(const char *buf);
+void changeQueues(const char *buf);
+void changeCapture(const char *buf);
+void changeTrigger(const char *buf);
+void changeOnChange(const char *buf);
+void changeDecimation(const char *buf);
+void changeBusStats(const char *buf);
+void changeIsoTp(const char *buf);
+void changePeriodic(const char *buf);
+void changeBatching(const char *buf);
+void changeFraming(const char *buf);
+void changeSwFilter(const char *buf);
+void reportFlags();
+void reportCounters();
+void open_can(twai_mode_t mode);
+bool start_can(twai_mode_t mode);
+void stop_can();
+static bool timer_transmit(const twai_message_t& message);
+
+// -------------------------------------------------------------
+
+void slcan_begin(CanPort* can, ByteSource* in, ByteSink* out)
+{
+  port = can;
+  tty_in = in;
+  tty_out.begin(out);
+  for (size_t n = 0; n < TX_SCHED_SLOTS; n++)
+    TxScheduler::clear_config(&tx_slots[n]);
+  tx_scheduler.begin(timer_transmit);
+  isotp.begin(timer_transmit, &isotp_results);
+  isotp.configure(isotp_config);
+}
+
+void slcan_capture_memory(void* mem, size_t len)
+{
+  capture_ring.attach(mem, len);
+}
+
+static void (*schedule_kick)() = nullptr;
+
+void slcan_schedule_kick(void (*kick)())
+{
+  schedule_kick = kick;
+}
+
+// -------------------------------------------------------------
+
+// While autobaud is listening, CAN-RX counts frames here instead of forwarding them.
+static std::atomic<bool> probing{false};
+static std::atomic<uint32_t> probe_frames{0};
+
+// Mode the channel was opened in: normal (`O`), listen-only (`L`) or self-test (`Y`).
+static twai_mode_t can_mode = TWAI_MODE_NORMAL;
+
+// Bus-off recovery, run by CAN-RX.
+static BusSupervisor supervisor;
+
+// While capturing, CAN-RX records frames in the capture ring instead of forwarding them.
+// serial-TX sends up to `dump_left` of them to the host between live frames.
+static std::atomic<bool> capturing{false};
+static std::atomic<uint32_t> dump_left{0};
+
+// `cc` on serial-RX records where the capture ring ends and sets capture_clear; serial-TX,
+// the ring's consumer, then discards up to there.  The drop count is CAN-RX's, so `c` reports
+// it from the count at the last `cc`.
+static std::atomic<size_t> capture_clear_to{0};
+static std::atomic<bool> capture_clear{false};
+static uint32_t capture_drops_base;
+
+// On-change forwarding (see the `o` command): while on, CAN-RX drops frames that repeat the
+// last one of their ID.  `o1` sets change_clear before turning it on, and CAN-RX, the only
+// one using the table, clears it before its next lookup.
+static std::atomic<bool> on_change{false};
+static std::atomic<bool> change_clear{false};
+static std::atomic<uint32_t> heartbeat_us{0};
+static ChangeFilter change_filter;
+
+// Bus statistics (see the `u` command), kept by CAN-RX while on.  `u1` sets stats_clear
+// before turning them on, and CAN-RX starts them over before its next frame.
+static std::atomic<bool> stats_on{false};
+static std::atomic<bool> stats_clear{false};
+static BusStats bus_stats;
+static uint32_t stats_bus_errors;     // The controller's bus error count when turned on
+
+// Counter values at the previous `F`; a flag is set if its counter moved since then.
+static struct {
+  uint32_t rx_missed;
+  uint32_t tx_full;
+  uint32_t overrun;
+  uint32_t arb_lost;
+  uint32_t bus_error;
+} flags_seen;
+
+// The port's status epoch (see CanPort::status_epoch()) that the controller's counts above
+// were taken in.  Only serial-RX uses any of them.
+static uint32_t status_epoch;
+
+// Called on serial-RX before the controller's counters are compared with those kept above.
+// When the driver has been reinstalled since, its counters started over, so the kept counts
+// do too.
+static void rebase_status_counts()
+{
+  uint32_t epoch = port->status_epoch();
+  if (epoch == status_epoch)
+    return;
+  status_epoch = epoch;
+  stats_bus_errors = 0;
+  flags_seen.rx_missed = 0;
+  flags_seen.arb_lost = 0;
+  flags_seen.bus_error = 0;
+}
+
+// Per-ID rate limit (see the `d` command).  The rules are only changed while it is off.
+// `d1` sets decimation_clear before turning it on, and CAN-RX clears the table before its
+// next lookup, as for on-change forwarding.
+static std::atomic<bool> decimating{false};
+static std::atomic<bool> decimation_clear{false};
+static RateLimiter rate_limiter;
+
+// While triggering, CAN-RX only forwards the frames around a trigger (see the `g` command).
+// The trigger is only set up while this is off.
+static std::atomic<bool> triggering{false};
+static Trigger trigger;
+
+// Input format on serial-RX, switched by the `x` command.
+static bool binary_in = false;
+
+// -------------------------------------------------------------
+
+// Queue a frame as the channel was opened, counting it in `frames` or `queue_full`, which
+// must belong to the calling task.
+static bool transmit_frame(twai_message_t message, uint32_t timeout_ms, uint32_t* frames,
+                           uint32_t* queue_full) {
+  // A listen-only channel must never drive the bus.
+  if (!slcan || can_mode == TWAI_MODE_LISTEN_ONLY)
+    return false;
+
+  // In self-test mode the frame is also received, as no other node needs to be present.
+  if (can_mode == TWAI_MODE_NO_ACK)
+    message.self = 1;
+#ifdef SLCAN_SINGLE_SHOT
+  message.ss = 1;
+#endif
+
+  if (!port->transmit(message, timeout_ms)) {
+    (*queue_full)++;
+    return false;
+  }
+  (*frames)++;
+  return true;
+}
+
+// The host's frames, on serial-RX.
+static bool queue_canmsg(twai_message_t message) {
+  //Queue message for transmission.  In pipelined mode the host is not waiting for an ack
+  //per frame, so a full queue makes us wait for room, which in turn holds back the host.
+  return transmit_frame(message, ack_window ? SLCAN_TX_BLOCK_MS : 0,
+                        &slcan_counters.tx_frames, &slcan_counters.tx_queue_full);
+}
+
+// Frames the device sends on its own, on the timer; never waits.
+static bool timer_transmit(const twai_message_t& message) {
+  return transmit_frame(message, 0, &slcan_counters.timer_tx_frames,
+                        &slcan_counters.timer_tx_queue_full);
+}
+
+bool send_canmsg(char *buf, bool ext, bool rtr) {
+  twai_message_t message;  
+
+  if (!slcan_decode_frame(buf, strcspn(buf, "\r"), ext, rtr, &message))
+    return false;
+
+  return queue_canmsg(message);
+} // send_canmsg()
+
+
+// -------------------------------------------------------------
+
+void parse_slcancmd(char *buf)
+{                           // LAWICEL PROTOCOL
+  switch (buf[0]) {
+    case 'O':               // OPEN CAN
+      open_can(TWAI_MODE_NORMAL);
+      // CAN.begin(can_baudrate);
+      break;
+    case 'L':               // OPEN CAN LISTEN ONLY
+      open_can(TWAI_MODE_LISTEN_ONLY);
+      break;
+    case 'Y':               // (NOT SPEC) OPEN CAN SELF TEST, NO ACK AND SELF RECEPTION
+      open_can(TWAI_MODE_NO_ACK);
+      break;
+    case 'C':               // CLOSE CAN
+      slcan=false;
+      stop_can();
+      if (schedule_kick) schedule_kick();
+      // CAN.end();
+      slcan_ack();
+      break;
+    case 't':               // send std frame
+      slcan_ack_tx(send_canmsg(&buf[1],false,false));
+      break;
+    case 'T':               // send ext frame
+      slcan_ack_tx(send_canmsg(&buf[1],true,false));
+      break;
+    case 'r':               // send std rtr frame
+      slcan_ack_tx(send_canmsg(&buf[1],false,true));
+      break;
+    case 'R':               // send ext rtr frame
+      slcan_ack_tx(send_canmsg(&buf[1],true,true));
+      break;
+    case 'w':               // (NOT SPEC) PIPELINED TRANSMIT ACK WINDOW
+      changeAckWindow(&buf[1]);
+      break;
+    case 'Z':               // ENABLE TIMESTAMPS
+      switch (buf[1]) {
+        case '0':           // TIMESTAMP OFF  
+          timestamp = 0;
+          slcan_ack();
+          break;
+        case '1':           // TIMESTAMP ON
+          timestamp = 1;
+          slcan_ack();
+          break;
+        case '2':           // (NOT SPEC) 32-BIT MICROSECOND TIMESTAMP ON
+          timestamp = 2;
+          slcan_ack();
+          break;
+        default:
+          break;
+      }
+      break;
+    case 'M':               ///set ACCEPTANCE CODE ACn REG
+      changeCANFilter(&buf[1], false);
+      slcan_ack();
+      break;
+    case 'm':               // set ACCEPTANCE MASK AMn REG
+      changeCANFilter(&buf[1], true);
+      slcan_ack();
+      break;
+    case 'f':               // (NOT SPEC) SOFTWARE ACCEPTANCE FILTER
+      changeSwFilter(&buf[1]);
+      break;
+    case 'x':               // (NOT SPEC) BINARY FRAMING
+      changeFraming(&buf[1]);
+      break;
+    case 'b':               // (NOT SPEC) OUTPUT BATCHING
+      changeBatching(&buf[1]);
+      break;
+    case 'S':               // CAN bit-rate      
+      changeCANSpeed(&buf[1]);
+      break;
+    case 's':               // CAN bit timing BTR0/BTR1
+      changeCANTiming(&buf[1]);
+      break;
+    case 'B':               // (NOT SPEC) CAN BITRATE AND SAMPLE POINT
+      changeCANBitrate(&buf[1]);
+      break;
+    case 'a':               // (NOT SPEC) DETECT BITRATE
+      autoBaud(&buf[1]);
+      break;
+    case 'q':               // (NOT SPEC) QUEUE DEPTHS
+      changeQueues(&buf[1]);
+      break;
+    case 'c':               // (NOT SPEC) CAPTURE TO MEMORY AND DUMP
+      changeCapture(&buf[1]);
+      break;
+    case 'o':               // (NOT SPEC) ON-CHANGE FORWARDING
+      changeOnChange(&buf[1]);
+      break;
+    case 'i':               // (NOT SPEC) ISO-TP
+      changeIsoTp(&buf[1]);
+      break;
+    case 'u':               // (NOT SPEC) BUS STATISTICS
+      changeBusStats(&buf[1]);
+      break;
+    case 'd':               // (NOT SPEC) PER-ID RATE LIMIT
+      changeDecimation(&buf[1]);
+      break;
+    case 'g':               // (NOT SPEC) TRIGGER
+      changeTrigger(&buf[1]);
+      break;
+    case 'p':               // (NOT SPEC) PERIODIC TRANSMIT
+      changePeriodic(&buf[1]);
+      break;
+    case 'k':               // (NOT SPEC) BUS-OFF RECOVERY
+      changeRecovery(&buf[1]);
+      break;
+    case 'F':               // STATUS FLAGS SJA1000
+      reportFlags();
+      break;
+    case 'E':               // (NOT SPEC) EVENT AND ERROR COUNTERS
+      reportCounters();
+      break;
+    case 'V':               // VERSION NUMBER
+      reply.print("V1");
+      slcan_ack();
+      break;
+    case 'N':               // SERIAL NUMBER
+      reply.print("N2208");
+      slcan_ack();
+      break;
+   case 'l':               // (NOT SPEC) TOGGLE LINE FEED ON SERIAL
+      cr = !cr;
+      slcan_nack();
+      break;
+    case 'h':               // (NOT SPEC) HELP SERIAL
+      reply.println();
+      reply.println("esp32-slcan");
+      reply.println();
+      reply.println("O\t=\tStart slcan");
+      reply.println("L\t=\tStart slcan listen only");
+      reply.println("C\t=\tStop slcan");
+      reply.println("t\t=\tSend std frame");
+      reply.println("r\t=\tSend std rtr frame");
+      reply.println("T\t=\tSend ext frame");
+      reply.println("R\t=\tSend ext rtr frame");
+      reply.println("Z0\t=\tTimestamp Off");
+      reply.print("Z1\t=\tTimestamp On");
+      if (timestamp == 1) reply.print("  ON");
+      reply.println();
+      reply.println("S0\t=\tSpeed 10k");
+      reply.println("S1\t=\tSpeed 25k");
+      reply.println("S2\t=\tSpeed 50k");
+      reply.println("S3\t=\tSpeed 100k");
+      reply.println("S4\t=\tSpeed 125k");
+      reply.println("S5\t=\tSpeed 250k");
+      reply.println("S6\t=\tSpeed 500k");
+      reply.println("S7\t=\tSpeed 800k");
+      reply.println("S8\t=\tSpeed 1000k");
+      reply.println("sxxyy\t=\tBTR0/BTR1, 16 MHz SJA1000");
+      reply.println("F\t=\tFlags");
+      reply.println("N\t=\tSerial No");
+      reply.println("V\t=\tVersion");
+      reply.println("-----NOT SPEC-----");
+      reply.println("h\t=\tHelp");
+      reply.println("Y\t=\tStart slcan self test");
+      reply.println("Bn,p\t=\tBitrate n, sample point p/1000");
+      reply.println("B\t=\tShow bit timing");
+      reply.println("a\t=\tDetect bitrate, an = n ms per rate, up to 1000");
+      reply.print("Z2\t=\tTimestamp On, 32-bit us");
+      if (timestamp == 2) reply.print("  ON");
+      reply.println();
+      reply.println("E\t=\tEvent and error counters");
+      reply.println("qn,m\t=\tDriver RX queue n, TX queue m frames");
+      reply.println("q\t=\tQueue depths and frame ring use");
+      reply.println("c1\t=\tCapture frames to memory, c0 = stop");
+      reply.println("cd\t=\tDump capture, cdn = n frames");
+      reply.println("cc\t=\tClear capture");
+      reply.println("c\t=\tCapture state");
+      reply.println("o1\t=\tSend changed frames only, o0 = all");
+      reply.println("ohn\t=\tSend unchanged frames every n ms, 0 = never");
+      reply.println("osiii\t=\tFrames of std id held back, oe... ext");
+      reply.println("o\t=\tOn-change stats");
+      reply.println("iaiii,jjj\t=\tISO-TP std tx id, rx id, iA... ext");
+      reply.println("ifbb,ss\t=\tISO-TP block size, STmin asked for");
+      reply.println("ipxx\t=\tISO-TP pad frames with xx, ip = no");
+      reply.println("i1\t=\tISO-TP on, i0 = off");
+      reply.println("iwdd..\t=\tAdd bytes to PDU, ix = discard");
+      reply.println("is\t=\tSend PDU");
+      reply.println("i\t=\tISO-TP state");
+      reply.println("u1\t=\tBus statistics on, u0 = off");
+      reply.println("u\t=\tBus load and totals");
+      reply.println("ul\t=\tPer id statistics, uln = from slot n");
+      reply.println("dsiii,mmm,n\t=\tStd id/mask at most n Hz, de... ext");
+      reply.println("d1\t=\tRate limit on, d0 = off, dc = clear");
+      reply.println("d\t=\tRate limit stats");
+      reply.println("gsiii,mmm\t=\tTrigger on std id/mask, ge... ext");
+      reply.println("gbn<op>vv,mm\t=\tTrigger on data byte n, op is = ! < >");
+      reply.println("gwp,q\t=\tSend p frames before, q after trigger");
+      reply.println("g1\t=\tArm trigger, g0 = off, gc = clear");
+      reply.println("g\t=\tTrigger state");
+      reply.println("pn=tiiildd..\t=\tPeriodic slot n frame, or T/r/R");
+      reply.println("pn@m,o\t=\tSlot n every m ms, o ms offset");
+      reply.println("pncb,mm\t=\tSlot n counter in byte b, bits mm");
+      reply.println("pnkbx\t=\tSlot n checksum in byte b, x = x/s/j");
+      reply.println("pn+\t=\tStart slot n, pn- = stop");
+      reply.println("pc\t=\tClear all slots");
+      reply.println("p\t=\tList slots");
+      reply.println("kn\t=\tBus-off recovery after n ms, 0 = off");
+      reply.println("k\t=\tBus state and recovery stats");
+      reply.println("wn\t=\tAck every n frames sent, 0 = each");
+      reply.println("w\t=\tReport partial ack window now");
+      reply.println("b\t=\tOutput batching stats");
+      reply.println("bn\t=\tOutput flush deadline n us");
+      reply.print("x1\t=\tBinary framing");
+      if (binary_in) reply.print("  ON");
+      reply.println();
+      reply.println("x0\t=\tASCII framing");
+      reply.println("fsiii\t=\tPass std id, fsiii-jjj range");
+      reply.println("feiiiiiiii\t=\tPass ext id, fe...-... range");
+      reply.println("fc\t=\tClear id filter, pass all");
+      reply.println("f\t=\tId filter stats");
+      reply.print("l\t=\tToggle CR ");
+      if (cr) {
+        reply.println("ON");
+      } else {
+        reply.println("OFF");
+      }
+      reply.print("CAN_SPEED:\t");
+      reply.printf("%lu", (unsigned long)can_timing_bitrate(t_config));
+      reply.print("bps");
+      if (timestamp) {
+        reply.print("\tT");
+      }
+      if (slcan) {
+        reply.print("\tON");
+      } else {
+        reply.print("\tOFF");
+      }
+      reply.println();
+      slcan_nack();
+      break;      
+    default:
+      slcan_nack();
+      break;
+  }
+} // parse_slcancmd()
+
+//----------------------------------------------------------------
+
+void changeCANSpeed(const char *buf)
+{
+  if (slcan) { return; }
+  
+  switch (buf[0])
+  {
+    case '0': t_config = TWAI_TIMING_CONFIG_10KBITS(); slcan_ack(); break;
+    case '1': t_config = TWAI_TIMING_CONFIG_25KBITS(); slcan_ack(); break; 
+    case '2': t_config = TWAI_TIMING_CONFIG_50KBITS(); slcan_ack(); break;
+    case '3': t_config = TWAI_TIMING_CONFIG_100KBITS(); slcan_ack(); break;
+    case '4': t_config = TWAI_TIMING_CONFIG_125KBITS(); slcan_ack(); break;
+    case '5': t_config = TWAI_TIMING_CONFIG_250KBITS(); slcan_ack(); break;
+    case '6': t_config = TWAI_TIMING_CONFIG_500KBITS(); slcan_ack(); break;
+    case '7': t_config = TWAI_TIMING_CONFIG_800KBITS(); slcan_ack(); break;
+    case '8': t_config = TWAI_TIMING_CONFIG_1MBITS(); slcan_ack(); break;
+    default: slcan_nack(); return;
+  }
+}
+
+//----------------------------------------------------------------
+
+// Lawicel `sxxyy`: BTR0 and BTR1 of an SJA1000 with a 16 MHz crystal, in hex.
+
+void changeCANTiming(const char *buf)
+{
+  uint32_t btr;
+
+  if (slcan || !slcan_decode_hex(buf, 4, &btr) || buf[4] != '\r') {
+    slcan_nack();
+    return;
+  }
+  can_timing_from_btr(btr >> 8, btr & 0xFF, &t_config);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `Bn` sets the bitrate to n bit/s and `Bn,p` also the sample point to p/1000 of a bit
+// (decimal, default 875), for rates S0-S8 do not cover such as 83333 or 33333.  It is
+// refused if the controller cannot get within 0.5% of n.  `B` reports the timing in use as
+// `B<bitrate>,<sample point> brp=.. tseg1=.. tseg2=.. sjw=..`.
+
+void changeCANBitrate(const char *buf)
+{
+  if (buf[0] == '\r') {
+    reply.printf("B%lu,%lu brp=%lu tseg1=%u tseg2=%u sjw=%u",
+                 (unsigned long)can_timing_bitrate(t_config),
+                 (unsigned long)can_timing_sample_point(t_config),
+                 (unsigned long)t_config.brp, t_config.tseg_1, t_config.tseg_2, t_config.sjw);
+    slcan_ack();
+    return;
+  }
+
+  char *end;
+  unsigned long bitrate = strtoul(buf, &end, 10);
+  unsigned long sample_point = CAN_TIMING_SAMPLE_POINT;
+  if (end != buf && *end == ',') {
+    const char *p = end + 1;
+    sample_point = strtoul(p, &end, 10);
+    if (end == p)
+      end = (char *)p - 1;
+  }
+  if (slcan || end == buf || *end != '\r'
+      || !can_timing_calc(bitrate, sample_point, &t_config)) {
+    slcan_nack();
+    return;
+  }
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// Bitrates tried by autobaud, most common first.
+static const uint32_t AUTOBAUD_RATES[] = {
+  500000, 250000, 125000, 1000000, 100000, 83333, 50000, 33333, 800000, 20000, 10000
+};
+
+// `a` finds the bus bitrate by listening at each of AUTOBAUD_RATES in turn, for 200 ms each
+// or n ms with `an` (1 to 1000), so it takes at most 11 times that.  The controller is in listen-only
+// mode throughout and never drives the bus, not even to ACK or flag an error.  A rate is
+// taken at once when it has received SLCAN_AUTOBAUD_MIN_FRAMES frames without a bus error;
+// otherwise the one that received the most frames in excess of bus errors wins.  The rate
+// found is set as with `B` and reported as `a<bitrate>`, or BELL if nothing was heard.
+// Only while the channel is closed; received frames are not forwarded.
+
+void autoBaud(const char *buf)
+{
+  unsigned long dwell = SLCAN_AUTOBAUD_DWELL_MS;
+  if (buf[0] != '\r') {
+    char *end;
+    dwell = strtoul(buf, &end, 10);
+    if (end == buf || *end != '\r' || dwell == 0 || dwell > SLCAN_AUTOBAUD_MAX_DWELL_MS) {
+      slcan_nack();
+      return;
+    }
+  }
+  if (slcan) {
+    slcan_nack();
+    return;
+  }
+
+  twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  twai_timing_config_t best_timing = t_config;
+  uint32_t best_rate = 0;
+  int32_t best_score = 0;
+
+  probing = true;
+  for (uint32_t rate : AUTOBAUD_RATES) {
+    twai_timing_config_t timing;
+    twai_status_info_t info = {};
+    uint32_t frames = 0;
+
+    if (!can_timing_calc(rate, CAN_TIMING_SAMPLE_POINT, &timing))
+      continue;
+    probe_frames = 0;
+    if (!port->start(TWAI_MODE_LISTEN_ONLY, timing, accept_all))
+      continue;
+    for (unsigned long waited = 0; waited < dwell; waited += 10) {
+      port->delay_ms(10);
+      frames = probe_frames;
+      port->get_status(&info);
+      if (frames >= SLCAN_AUTOBAUD_MIN_FRAMES && info.bus_error_count == 0)
+        break;
+    }
+    port->stop();
+
+    int32_t score = (int32_t)frames - (int32_t)info.bus_error_count;
+    if (frames > 0 && score > best_score) {
+      best_score = score;
+      best_rate = rate;
+      best_timing = timing;
+    }
+    if (frames >= SLCAN_AUTOBAUD_MIN_FRAMES && info.bus_error_count == 0)
+      break;
+  }
+  probing = false;
+  // Errors seen at the wrong rates say nothing about the bus.
+  supervisor.seen = 0;
+
+  if (best_rate == 0) {
+    slcan_nack();
+    return;
+  }
+  t_config = best_timing;
+  reply.printf("a%lu", (unsigned long)best_rate);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `qn,m` sets the depth of the driver's RX and TX queues in frames (decimal), from the next
+// open on; it is refused while open or if the queues would take too much RAM.  `q` reports
+// `q rx=.. tx=.. ring=<frames>/<capacity> peak=.. drops=..` for the driver queues and the
+// frame ring behind them.
+
+void changeQueues(const char *buf)
+{
+  if (buf[0] != '\r') {
+    char *end;
+    unsigned long rx_len = strtoul(buf, &end, 10);
+    if (end == buf || *end != ',') {
+      slcan_nack();
+      return;
+    }
+    const char *p = end + 1;
+    unsigned long tx_len = strtoul(p, &end, 10);
+    if (slcan || end == p || *end != '\r' || !port->set_queue_lengths(rx_len, tx_len)) {
+      slcan_nack();
+      return;
+    }
+    slcan_ack();
+    return;
+  }
+
+  uint32_t rx_len, tx_len;
+  port->get_queue_lengths(&rx_len, &tx_len);
+  reply.printf("q rx=%lu tx=%lu ring=%lu/%lu peak=%lu drops=%lu",
+               (unsigned long)rx_len, (unsigned long)tx_len, (unsigned long)rx_ring.length(),
+               (unsigned long)rx_ring.capacity(), (unsigned long)slcan_counters.rx_ring_peak,
+               (unsigned long)slcan_counters.rx_ring_drops);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// Capture records received frames in a large ring (PSRAM where there is some) at whatever
+// rate the bus delivers, while nothing goes to the host, so bursts the serial link cannot
+// carry are kept whole.  The host dumps them later at its own pace.
+//
+// `c1` starts capturing, adding to what is already recorded, and `c0` stops; frames then
+// go to the host live again.  `cd` dumps all recorded frames and `cdn` up to n of them, in
+// the current output format, oldest first; a dump may run while capturing, and `cd0` ends
+// one.  `cc` drops the recording, and is refused while capturing or dumping.  `c` reports
+// `c on|off n=<recorded> cap=<capacity> dump=<left> drops=<lost to a full ring>`.
+//
+// The ring keeps the low 32 bits of the receive time, so Z2 and binary timestamps are exact,
+// while Z1 times of frames dumped more than 71 minutes after they came in are not.
+
+void changeCapture(const char *buf)
+{
+  char *end;
+
+  switch (buf[0]) {
+    case '\r': {
+      size_t recorded = capture_ring.length();
+      if (capture_clear && capture_ring.end() - capture_clear_to < recorded)
+        recorded = capture_ring.end() - capture_clear_to;
+      reply.printf("c %s n=%lu cap=%lu dump=%lu drops=%lu", capturing ? "on" : "off",
+                   (unsigned long)recorded, (unsigned long)capture_ring.capacity(),
+                   (unsigned long)dump_left.load(),
+                   (unsigned long)(slcan_counters.capture_drops - capture_drops_base));
+      break;
+    }
+    case '1':
+      if (buf[1] != '\r' || capture_ring.capacity() == 0) {
+        slcan_nack();
+        return;
+      }
+      capturing = true;
+      break;
+    case '0':
+      if (buf[1] != '\r') {
+        slcan_nack();
+        return;
+      }
+      capturing = false;
+      break;
+    case 'd':
+      if (buf[1] == '\r') {
+        dump_left = UINT32_MAX;
+      } else {
+        unsigned long n = strtoul(&buf[1], &end, 10);
+        if (end == &buf[1] || *end != '\r') {
+          slcan_nack();
+          return;
+        }
+        dump_left = n;
+      }
+      break;
+    case 'c':
+      // Frames CAN-RX records after this point, should it still be finishing one, are kept.
+      if (buf[1] != '\r' || capturing || dump_left != 0) {
+        slcan_nack();
+        return;
+      }
+      capture_clear_to = capture_ring.end();
+      capture_clear = true;
+      capture_drops_base = slcan_counters.capture_drops;
+      break;
+    default:
+      slcan_nack();
+      return;
+  }
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// With on-change forwarding on (`o1`), a frame is only sent if its DLC or data differ from
+// the last one sent with its ID, or if the heartbeat interval set with `ohn` (ms, decimal,
+// 0 = never) has passed since then (see change_filter.h).  `o0` turns it off, and the next
+// `o1` starts over with an empty table.  `o` reports
+// `o on|off hb=<ms> ids=<n> held=<frames held back> overflows=<frames of IDs not fitting>`,
+// and `osiii` and `oeiiiiiiii` report `o held=<n>` for one ID, or nack if it was not seen.
+
+void changeOnChange(const char *buf)
+{
+  char *end;
+  uint32_t id, held;
+
+  switch (buf[0]) {
+    case '\r':
+      reply.printf("o %s hb=%lu ids=%u held=%lu overflows=%lu", on_change ? "on" : "off",
+                   (unsigned long)heartbeat_us / 1000, (unsigned)change_filter.ids(),
+                   (unsigned long)change_filter.total_suppressed,
+                   (unsigned long)change_filter.overflows);
+      break;
+    case '1':
+      if (buf[1] != '\r') {
+        slcan_nack();
+        return;
+      }
+      if (!on_change) {
+        change_clear = true;
+        on_change = true;
+      }
+      break;
+    case '0':
+      if (buf[1] != '\r') {
+        slcan_nack();
+        return;
+      }
+      on_change = false;
+      break;
+    case 'h': {
+      unsigned long ms = strtoul(&buf[1], &end, 10);
+      if (end == &buf[1] || *end != '\r' || ms > 3600000) {
+        slcan_nack();
+        return;
+      }
+      heartbeat_us = ms * 1000;
+      break;
+    }
+    case 's':
+    case 'e': {
+      size_t digits = buf[0] == 's' ? 3 : 8;
+      if (!slcan_decode_hex(&buf[1], digits, &id) || buf[1 + digits] != '\r'
+          || id > (buf[0] == 's' ? TWAI_STD_ID_MASK : TWAI_EXTD_ID_MASK)
+          || !change_filter.suppressed(id | (buf[0] == 'e' ? RX_FRAME_EXTD : 0), &held)) {
+        slcan_nack();
+        return;
+      }
+      reply.printf("o held=%lu", (unsigned long)held);
+      break;
+    }
+    default:
+      slcan_nack();
+      return;
+  }
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// ISO-TP runs on the device (see isotp.h), so flow control and STmin are kept to within
+// microseconds, and the host only exchanges whole PDUs:
+//
+//  - `iaiii,jjj` and `iAiiiiiiii,jjjjjjjj` set the standard or extended IDs we send and
+//    receive with (hex, default 7E0 and 7E8),
+//  - `ifbb,ss` sets the block size and STmin asked of the sender (hex, as in the flow control
+//    frame, default 00,00),
+//  - `ipxx` pads frames to 8 bytes with xx, `ip` sends them short (the default),
+//  - `i1` turns it on: frames with the receive ID then go to ISO-TP instead of the host, and
+//    `i0` turns it off, giving up on transfers in progress,
+//  - `iwdd..` adds up to 128 bytes (hex) to the PDU to send, `is` sends it and `ix` discards
+//    it.  Both are refused while a PDU is being sent.  With binary framing a text record
+//    holds 30 bytes of `iw`.
+//
+// The results come as lines of their own: `Irlll<data>` for a received PDU of lll bytes
+// (hex), `It` once a PDU is sent, and `Iecc` or `IEcc` when sending or receiving failed (see
+// IsoTpError).  `i` reports
+// `i on|off tx=<id> rx=<id> bs=.. st=.. pad=..|- pdu=<bytes> busy=0|1 sent=.. received=..
+// errors=.. drops=<frames>/<results>`, the frames and results lost to a full ring.
+
+static void isotp_request(IsoTpRequestType type, uint16_t len)
+{
+  // Every request checks for room first, see changeIsoTp().
+  isotp_requests.push({type, isotp_config, len});
+  if (schedule_kick) schedule_kick();
+}
+
+void changeIsoTp(const char *buf)
+{
+  uint32_t tx_id, rx_id, value, value2;
+  bool on = isotp_rx_key != ISOTP_OFF;
+
+  if (buf[0] == '\r') {
+    const IsoTpConfig& c = isotp_config;
+    reply.printf("i %s tx=%lX rx=%lX bs=%02X st=%02X pad=", on ? "on" : "off",
+                 (unsigned long)c.tx_id, (unsigned long)c.rx_id, c.block_size, c.st_min);
+    if (c.pad >= 0)
+      reply.printf("%02X", c.pad);
+    else
+      reply.print("-");
+    reply.printf(" pdu=%u busy=%d sent=%lu received=%lu errors=%lu drops=%lu/%lu",
+                 (unsigned)isotp_tx_len, isotp_tx_busy ? 1 : 0,
+                 (unsigned long)isotp.pdus_sent, (unsigned long)isotp.pdus_received,
+                 (unsigned long)isotp.errors, (unsigned long)slcan_counters.isotp_frame_drops,
+                 (unsigned long)slcan_counters.isotp_result_drops);
+    slcan_ack();
+    return;
+  }
+
+  if (isotp_requests.is_full()) {
+    slcan_nack();
+    return;
+  }
+
+  IsoTpConfig c = isotp_config;
+  bool ok = false;
+  bool changed = false;       // c has new settings
+  switch (buf[0]) {
+    case 'a':
+    case 'A': {
+      size_t digits = buf[0] == 'a' ? 3 : 8;
+      const char *p = &buf[1];
+      uint32_t limit = buf[0] == 'a' ? TWAI_STD_ID_MASK : TWAI_EXTD_ID_MASK;
+      ok = slcan_decode_hex(p, digits, &tx_id) && p[digits] == ','
+           && slcan_decode_hex(p + digits + 1, digits, &rx_id) && p[2 * digits + 1] == '\r'
+           && tx_id <= limit && rx_id <= limit;
+      c.tx_id = tx_id;
+      c.rx_id = rx_id;
+      c.ext = buf[0] == 'A';
+      changed = true;
+      break;
+    }
+    case 'f':
+      ok = slcan_decode_hex(&buf[1], 2, &value) && buf[3] == ','
+           && slcan_decode_hex(&buf[4], 2, &value2) && buf[6] == '\r';
+      c.block_size = value;
+      c.st_min = value2;
+      changed = true;
+      break;
+    case 'p':
+      if (buf[1] == '\r') {
+        c.pad = -1;
+        ok = true;
+      } else {
+        ok = slcan_decode_hex(&buf[1], 2, &value) && buf[3] == '\r';
+        c.pad = value;
+      }
+      changed = true;
+      break;
+    case '1':
+    case '0':
+      ok = buf[1] == '\r';
+      if (!ok)
+        break;
+      on = buf[0] == '1';
+      if (!on) {
+        isotp_rx_key = ISOTP_OFF;
+        isotp_request(ISOTP_REQ_ABORT, 0);
+      }
+      break;
+    case 'w': {
+      const char *p = &buf[1];
+      size_t len = isotp_tx_len;
+      if (isotp_tx_busy)
+        break;
+      while (*p != '\r' && len < ISOTP_MAX_PDU && slcan_decode_hex(p, 2, &value)) {
+        isotp_tx_pdu[len++] = value;
+        p += 2;
+      }
+      ok = *p == '\r';
+      if (ok)
+        isotp_tx_len = len;
+      break;
+    }
+    case 'x':
+      ok = buf[1] == '\r' && !isotp_tx_busy;
+      if (ok)
+        isotp_tx_len = 0;
+      break;
+    case 's':
+      ok = buf[1] == '\r' && on && !isotp_tx_busy && isotp_tx_len > 0;
+      if (ok) {
+        isotp_tx_busy = true;
+        isotp_request(ISOTP_REQ_SEND, isotp_tx_len);
+        isotp_tx_len = 0;
+      }
+      break;
+  }
+
+  if (!ok) {
+    slcan_nack();
+    return;
+  }
+  if (changed) {
+    isotp_config = c;
+    isotp_request(ISOTP_REQ_CONFIG, 0);
+  }
+  if (on)
+    isotp_rx_key = c.rx_id | (c.ext ? RX_FRAME_EXTD : 0);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// With bus statistics on (`u1`), CAN-RX counts every frame the controller receives, before
+// any software filtering (see bus_stats.h); `u1` after `u0` starts over.  `u` reports
+// `u on|off ids=<n> frames=<n> load=<%> peak=<%> bus_err=<n> overflows=<n>`: the mean load
+// since `u1` and the highest over a second, at the current bitrate, and the bus errors the
+// controller saw meanwhile, or since the driver was last reinstalled, which clears its
+// count.  The controller does not tell which frame an error hit, so they are only counted
+// in total.
+//
+// Frames the hardware acceptance filter (`M`/`m`, or the one `f` fits) turns away never
+// reach CAN-RX, so with such a filter set the load, like everything else here, covers only
+// the traffic it accepts, not the whole bus.
+//
+// `ul` lists the IDs as `u <t|T|r|R><id> n=<frames> dlc=<last> gap=<min>/<mean>/<max>` (us),
+// one per line.  As many lines as the reply buffer takes are sent, followed by
+// `u next=<slot>` if there are more, to be fetched with `ul<slot>`, or `u end`.
+
+static unsigned long load_permille(uint64_t bits, int64_t us, uint32_t bitrate)
+{
+  if (us <= 0 || bitrate == 0)
+    return 0;
+  return bits * 1000000 / us * 1000 / bitrate;
+}
+
+static void report_stats_ids(size_t slot)
+{
+  char id[10];
+
+  for (; slot < BUS_STATS_SLOTS; slot++) {
+    const BusStatsEntry* e = bus_stats.slot(slot);
+    if (!e)
+      continue;
+    // Room for this line and the closing one.
+    if (reply.available_for_write() < 96) {
+      reply.printf("u next=%u", (unsigned)slot);
+      return;
+    }
+    bool ext = e->key & RX_FRAME_EXTD;
+    id[0] = e->key & RX_FRAME_RTR ? (ext ? 'R' : 'r') : (ext ? 'T' : 't');
+    *slcan_encode_hex(&id[1], e->key & TWAI_EXTD_ID_MASK, ext ? 8 : 3) = '\0';
+    reply.printf("u %s n=%lu dlc=%u", id, (unsigned long)e->frames, (unsigned)e->dlc);
+    if (e->frames > 1)
+      reply.printf(" gap=%lu/%lu/%lu", (unsigned long)e->min_gap_us,
+                   (unsigned long)(e->gap_sum_us / (e->frames - 1)),
+                   (unsigned long)e->max_gap_us);
+    reply.println();
+  }
+  reply.print("u end");
+}
+
+void changeBusStats(const char *buf)
+{
+  char *end;
+  twai_status_info_t info = {};
+  bool open = port->is_running() && port->get_status(&info);
+
+  rebase_status_counts();
+  switch (buf[0]) {
+    case '\r': {
+      uint32_t bitrate = can_timing_bitrate(t_config);
+      unsigned long load = load_permille(bus_stats.bits, port->now_us() - bus_stats.start_us,
+                                         bitrate);
+      unsigned long peak = load_permille(bus_stats.peak_bits_per_s, 1000000, bitrate);
+      reply.printf("u %s ids=%u frames=%lu load=%lu.%lu%% peak=%lu.%lu%%",
+                   stats_on ? "on" : "off", (unsigned)bus_stats.ids(),
+                   (unsigned long)bus_stats.frames, load / 10, load % 10, peak / 10, peak % 10);
+      reply.printf(" bus_err=%lu overflows=%lu",
+                   open ? (unsigned long)(info.bus_error_count - stats_bus_errors) : 0ul,
+                   (unsigned long)bus_stats.overflows);
+      break;
+    }
+    case '1':
+      if (buf[1] != '\r') {
+        slcan_nack();
+        return;
+      }
+      if (!stats_on) {
+        stats_clear = true;
+        stats_bus_errors = info.bus_error_count;
+        stats_on = true;
+      }
+      break;
+    case '0':
+      if (buf[1] != '\r') {
+        slcan_nack();
+        return;
+      }
+      stats_on = false;
+      break;
+    case 'l': {
+      unsigned long slot = 0;
+      if (buf[1] != '\r') {
+        slot = strtoul(&buf[1], &end, 10);
+        if (end == &buf[1] || *end != '\r') {
+          slcan_nack();
+          return;
+        }
+      }
+      report_stats_ids(slot);
+      break;
+    }
+    default:
+      slcan_nack();
+      return;
+  }
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// With the rate limit on (`d1`), each ID matching a rule is sent at most at the rule's rate,
+// the other frames of it being dropped on CAN-RX (see rate_limiter.h).  While it is off
+// (`d0`), `dsiii,mmm,n` and `deiiiiiiii,mmmmmmmm,n` add a rule for standard or extended IDs
+// whose bits under the mask m equal those of i (hex) with a rate of n Hz (decimal), the first
+// matching rule applying, and `dc` removes them all.  `d` reports
+// `d on|off ids=<n> dropped=<frames> overflows=<frames of IDs not fitting>` and the rules.
+
+void changeDecimation(const char *buf)
+{
+  char *end;
+  uint32_t code, mask;
+
+  if (buf[0] == '\r') {
+    reply.printf("d %s ids=%u dropped=%lu overflows=%lu", decimating ? "on" : "off",
+                 (unsigned)rate_limiter.ids(), (unsigned long)rate_limiter.dropped,
+                 (unsigned long)rate_limiter.overflows);
+    rate_limiter.describe(reply);
+    slcan_ack();
+    return;
+  }
+
+  if (buf[0] == '0' && buf[1] == '\r') {
+    decimating = false;
+    slcan_ack();
+    return;
+  }
+
+  // Everything else changes what CAN-RX is using.
+  if (decimating) {
+    slcan_nack();
+    return;
+  }
+
+  bool ok = false;
+  switch (buf[0]) {
+    case '1':
+      if (buf[1] == '\r') {
+        decimation_clear = true;
+        decimating = true;
+        ok = true;
+      }
+      break;
+    case 'c':
+      if (buf[1] == '\r') {
+        rate_limiter.clear_rules();
+        ok = true;
+      }
+      break;
+    case 's':
+    case 'e': {
+      size_t digits = buf[0] == 's' ? 3 : 8;
+      const char *p = &buf[1];
+      if (!slcan_decode_hex(p, digits, &code) || p[digits] != ','
+          || !slcan_decode_hex(p + digits + 1, digits, &mask) || p[2 * digits + 1] != ',')
+        break;
+      p += 2 * digits + 2;
+      unsigned long hz = strtoul(p, &end, 10);
+      ok = end != p && *end == '\r' && hz > 0 && hz <= 1000000
+           && rate_limiter.add_rule(code, mask, buf[0] == 'e', 1000000 / hz);
+      break;
+    }
+  }
+
+  if (ok)
+    slcan_ack();
+  else
+    slcan_nack();
+}
+
+//----------------------------------------------------------------
+
+// While the trigger is armed (`g1`) received frames are held back, and only those around a
+// frame matching the trigger are sent (see trigger.h), through the capture ring if capturing.
+// The condition is set while it is off (`g0`):
+//
+//  - `gsiii,mmm` and `geiiiiiiii,mmmmmmmm` match standard or extended IDs whose bits under
+//    the mask m equal those of i (hex),
+//  - `gbn<op>vv` and `gbn<op>vv,mm` test data byte n (0-7): the byte, masked with mm (hex,
+//    default FF), must be `=`, `!` (not equal), `<` or `>` than vv (hex),
+//  - `gwp,q` sends p (at most TRIGGER_MAX_PRE) frames before and q frames after it (decimal),
+//  - `gc` clears all of it, which makes every frame a trigger.
+//
+// `g` reports `g on|off fires=<n>` followed by the settings in the form above.
+
+void changeTrigger(const char *buf)
+{
+  char *end;
+  uint32_t code, mask, value;
+
+  if (buf[0] == '\r') {
+    reply.printf("g %s fires=%lu", triggering ? "on" : "off", (unsigned long)trigger.fires);
+    trigger.describe(reply);
+    slcan_ack();
+    return;
+  }
+
+  if (buf[0] == '0' && buf[1] == '\r') {
+    triggering = false;
+    slcan_ack();
+    return;
+  }
+
+  // Everything else changes what CAN-RX is using.
+  if (triggering) {
+    slcan_nack();
+    return;
+  }
+
+  bool ok = false;
+  switch (buf[0]) {
+    case '1':
+      if (buf[1] == '\r') {
+        trigger.arm();
+        trigger.fires = 0;
+        triggering = true;
+        ok = true;
+      }
+      break;
+    case 'c':
+      if (buf[1] == '\r') {
+        trigger.clear();
+        ok = true;
+      }
+      break;
+    case 's':
+    case 'e': {
+      size_t digits = buf[0] == 's' ? 3 : 8;
+      const char *p = &buf[1];
+      ok = slcan_decode_hex(p, digits, &code) && p[digits] == ','
+           && slcan_decode_hex(p + digits + 1, digits, &mask) && p[2 * digits + 1] == '\r'
+           && trigger.set_id(code, mask, buf[0] == 'e');
+      break;
+    }
+    case 'b': {
+      const char *p = &buf[3];
+      mask = 0xFF;
+      if (buf[1] < '0' || buf[1] > '9' || !slcan_decode_hex(p, 2, &value))
+        break;
+      p += 2;
+      if (*p == ',') {
+        if (!slcan_decode_hex(p + 1, 2, &mask))
+          break;
+        p += 3;
+      }
+      ok = *p == '\r' && trigger.set_byte(buf[1] - '0', buf[2], value, mask);
+      break;
+    }
+    case 'w': {
+      unsigned long pre = strtoul(&buf[1], &end, 10);
+      if (end == &buf[1] || *end != ',')
+        break;
+      const char *p = end + 1;
+      unsigned long post = strtoul(p, &end, 10);
+      ok = end != p && *end == '\r' && trigger.set_window(pre, post);
+      break;
+    }
+  }
+
+  if (ok)
+    slcan_ack();
+  else
+    slcan_nack();
+}
+
+//----------------------------------------------------------------
+
+// The device sends up to TX_SCHED_SLOTS frames periodically by itself, from a timer (see
+// tx_scheduler.h), while the channel is open in normal or self-test mode.  Slots are set up
+// with `pn...`, n being the slot number (decimal):
+//
+//  - `pn=tiiildd..`, also with T, r or R, sets the frame as the transmit commands take it,
+//  - `pn@m` and `pn@m,o` send it every m ms, o ms after the open or the start,
+//  - `pncb` and `pncb,mm` count up the bits mm (hex, default FF) of data byte b (0-7) before
+//    each transmission, `pnc` removes the counter,
+//  - `pnkbx` sets data byte b to a checksum of the others after that: x for XOR, s for the
+//    sum, j for CRC-8 SAE J1850; `pnk` removes it,
+//  - `pn+` starts the slot, which needs a frame and a period, and `pn-` stops it.
+//
+// Settings can be changed while a slot runs.  `pc` clears all slots.  `p` lists the slots
+// with a frame, one per line, as `pn +|- =<frame> @m,o [c..] [k..] sent=.. failed=.. late=..`.
+
+static void report_periodic()
+{
+  char line[SLCAN_MAX_LINE];
+
+  for (size_t n = 0; n < TX_SCHED_SLOTS; n++) {
+    const TxSlotConfig& s = tx_slots[n];
+    if (!s.has_frame)
+      continue;
+    line[slcan_encode_frame(&s.msg, 0, 0, line)] = '\0';
+    reply.printf("p%u %c =%s @%lu,%lu", (unsigned)n, s.enabled ? '+' : '-', line,
+                 (unsigned long)s.period_us / 1000, (unsigned long)s.offset_us / 1000);
+    if (s.counter_byte >= 0)
+      reply.printf(" c%d,%02X", s.counter_byte, s.counter_mask);
+    if (s.check_byte >= 0)
+      reply.printf(" k%d%c", s.check_byte, s.check_type);
+    const TxSlotStats& st = tx_scheduler.stats[n];
+    reply.printf(" sent=%lu failed=%lu late=%lu\r\n", (unsigned long)st.sent,
+                 (unsigned long)st.failed, (unsigned long)st.late);
+  }
+}
+
+// Parse a data byte index 0-7 at p.
+static bool decode_byte_index(const char *p, int8_t *index)
+{
+  if (*p < '0' || *p >= '0' + TWAI_FRAME_MAX_DLC)
+    return false;
+  *index = *p - '0';
+  return true;
+}
+
+void changePeriodic(const char *buf)
+{
+  char *end;
+
+  if (buf[0] == '\r') {
+    report_periodic();
+    slcan_ack();
+    return;
+  }
+
+  // Every change is one update per slot, so make sure they all fit.
+  if (TX_SCHED_SLOTS > tx_updates.capacity() - tx_updates.length()) {
+    slcan_nack();
+    return;
+  }
+
+  if (buf[0] == 'c' && buf[1] == '\r') {
+    for (size_t n = 0; n < TX_SCHED_SLOTS; n++) {
+      TxScheduler::clear_config(&tx_slots[n]);
+      tx_updates.push({(uint8_t)n, tx_slots[n]});
+    }
+    if (schedule_kick) schedule_kick();
+    slcan_ack();
+    return;
+  }
+
+  unsigned long n = strtoul(buf, &end, 10);
+  if (end == buf || n >= TX_SCHED_SLOTS) {
+    slcan_nack();
+    return;
+  }
+  TxSlotConfig s = tx_slots[n];
+  const char *p = end + 1;
+  bool ok = false;
+
+  switch (*end) {
+    case '=': {
+      bool ext = *p == 'T' || *p == 'R';
+      bool rtr = *p == 'r' || *p == 'R';
+      ok = (ext || rtr || *p == 't')
+           && slcan_decode_frame(p + 1, strcspn(p + 1, "\r"), ext, rtr, &s.msg);
+      s.has_frame = s.has_frame || ok;
+      break;
+    }
+    case '@': {
+      unsigned long period = strtoul(p, &end, 10);
+      unsigned long offset = 0;
+      if (end != p && *end == ',') {
+        p = end + 1;
+        offset = strtoul(p, &end, 10);
+      }
+      ok = end != p && *end == '\r' && period > 0 && period <= 3600000 && offset <= 3600000;
+      s.period_us = period * 1000;
+      s.offset_us = offset * 1000;
+      break;
+    }
+    case 'c': {
+      if (*p == '\r') {
+        s.counter_byte = -1;
+        ok = true;
+        break;
+      }
+      uint32_t mask = 0xFF;
+      if (!decode_byte_index(p, &s.counter_byte))
+        break;
+      p++;
+      if (*p == ',') {
+        if (!slcan_decode_hex(p + 1, 2, &mask))
+          break;
+        p += 3;
+      }
+      s.counter_mask = mask;
+      ok = *p == '\r' && mask != 0;
+      break;
+    }
+    case 'k':
+      if (*p == '\r') {
+        s.check_byte = -1;
+        ok = true;
+        break;
+      }
+      s.check_type = p[1];
+      ok = decode_byte_index(p, &s.check_byte) && p[2] == '\r'
+           && (p[1] == TX_CHECK_XOR || p[1] == TX_CHECK_SUM || p[1] == TX_CHECK_J1850);
+      break;
+    case '+':
+      s.enabled = true;
+      ok = *p == '\r' && s.has_frame && s.period_us > 0;
+      break;
+    case '-':
+      s.enabled = false;
+      ok = *p == '\r';
+      break;
+  }
+
+  if (!ok) {
+    slcan_nack();
+    return;
+  }
+  tx_slots[n] = s;
+  tx_updates.push({(uint8_t)n, s});
+  if (schedule_kick) schedule_kick();
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `kn` sets the wait before the first automatic recovery from bus-off to n ms (decimal); it
+// doubles, up to 5 s or n if that is longer, while the bus keeps going off again within
+// 10 s.  `k0` turns automatic recovery off, leaving it to the host to close and reopen.  `k`
+// reports `k<state> backoff=.. bus_off=.. recovered=..`.
+
+void changeRecovery(const char *buf)
+{
+  if (buf[0] != '\r') {
+    char *end;
+    unsigned long ms = strtoul(buf, &end, 10);
+    if (end == buf || *end != '\r') {
+      slcan_nack();
+      return;
+    }
+    supervisor.backoff_ms = ms;
+    slcan_ack();
+    return;
+  }
+
+  reply.printf("k%s backoff=%lu bus_off=%lu recovered=%lu",
+               port->is_running() ? BusSupervisor::state_name(supervisor.state) : "closed",
+               (unsigned long)supervisor.backoff_ms, (unsigned long)supervisor.bus_offs,
+               (unsigned long)supervisor.recoveries);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `b` reports how many frames went into each flush to the host, `bn` sets the flush
+// deadline to n microseconds (decimal).  With 0 output is flushed whenever the frame ring
+// runs empty.
+
+void changeBatching(const char *buf)
+{
+  if (buf[0] != '\r') {
+    char *end;
+    unsigned long us = strtoul(buf, &end, 10);
+    if (end == buf || *end != '\r') {
+      slcan_nack();
+      return;
+    }
+    tty_out.deadline_us = us;
+    slcan_ack();
+    return;
+  }
+
+  // The counters are updated by serial-TX; a torn read here is harmless.
+  SerialBatchStats s = tty_out.stats;
+  reply.printf("b%lu flushes=%lu frames=%lu last=%lu max=%lu hist=%lu/%lu/%lu/%lu/%lu/%lu",
+               (unsigned long)tty_out.deadline_us, (unsigned long)s.flushes,
+               (unsigned long)s.frames, (unsigned long)s.last_frames,
+               (unsigned long)s.max_frames, (unsigned long)s.histogram[0],
+               (unsigned long)s.histogram[1], (unsigned long)s.histogram[2],
+               (unsigned long)s.histogram[3], (unsigned long)s.histogram[4],
+               (unsigned long)s.histogram[5]);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `x1` switches both directions to the binary records of slcan_binary.h, `x0` back to ASCII.
+// Input switches as soon as the command has been read, output right after its ack, so in
+// binary mode `x0` arrives in a text record and its ack leaves in one.
+
+void changeFraming(const char *buf)
+{
+  if ((buf[0] != '0' && buf[0] != '1') || buf[1] != '\r' || reply.switching()) {
+    slcan_nack();
+    return;
+  }
+  binary_in = buf[0] == '1';
+  slcan_ack();
+  reply.switch_output(binary_in);
+}
+
+//----------------------------------------------------------------
+
+// `wn` sets the ack window to n frames (decimal), 0 restoring one ack per frame.  Any frames
+// counted so far are reported first.  `w` alone reports the partial window now, which a host
+// uses at the end of a burst, as `w<queued>,<refused>`.
+
+void changeAckWindow(const char *buf)
+{
+  if (buf[0] != '\r') {
+    char *end;
+    unsigned long n = strtoul(buf, &end, 10);
+    if (end == buf || *end != '\r') {
+      slcan_nack();
+      return;
+    }
+    if (window_ok + window_failed > 0)
+      changeAckWindow("\r");
+    ack_window = n;
+    slcan_ack();
+    return;
+  }
+
+  reply.printf("w%lu,%lu\r", (unsigned long)window_ok, (unsigned long)window_failed);
+  window_ok = 0;
+  window_failed = 0;
+}
+
+//----------------------------------------------------------------
+
+static uint32_t tx_queue_fulls()
+{
+  return slcan_counters.tx_queue_full + slcan_counters.timer_tx_queue_full;
+}
+
+static uint32_t bridge_overruns()
+{
+  return slcan_counters.rx_ring_drops + slcan_counters.reply_drops
+         + tty_out.stats.dropped_bytes;
+}
+
+// Lawicel `F`: reply `Fxx\r` with the SJA1000 style flags, clearing them, or BELL when the
+// channel is closed.
+
+void reportFlags()
+{
+  twai_status_info_t info;
+
+  if (!port->is_running() || !port->get_status(&info)) {
+    slcan_nack();
+    return;
+  }
+
+  uint8_t flags = 0;
+  uint32_t overrun = bridge_overruns();
+
+  rebase_status_counts();
+
+  if (info.rx_missed_count != flags_seen.rx_missed) flags |= SLCAN_F_RX_FIFO_FULL;
+  if (tx_queue_fulls() != flags_seen.tx_full) flags |= SLCAN_F_TX_FIFO_FULL;
+  if (info.tx_error_counter >= 96 || info.rx_error_counter >= 96) flags |= SLCAN_F_ERR_WARNING;
+  if (overrun != flags_seen.overrun) flags |= SLCAN_F_DATA_OVERRUN;
+  if (info.tx_error_counter >= 128 || info.rx_error_counter >= 128
+      || info.state == TWAI_STATE_BUS_OFF || info.state == TWAI_STATE_RECOVERING)
+    flags |= SLCAN_F_ERR_PASSIVE;
+  if (info.arb_lost_count != flags_seen.arb_lost) flags |= SLCAN_F_ARB_LOST;
+  if (info.bus_error_count != flags_seen.bus_error) flags |= SLCAN_F_BUS_ERROR;
+
+  // States the controller passed through since the last `F`, even if it has left them.
+  uint32_t alerts = supervisor.seen.exchange(0);
+  if (alerts & TWAI_ALERT_RX_QUEUE_FULL) flags |= SLCAN_F_RX_FIFO_FULL;
+  if (alerts & TWAI_ALERT_ABOVE_ERR_WARN) flags |= SLCAN_F_ERR_WARNING;
+  if (alerts & (TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF)) flags |= SLCAN_F_ERR_PASSIVE;
+  if (alerts & TWAI_ALERT_BUS_OFF) flags |= SLCAN_F_BUS_ERROR;
+
+  flags_seen.rx_missed = info.rx_missed_count;
+  flags_seen.tx_full = tx_queue_fulls();
+  flags_seen.overrun = overrun;
+  flags_seen.arb_lost = info.arb_lost_count;
+  flags_seen.bus_error = info.bus_error_count;
+
+  reply.printf("F%02X\r", flags);
+}
+
+//----------------------------------------------------------------
+
+// `E` reports every counter the bridge keeps, as key=value pairs, so the host can tell where
+// frames are being lost.  The controller's counters are only available while it is open.
+
+void reportCounters()
+{
+  twai_status_info_t info = {};
+  bool open = port->is_running() && port->get_status(&info);
+
+  reply.printf("E rx=%lu rx_missed=%lu ring_drops=%lu tx=%lu tx_full=%lu",
+               (unsigned long)slcan_counters.rx_frames, (unsigned long)info.rx_missed_count,
+               (unsigned long)slcan_counters.rx_ring_drops,
+               (unsigned long)(slcan_counters.tx_frames + slcan_counters.timer_tx_frames),
+               (unsigned long)tx_queue_fulls());
+  reply.printf(" tx_failed=%lu bus_err=%lu arb_lost=%lu tec=%lu rec=%lu",
+               (unsigned long)info.tx_failed_count, (unsigned long)info.bus_error_count,
+               (unsigned long)info.arb_lost_count, (unsigned long)info.tx_error_counter,
+               (unsigned long)info.rx_error_counter);
+  reply.printf(" filtered=%lu reply_drops=%lu tty_drops=%lu state=%s",
+               (unsigned long)slcan_counters.rx_filtered,
+               (unsigned long)slcan_counters.reply_drops,
+               (unsigned long)tty_out.stats.dropped_bytes,
+               !open ? "closed"
+               : info.state == TWAI_STATE_BUS_OFF ? "bus_off"
+               : info.state == TWAI_STATE_RECOVERING ? "recovering"
+               : (info.tx_error_counter >= 128 || info.rx_error_counter >= 128) ? "passive"
+               : "active");
+  reply.printf(" open_fails=%lu open_us=%lu close_us=%lu bus_off=%lu recovered=%lu",
+               (unsigned long)slcan_counters.open_fails, (unsigned long)slcan_counters.open_us,
+               (unsigned long)slcan_counters.close_us, (unsigned long)supervisor.bus_offs,
+               (unsigned long)supervisor.recoveries);
+  slcan_ack();
+}
+
+//----------------------------------------------------------------
+
+// `fsiii` and `feiiiiiiii` add a standard or extended ID to the software filter, and
+// `fsiii-jjj` and `feiiiiiiii-jjjjjjjj` a range of them (hex, with leading zeros as in t/T).
+// `fc` clears it, after which everything is passed again.  Changes are only accepted while
+// the channel is closed; on the next `O` the controller is programmed with the single or dual
+// filter that best covers the set instead of the one set with M/m.  `f` reports the number
+// of entries, that filter, the expected IDs it lets through per wanted ID (`pass`) and how
+// many frames the software filter has dropped.
+
+void changeSwFilter(const char *buf)
+{
+  if (buf[0] == '\r') {
+    HwFilterFit fit = {f_config, 0, 0, 0};
+    if (sw_filter.active())
+      fit = sw_filter.hw_filter();
+    reply.printf("f std=%u ext=%u ranges=%u %s code=%08lX mask=%08lX",
+                 (unsigned)sw_filter.std_ids(), (unsigned)sw_filter.ext_ids(),
+                 (unsigned)sw_filter.ext_ranges_used(),
+                 fit.config.single_filter ? "single" : "dual",
+                 (unsigned long)fit.config.acceptance_code,
+                 (unsigned long)fit.config.acceptance_mask);
+    if (fit.wanted > 0) {
+      // Expected IDs let through per wanted ID, 1.00 being a perfect fit.
+      unsigned long ratio = (fit.std_passed + fit.ext_passed) * 100 / fit.wanted + 0.5;
+      reply.printf(" pass=%lu.%02lu std_pass=%lu ext_pass=%lu", ratio / 100, ratio % 100,
+                   (unsigned long)fit.std_passed, (unsigned long)fit.ext_passed);
+    }
+    reply.printf(" dropped=%lu", (unsigned long)slcan_counters.rx_filtered);
+    slcan_ack();
+    return;
+  }
+
+  if (slcan) {
+    slcan_nack();
+    return;
+  }
+
+  if (buf[0] == 'c' && buf[1] == '\r') {
+    sw_filter.clear();
+    slcan_ack();
+    return;
+  }
+
+  size_t digits;
+  if (buf[0] == 's')
+    digits = 3;
+  else if (buf[0] == 'e')
+    digits = 8;
+  else {
+    slcan_nack();
+    return;
+  }
+
+  uint32_t lo, hi;
+  const char *p = &buf[1];
+  if (!slcan_decode_hex(p, digits, &lo)) {
+    slcan_nack();
+    return;
+  }
+  p += digits;
+  hi = lo;
+  if (*p == '-') {
+    if (!slcan_decode_hex(p + 1, digits, &hi)) {
+      slcan_nack();
+      return;
+    }
+    p += 1 + digits;
+  }
+  if (*p != '\r') {
+    slcan_nack();
+    return;
+  }
+
+  bool ok = buf[0] == 's' ? sw_filter.add_std(lo, hi) : sw_filter.add_ext(lo, hi);
+  if (ok)
+    slcan_ack();
+  else
+    slcan_nack();
+}
+
+//----------------------------------------------------------------
+
+void changeCANFilter(const char *buf, bool mask)
+{
+  if (slcan) { return; }
+
+  if(mask)
+    sscanf(&buf[0], "%08X", &f_config.acceptance_mask);      
+  else
+    sscanf(&buf[0], "%08X", &f_config.acceptance_code);      
+}
+
+//----------------------------------------------------------------
+
+void slcan_ack()
+{
+  reply.write("Z\r",2);
+} // slcan_ack()
+
+//----------------------------------------------------------------
+
+// Acknowledge a t/T/r/R command, either at once or as part of the ack window.
+
+void slcan_ack_tx(bool ok)
+{
+  if (ack_window == 0) {
+    if (ok)
+      slcan_ack();
+    else
+      slcan_nack();
+    return;
+  }
+
+  if (ok)
+    window_ok++;
+  else
+    window_failed++;
+  if (window_ok + window_failed >= ack_window)
+    changeAckWindow("\r");
+}
+
+//----------------------------------------------------------------
+
+void slcan_nack()
+{
+#ifdef SLCAN_NACK_NO_CR
+  reply.write("\a",1);
+#else
+  reply.write("\a\r",2);
+#endif
+} // slcan_nack()
+
+// -------------------------------------------------------------
+
+// Longest command that starts with `c`.
+static size_t max_cmd(char c)
+{
+  return c == 'i' ? SLCAN_MAX_ISOTP_CMD : SLCAN_MAX_CMD;
+}
+
+// Execute one binary record of `len` bytes, without its terminating zero.
+
+static void parse_binrecord(uint8_t *rec, size_t len)
+{
+  twai_message_t message;
+  const char *text;
+  size_t text_len;
+  char cmd[SLCAN_MAX_ISOTP_CMD + 1];
+
+  switch (slcan_bin_decode(rec, len, &message, &text, &text_len)) {
+    case SLCAN_BIN_FRAME:
+      slcan_ack_tx(queue_canmsg(message));
+      break;
+    case SLCAN_BIN_TEXT:
+      if (text_len == 0 || text_len > max_cmd(text[0]) || text[text_len - 1] != '\r') {
+        slcan_nack();
+        break;
+      }
+      memcpy(cmd, text, text_len);
+      cmd[text_len] = '\0';
+      parse_slcancmd(cmd);
+      break;
+    default:
+      slcan_nack();
+      break;
+  }
+}
+
+bool xfer_tty2can()
+{
+  int ser_length;
+  bool replied = false;
+  static char cmdbuf[SLCAN_MAX_ISOTP_CMD];
+  static int cmdidx = 0;
+  static uint8_t binbuf[SLCAN_BIN_MAX_RECORD];
+  static size_t binidx = 0;
+  static bool binskip = false;
+
+  if ((ser_length = tty_in->available()) <= 0)
+    return false;
+
+  for (int i = 0; i < ser_length; i++) {
+    char val = tty_in->read();
+
+    if (binary_in) {
+      // Records end at a zero byte.  An overlong one is dropped up to the next zero.
+      if (val != 0) {
+        if (binidx == sizeof(binbuf))
+          binskip = true;
+        else
+          binbuf[binidx++] = val;
+        continue;
+      }
+      if (binskip)
+        slcan_nack();
+      else if (binidx > 0)
+        parse_binrecord(binbuf, binidx);
+      replied |= reply.commit();
+      binidx = 0;
+      binskip = false;
+      continue;
+    }
+
+    cmdbuf[cmdidx++] = val;
+
+    if ((size_t)cmdidx == max_cmd(cmdbuf[0]))
+    {
+      slcan_nack();
+      replied |= reply.commit();
+      cmdidx = 0;
+      continue;
+    }
+    
+    if (val == '\r')
+    {
+      cmdbuf[cmdidx] = '\0';
+      parse_slcancmd(cmdbuf);
+      replied |= reply.commit();
+      cmdidx = 0;
+    }
+  }
+  return replied;
+} //xfer_tty2can()
+
+// -------------------------------------------------------------
+
+static void pack_frame(const twai_message_t& msg, uint32_t rx_us, RxFrame* frame)
+{
+  frame->id_flags = msg.identifier | (msg.extd ? RX_FRAME_EXTD : 0)
+                    | (msg.rtr ? RX_FRAME_RTR : 0);
+  frame->rx_us = rx_us;
+  frame->dlc = msg.data_length_code;
+  memcpy(frame->data, msg.data, TWAI_FRAME_MAX_DLC);
+}
+
+static void unpack_frame(const RxFrame& frame, twai_message_t* msg)
+{
+  msg->flags = 0;
+  msg->identifier = frame.id_flags & TWAI_EXTD_ID_MASK;
+  msg->extd = (frame.id_flags & RX_FRAME_EXTD) != 0;
+  msg->rtr = (frame.id_flags & RX_FRAME_RTR) != 0;
+  msg->data_length_code = frame.dlc;
+  memcpy(msg->data, frame.data, TWAI_FRAME_MAX_DLC);
+}
+
+// Queue a received frame for the host, or record it while capturing.  Returns true if
+// serial-TX should be woken.
+static bool forward_frame(const RxFrame& frame)
+{
+  if (capturing) {
+    if (!capture_ring.push(frame)) {
+      slcan_counters.capture_drops++;
+      return false;
+    }
+    // Only worth waking serial-TX for if it is dumping.
+    return dump_left != 0;
+  }
+
+  // If serial-TX cannot keep up the frame is dropped here rather than blocking the driver.
+  if (!rx_ring.push(frame)) {
+    slcan_counters.rx_ring_drops++;
+    return false;
+  }
+  size_t queued = rx_ring.length();
+  if (queued > slcan_counters.rx_ring_peak)
+    slcan_counters.rx_ring_peak = queued;
+  return true;
+}
+
+// Called on CAN-RX: carry out the clears serial-RX asked for.
+static void serve_clears()
+{
+  if (change_clear.load(std::memory_order_relaxed) && change_clear.exchange(false))
+    change_filter.clear();
+  if (decimation_clear.load(std::memory_order_relaxed) && decimation_clear.exchange(false))
+    rate_limiter.clear_ids();
+  if (stats_clear.load(std::memory_order_relaxed) && stats_clear.exchange(false))
+    bus_stats.clear(port->now_us());
+}
+
+bool xfer_can2ring(uint32_t timeout_ms)
+{
+  twai_message_t msg;
+  RxFrame frame;
+
+  if (!port->receive(&msg, timeout_ms))
+    return false;
+  serve_clears();
+
+  // CAN-RX is the highest priority task and waits inside receive(), so unless the driver
+  // queue has backed up this is within microseconds of the RX interrupt.
+  int64_t rx_us = port->now_us();
+
+  if (probing) {
+    probe_frames++;
+    return false;
+  }
+
+  slcan_counters.rx_frames++;
+  if (stats_on)
+    bus_stats.add(msg, rx_us);
+
+  // ISO-TP takes its frames before any filtering; the host gets them as PDUs.
+  uint32_t isotp_key = isotp_rx_key.load(std::memory_order_relaxed);
+  if (isotp_key != ISOTP_OFF && !msg.rtr
+      && (msg.identifier | (msg.extd ? RX_FRAME_EXTD : 0)) == isotp_key) {
+    if (!isotp_frames.push(msg))
+      slcan_counters.isotp_frame_drops++;
+    if (schedule_kick) schedule_kick();
+    return false;
+  }
+  if (sw_filter.active() && !sw_filter.match(msg)) {
+    slcan_counters.rx_filtered++;
+    return false;
+  }
+
+  pack_frame(msg, rx_us, &frame);
+  if (on_change && !change_filter.pass(frame, heartbeat_us))
+    return false;
+  if (decimating && !rate_limiter.pass(frame))
+    return false;
+  if (!triggering)
+    return forward_frame(frame);
+
+  switch (trigger.feed(frame)) {
+    case TRIGGER_HOLD:
+      return false;
+    case TRIGGER_FIRE: {
+      RxFrame before;
+      bool wake = false;
+      while (trigger.pop_pre(&before))
+        wake |= forward_frame(before);
+      return forward_frame(frame) || wake;
+    }
+    default:
+      return forward_frame(frame);
+  }
+}
+
+// -------------------------------------------------------------
+
+void xfer_supervise()
+{
+  serve_clears();
+  supervisor.poll(port, port->now_us());
+}
+
+// -------------------------------------------------------------
+
+uint32_t xfer_schedule(bool* wake_tty)
+{
+  int64_t now_us = port->now_us();
+  TxSlotUpdate update;
+  IsoTpRequest request;
+  twai_message_t msg;
+
+  while (tx_updates.pop(&update))
+    tx_scheduler.update(update, now_us);
+
+  isotp_results.wake = false;
+  while (isotp_requests.pop(&request)) {
+    switch (request.type) {
+      case ISOTP_REQ_CONFIG:
+        isotp.configure(request.config);
+        break;
+      case ISOTP_REQ_SEND:
+        if (!isotp.send(isotp_tx_pdu, request.len, now_us))
+          isotp_results.on_error(ISOTP_ERR_ABORTED, true);
+        break;
+      case ISOTP_REQ_ABORT:
+        isotp.abort();
+        break;
+    }
+  }
+  while (isotp_frames.pop(&msg))
+    isotp.on_frame(msg, now_us);
+
+  uint32_t wait_us = 0;
+  if (!port->is_running() || can_mode == TWAI_MODE_LISTEN_ONLY) {
+    tx_scheduler.stop();
+    isotp.abort();
+  } else {
+    wait_us = tx_scheduler.run(now_us);
+    uint32_t isotp_wait_us = isotp.poll(now_us);
+    if (isotp_wait_us > 0 && (wait_us == 0 || isotp_wait_us < wait_us))
+      wait_us = isotp_wait_us;
+  }
+  *wake_tty = isotp_results.wake;
+  return wait_us;
+}
+
+// -------------------------------------------------------------
+
+// Send `len` bytes of a line to the host, as a text record in binary mode.
+static void tty_text(const char* text, size_t len)
+{
+  if (reply.binary_out) {
+    uint8_t record[SLCAN_BIN_MAX_RECORD];
+    tty_out.write(record, slcan_bin_encode_text((const uint8_t*)text, len, record));
+  } else {
+    tty_out.write(text, len);
+  }
+}
+
+// Send the next ISO-TP result as a line (see the `i` command).  Returns false if there was
+// none.
+static bool send_isotp_result()
+{
+  char line[SLCAN_BIN_MAX_TEXT];
+  uint8_t type, lo, hi, b;
+
+  if (isotp_records == 0)
+    return false;
+
+  // A record is only counted once all of it is in the ring, so it is never short; should one
+  // be anyway, nothing of it is sent.
+  if (!isotp_out.pop(&type) || !isotp_out.pop(&lo) || !isotp_out.pop(&hi))
+    return false;
+  size_t len = lo | hi << 8;
+  if (isotp_out.length() < len)
+    return false;
+
+  line[0] = 'I';
+  line[1] = type;
+  size_t n = 2;
+  if (type == 'r')
+    n = slcan_encode_hex(&line[2], len, 3) - line;
+  for (size_t i = 0; i < len; i++) {
+    if (n + 2 > sizeof(line)) {
+      tty_text(line, n);
+      n = 0;
+    }
+    if (!isotp_out.pop(&b))
+      break;
+    n = slcan_encode_hex(&line[n], b, 2) - line;
+  }
+  if (n + 3 > sizeof(line)) {
+    tty_text(line, n);
+    n = 0;
+  }
+  line[n++] = NEW_LINE;
+  if (cr) {
+    line[n++] = '\r';
+    line[n++] = '\n';
+  }
+  tty_text(line, n);
+  isotp_records--;
+
+  // The host is waiting for it.
+  tty_out.flush();
+  return true;
+}
+
+// Take the next frame to send: live frames first, then any the host asked to be dumped.
+static bool next_frame(RxFrame* frame)
+{
+  if (capture_clear.exchange(false))
+    capture_ring.discard_to(capture_clear_to);
+
+  if (rx_ring.pop(frame))
+    return true;
+
+  uint32_t left = dump_left.load();
+  if (left == 0)
+    return false;
+  if (!capture_ring.pop(frame)) {
+    // Recorded frames are all sent; a dump of everything ends here.
+    if (left == UINT32_MAX)
+      dump_left.compare_exchange_strong(left, 0);
+    return false;
+  }
+  // serial-RX may have set a new count meanwhile, which then stands.
+  dump_left.compare_exchange_strong(left, left == UINT32_MAX ? left : left - 1);
+  return true;
+}
+
+bool xfer_can2tty()
+{
+  char line[SLCAN_MAX_LINE];
+  size_t len;
+  RxFrame frame;
+  twai_message_t msg;
+
+  if (!next_frame(&frame))
+    return send_isotp_result();
+
+  unpack_frame(frame, &msg);
+
+  // The ring keeps only the low half of the receive time; no frame waits 71 minutes, so the
+  // rest follows from the time now.
+  int64_t now_us = port->now_us();
+  int64_t rx_us = now_us - (uint32_t)((uint32_t)now_us - frame.rx_us);
+
+  if (reply.binary_out) {
+    uint8_t record[SLCAN_BIN_MAX_RECORD];
+    len = slcan_bin_encode_frame(&msg, frame.rx_us, record);
+    tty_out.add_frame((const char*)record, len, now_us);
+    return true;
+  }
+
+  switch (timestamp) {
+    case 1:                 // ms, wrapping at 60000 as the Lawicel spec has it
+      len = slcan_encode_frame(&msg, (rx_us / 1000) % 60000, 4, line);
+      break;
+    case 2:                 // us, wrapping at 2^32 (about 71 minutes)
+      len = slcan_encode_frame(&msg, frame.rx_us, 8, line);
+      break;
+    default:
+      len = slcan_encode_frame(&msg, 0, 0, line);
+      break;
+  }
+
+  line[len++] = NEW_LINE;
+  if (cr) {
+    line[len++] = '\r';
+    line[len++] = '\n';
+  }
+
+  tty_out.add_frame(line, len, now_us);
+  return true;
+}
+
+// -------------------------------------------------------------
+
+bool xfer_reply2tty()
+{
+  // Replies are flushed at once since the host is waiting for them.
+  if (!reply.drain(tty_out))
+    return false;
+  tty_out.flush();
+  return true;
+}
+
+// -------------------------------------------------------------
+
+bool xfer_poll_tty()
+{
+  return tty_out.poll(port->now_us());
+}
+
+// -------------------------------------------------------------
+
+// O, L and Y.  Opening a channel that is already open is refused.
+
+void open_can(twai_mode_t mode)
+{
+  if (port->is_running()) {
+    slcan_nack();
+    return;
+  }
+  slcan = start_can(mode);
+  if (slcan)
+    slcan_ack();
+  else
+    slcan_nack();
+  if (slcan && schedule_kick)
+    schedule_kick();
+}
+
+// Open and close are timed, see `E`: with unchanged settings they only start and stop the
+// controller, anything else reinstalls the driver.
+
+bool start_can(twai_mode_t mode)
+{
+  can_mode = mode;
+  twai_filter_config_t filter = f_config;
+  if (sw_filter.active())
+    filter = sw_filter.hw_filter().config;
+
+  supervisor.reset();
+  int64_t t0 = port->now_us();
+  bool ok = port->start(mode, t_config, filter);
+  slcan_counters.open_us = port->now_us() - t0;
+  if (!ok)
+    slcan_counters.open_fails++;
+  return ok;
+}
+
+void stop_can()
+{
+  int64_t t0 = port->now_us();
+  port->stop();
+  slcan_counters.close_us = port->now_us() - t0;
+}
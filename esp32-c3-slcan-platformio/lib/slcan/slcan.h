@@ -0,0 +1,155 @@
+// SLCAN (Lawicel) protocol core.
+//
+// Hardware independent: the host is reached through a ByteSource/ByteSink pair and the bus
+// through a CanPort.  The functions are meant to be called from three tasks:
+//
+//  - CAN-RX calls xfer_can2ring() to move received frames into the frame ring, and
+//    xfer_supervise() to watch over the controller,
+//  - serial-RX calls xfer_tty2can() to read and execute host commands,
+//  - serial-TX calls xfer_reply2tty(), xfer_can2tty() and xfer_poll_tty() and is the only
+//    one writing to the host.
+//
+// The three talk through lock-free single-producer single-consumer rings, so each
+// function may only ever be called from its own task.
+
+#ifndef slcan_h_included
+#define slcan_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "driver/twai.h"
+#include "byte_stream.h"
+#include "can_port.h"
+
+// Frames waiting for serial-TX, and reply bytes waiting for serial-TX.  The frame ring is the
+// second-level buffer behind the driver's RX queue that rides out stalls on the host side,
+// so it is as large as the target's RAM allows: at 1 Mbit/s a full bus delivers about
+// 8000 frames a second.  A reply is only handed to serial-TX once it is complete, so the
+// reply ring must hold the longest one, the `h` help, whole.
+#if CONFIG_IDF_TARGET_ESP32S3
+#define RX_RING_LEN         8192      // 136 KB
+#else
+#define RX_RING_LEN         2048      // 34 KB
+#endif
+#define REPLY_RING_LEN      4096
+
+// Received ISO-TP PDUs and results waiting for serial-TX (see the `i` command).
+#define ISOTP_OUT_LEN       8192
+
+// How long a transmit command may wait for room in the controller's TX queue when
+// transmit acks are windowed (see the `w` command).
+#define SLCAN_TX_BLOCK_MS   50
+
+// Longest host command, including the '\r'.  ISO-TP commands may be longer, so that `iw`
+// takes 128 PDU bytes at a time rather than 14.
+#define SLCAN_MAX_CMD       32
+#define SLCAN_MAX_ISOTP_CMD 260
+
+// Autobaud (see the `a` command): how long each candidate bitrate is listened to by default
+// and at most, and how many error free frames settle it at once.  The longest dwell keeps
+// serial-RX, which runs autobaud, from being tied up for more than about 11 seconds.
+#define SLCAN_AUTOBAUD_DWELL_MS     200
+#define SLCAN_AUTOBAUD_MAX_DWELL_MS 1000
+#define SLCAN_AUTOBAUD_MIN_FRAMES   2
+
+// Build options, set from platformio.ini.  SLCAN_SINGLE_SHOT sends the host's frames single
+// shot, so a frame that loses arbitration or meets an error is not retried by the controller.
+// SLCAN_NACK_NO_CR answers a refused command with a lone BELL, as the Lawicel documents have
+// it, instead of BELL and '\r'.  The S3 project sets both, as its own sources always did.
+//#define SLCAN_SINGLE_SHOT
+//#define SLCAN_NACK_NO_CR
+
+// SJA1000 style status flags as reported by the `F` command.
+#define SLCAN_F_RX_FIFO_FULL   0x01   // Driver RX queue overflowed
+#define SLCAN_F_TX_FIFO_FULL   0x02   // Driver TX queue refused a frame
+#define SLCAN_F_ERR_WARNING    0x04   // An error counter reached 96
+#define SLCAN_F_DATA_OVERRUN   0x08   // The bridge lost frames or output on the serial side
+#define SLCAN_F_ERR_PASSIVE    0x20   // An error counter reached 128, or bus-off
+#define SLCAN_F_ARB_LOST       0x40
+#define SLCAN_F_BUS_ERROR      0x80
+
+// Event counters kept by the core.  Each is only written by one task, readers on other
+// tasks may see a slightly stale value.
+struct SlcanCounters {
+  uint32_t rx_frames;         // Frames taken from the controller (CAN-RX)
+  uint32_t rx_ring_drops;     // Frames lost because serial-TX fell behind (CAN-RX)
+  uint32_t rx_ring_peak;      // Most frames ever waiting in the frame ring (CAN-RX)
+  uint32_t rx_filtered;       // Frames dropped by the software filter (CAN-RX)
+  uint32_t capture_drops;     // Frames lost because the capture ring was full (CAN-RX)
+  uint32_t isotp_frame_drops; // Frames for ISO-TP lost to a full ring (CAN-RX)
+  uint32_t isotp_result_drops; // ISO-TP results lost to a full ring (timer)
+  uint32_t tx_frames;         // Frames queued for transmission (serial-RX)
+  uint32_t tx_queue_full;     // Frames the controller refused to queue (serial-RX)
+  uint32_t timer_tx_frames;   // Periodic and ISO-TP frames queued for transmission (timer)
+  uint32_t timer_tx_queue_full; // Periodic and ISO-TP frames the controller refused (timer)
+  uint32_t reply_drops;       // Reply bytes lost to a full reply ring (serial-RX)
+  uint32_t open_fails;        // Opens the controller refused (serial-RX)
+  uint32_t open_us;           // Time the last open took (serial-RX)
+  uint32_t close_us;          // Time the last close took (serial-RX)
+};
+
+extern SlcanCounters slcan_counters;
+
+// Flags in RxFrame::id_flags.
+#define RX_FRAME_EXTD  (1u << 29)
+#define RX_FRAME_RTR   (1u << 30)
+
+// A received frame as held in the frame ring, packed into 17 bytes rather than the 32 of a
+// twai_message_t and a 64-bit time.
+struct __attribute__((packed)) RxFrame {
+  uint32_t id_flags;          // ID in bits 0-28, extended in bit 29, RTR in bit 30
+  uint32_t rx_us;             // Low 32 bits of the port time when CAN-RX took the frame
+  uint8_t dlc;
+  uint8_t data[TWAI_FRAME_MAX_DLC];
+};
+
+// Connect the core to the CAN controller and to the host.  Must be called before any of the
+// tasks start.
+void slcan_begin(CanPort* port, ByteSource* in, ByteSink* out);
+
+// Give the core `len` bytes at `mem` for the capture ring (see the `c` command), typically
+// PSRAM.  Without it capture is refused.  Must be called before any of the tasks start.
+void slcan_capture_memory(void* mem, size_t len);
+
+// Have the core call `kick`, on serial-RX or CAN-RX, whenever xfer_schedule() should run at
+// once: the periodic transmit table changed, the channel was opened or closed, or there is
+// ISO-TP work.
+void slcan_schedule_kick(void (*kick)());
+
+// Execute one host command held in `buf`, which ends in '\r' and a NUL.
+void parse_slcancmd(char *buf);
+
+// Decode and queue a t/T/r/R command body.  Returns false if it was malformed or not queued.
+bool send_canmsg(char *buf, bool ext, bool rtr);
+
+// Called on serial-RX.  Read whatever the host has sent and execute complete commands.
+// Returns true if replies were queued for serial-TX, which should then be woken.
+bool xfer_tty2can();
+
+// Called on CAN-RX.  Wait up to `timeout_ms` for a frame and queue it for serial-TX.
+// Returns true if a frame was queued, in which case serial-TX should be woken.
+bool xfer_can2ring(uint32_t timeout_ms);
+
+// Called on CAN-RX after xfer_can2ring().  Watch the controller's alerts and recover from
+// bus-off; cheap enough to call after every frame.
+void xfer_supervise();
+
+// Called from the periodic transmit timer.  Send the periodic frames that are due (see the
+// `p` command) and run ISO-TP (see the `i` command).  Returns the microseconds until it
+// should be called again, or 0 if nothing is scheduled; kick (see slcan_schedule_kick()) is
+// called when that changes.  Sets *wake_tty if serial-TX should be woken.
+uint32_t xfer_schedule(bool* wake_tty);
+
+// Called on serial-TX.  Send one queued frame to the host.  Returns false if there was none.
+bool xfer_can2tty();
+
+// Called on serial-TX.  Send queued command replies to the host.  Returns false if there were
+// none.
+bool xfer_reply2tty();
+
+// Called on serial-TX after the rings have been emptied.  Returns true if output is being
+// held back for batching, in which case this should be called again within a millisecond.
+bool xfer_poll_tty();
+
+#endif // !slcan_h_included
@@ -0,0 +1,429 @@
+// Deterministic throughput and latency benchmark for the whole bridge.
+
+#include "slcan_bench.h"
+#include <stdlib.h>
+#include "can_bits.h"
+#include "can_port.h"
+#include "ring_buffer.h"
+#include "slcan.h"
+#include "slcan_decode.h"
+
+// Simulation step while anything is in flight.
+#define BENCH_STEP_NS 10000
+
+// Free space the simulated serial driver reports; beyond this a write would block.
+#define BENCH_DRIVER_FIFO 256
+
+// Bytes in flight on the serial link in each direction.
+#define BENCH_LINK_BUF 8192
+
+// Give up this long after the last frame was offered.
+#define BENCH_DRAIN_NS 5000000000LL
+
+// One direction of the serial link: bytes leave at link speed.
+struct SimLink {
+  SpscRing<uint8_t, BENCH_LINK_BUF> fifo;
+  uint64_t credit = 0;         // In millionths of a byte
+
+  // Number of bytes that may cross the link in `dt_ns` of simulated time.  An idle link
+  // does not save up time for later.
+  uint32_t budget(uint32_t bytes_per_s, int64_t dt_ns) {
+    if (fifo.is_empty()) {
+      credit = 0;
+      return 0;
+    }
+    credit += (uint64_t)bytes_per_s * dt_ns / 1000;
+    uint32_t n = credit / 1000000;
+    credit -= (uint64_t)n * 1000000;
+    return n;
+  }
+};
+
+struct BenchState {
+  const BenchConfig* config;
+  BenchResult* result;
+  int64_t t_ns;
+  int64_t* sent_ns;            // Bus arrival time by sequence number
+  uint32_t* to_host_us;        // Latencies, in order of arrival at the host
+  uint32_t* round_trip_us;     // Latencies, in order of retransmission
+  int64_t last_delivery_ns;
+};
+
+static BenchState st;
+
+// ---------------------------------------------------------------------------------------
+//
+// Simulated controller
+
+class SimBus : public CanPort {
+  bool running = false;
+
+public:
+  SpscRing<twai_message_t, 64> rx_queue;
+
+  bool start(twai_mode_t, const twai_timing_config_t&, const twai_filter_config_t&) override {
+    running = true;
+    return true;
+  }
+  void stop() override {
+    running = false;
+  }
+  bool is_running() override {
+    return running;
+  }
+  bool transmit(const twai_message_t& msg, uint32_t timeout_ms) override;
+  bool receive(twai_message_t* msg, uint32_t) override {
+    return running && rx_queue.pop(msg);
+  }
+  bool set_queue_lengths(uint32_t, uint32_t) override {
+    return false;
+  }
+  void get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) override {
+    *rx_len = rx_queue.capacity();
+    *tx_len = 0;
+  }
+  uint32_t read_alerts() override {
+    return 0;
+  }
+  bool initiate_recovery() override {
+    return false;
+  }
+  bool resume() override {
+    return running;
+  }
+  bool get_status(twai_status_info_t* info) override {
+    *info = {};
+    info->state = running ? TWAI_STATE_RUNNING : TWAI_STATE_STOPPED;
+    return running;
+  }
+  int64_t now_us() override {
+    return st.t_ns / 1000;
+  }
+  void delay_ms(uint32_t ms) override {
+    st.t_ns += (int64_t)ms * 1000000;
+  }
+};
+
+static uint32_t frame_seq(const twai_message_t& msg) {
+  return msg.data[0] | (msg.data[1] << 8) | (msg.data[2] << 16) | ((uint32_t)msg.data[3] << 24);
+}
+
+bool SimBus::transmit(const twai_message_t& msg, uint32_t) {
+  uint32_t seq = frame_seq(msg);
+  if (seq < st.result->offered) {
+    st.round_trip_us[st.result->transmitted++] = (st.t_ns - st.sent_ns[seq]) / 1000;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Simulated serial link and host
+
+static SimLink to_host;        // Device -> host
+static SimLink to_device;      // Host -> device
+static SpscRing<uint8_t, 1024> device_rx;   // Device's serial RX buffer
+
+class SimDevicePort : public ByteSource, public ByteSink {
+public:
+  int available() override {
+    return device_rx.length();
+  }
+  int read() override {
+    uint8_t c;
+    return device_rx.pop(&c) ? c : -1;
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    size_t n = 0;
+    while (n < len && to_host.fifo.push(buf[n])) {
+      n++;
+    }
+    return n;
+  }
+  int available_for_write() override {
+    size_t used = to_host.fifo.length();
+    return used >= BENCH_DRIVER_FIFO ? 0 : BENCH_DRIVER_FIFO - used;
+  }
+  using ByteSink::write;
+
+  // A real write would be blocking serial-TX now.
+  bool blocked() {
+    return to_host.fifo.length() > BENCH_DRIVER_FIFO;
+  }
+};
+
+static SimBus bus;
+static SimDevicePort device_port;
+
+static char host_line[SLCAN_MAX_CMD];
+static size_t host_len;
+
+// A complete line arrived at the host: note the latency and send it back as a command.
+static void host_receive_line() {
+  twai_message_t msg;
+  bool ext = host_line[0] == 'T';
+
+  if (host_line[0] != 't' && host_line[0] != 'T') {
+    return;                    // Command replies
+  }
+  if (!slcan_decode_frame(&host_line[1], host_len - 1, ext, false, &msg)) {
+    return;
+  }
+  uint32_t seq = frame_seq(msg);
+  if (seq >= st.result->offered) {
+    return;
+  }
+  st.to_host_us[st.result->delivered++] = (st.t_ns - st.sent_ns[seq]) / 1000;
+  st.last_delivery_ns = st.t_ns;
+
+  for (size_t i = 0; i < host_len; i++) {
+    to_device.fifo.push(host_line[i]);
+  }
+  to_device.fifo.push('\r');
+}
+
+static void host_command(const char* cmd) {
+  while (*cmd) {
+    to_device.fifo.push(*cmd++);
+  }
+}
+
+// Move `dt_ns` worth of bytes across the link in both directions, ending at the current time.
+static void run_link(int64_t dt_ns) {
+  uint8_t c;
+
+  uint32_t n = to_host.budget(st.config->link_bytes_per_s, dt_ns);
+  while (n-- > 0 && to_host.fifo.pop(&c)) {
+    if (c == '\r') {
+      host_receive_line();
+      host_len = 0;
+    } else if (host_len < sizeof(host_line)) {
+      host_line[host_len++] = c;
+    }
+  }
+
+  n = to_device.budget(st.config->link_bytes_per_s, dt_ns);
+  while (n-- > 0 && !device_rx.is_full() && to_device.fifo.pop(&c)) {
+    device_rx.push(c);
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Traffic
+
+static uint32_t xorshift(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Mixed standard and extended data frames of 4-8 bytes, the first four carrying `seq`.
+static void make_frame(uint32_t seq, uint32_t* rng, twai_message_t* msg) {
+  uint32_t r = xorshift(rng);
+
+  msg->flags = 0;
+  msg->extd = (r & 3) == 0;
+  msg->identifier = xorshift(rng) & (msg->extd ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK);
+  msg->data_length_code = 4 + (r >> 8) % 5;
+  msg->data[0] = seq;
+  msg->data[1] = seq >> 8;
+  msg->data[2] = seq >> 16;
+  msg->data[3] = seq >> 24;
+  for (int i = 4; i < 8; i++) {
+    msg->data[i] = xorshift(rng);
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Driver
+
+static int compare_u32(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void percentiles(uint32_t* v, uint32_t n, BenchLatency* lat) {
+  *lat = {};
+  if (n == 0) {
+    return;
+  }
+  qsort(v, n, sizeof(*v), compare_u32);
+  lat->p50_us = v[(n - 1) * 50 / 100];
+  lat->p99_us = v[(n - 1) * 99 / 100];
+  lat->max_us = v[n - 1];
+}
+
+static uint32_t read_cycles() {
+  return st.config->cycles ? st.config->cycles() : 0;
+}
+
+void bench_default_config(BenchConfig* config, uint32_t bitrate, uint32_t load_pct) {
+  *config = {};
+  config->bitrate = bitrate;
+  config->load_pct = load_pct;
+  config->frames = 1000;
+  config->link_bytes_per_s = 1000000;
+  config->rx_queue_len = 5;
+  config->seed = 0x2208;
+}
+
+void bench_run(const BenchConfig& config, BenchResult* result) {
+  uint64_t stage_cycles[BENCH_STAGES] = {};
+  uint32_t rng = config.seed;
+  twai_message_t next_msg;
+  int64_t next_ns = 0;
+  int64_t last_offer_ns = 0;
+  uint32_t seq = 0;
+  bool pending = false;
+
+  *result = {};
+  st = {};
+  st.config = &config;
+  st.result = result;
+  st.sent_ns = new int64_t[config.frames];
+  st.to_host_us = new uint32_t[config.frames];
+  st.round_trip_us = new uint32_t[config.frames];
+
+  to_host.fifo.clear();
+  to_device.fifo.clear();
+  device_rx.clear();
+  bus.rx_queue.clear();
+  host_len = 0;
+
+  slcan_begin(&bus, &device_port, &device_port);
+  host_command("C\rZ0\rO\r");
+
+  make_frame(seq, &rng, &next_msg);
+  for (;;) {
+    bool busy = false;
+
+    // Offer frames that are due; a full driver queue loses them like the real one.
+    while (seq < config.frames && next_ns <= st.t_ns) {
+      if (bus.rx_queue.length() < config.rx_queue_len) {
+        bus.rx_queue.push(next_msg);
+      } else {
+        result->bus_drops++;
+      }
+      st.sent_ns[seq++] = next_ns;
+      result->offered = seq;
+      last_offer_ns = next_ns;
+      next_ns += (int64_t)can_frame_bits(&next_msg) * 1000000000LL * 100
+                 / config.bitrate / config.load_pct;
+      make_frame(seq, &rng, &next_msg);
+    }
+
+    // CAN-RX
+    for (;;) {
+      uint32_t c0 = read_cycles();
+      bool moved = xfer_can2ring(0);
+      if (!moved) {
+        break;
+      }
+      stage_cycles[BENCH_CAN_RX] += read_cycles() - c0;
+      busy = true;
+    }
+
+    // serial-TX, unless a real one would still be stuck in a blocking write
+    if (!device_port.blocked()) {
+      for (;;) {
+        uint32_t c0 = read_cycles();
+        bool replied = xfer_reply2tty();
+        stage_cycles[BENCH_SERIAL_OUT] += read_cycles() - c0;
+        c0 = read_cycles();
+        bool sent = xfer_can2tty();
+        if (!sent) {
+          break;
+        }
+        stage_cycles[BENCH_ENCODE] += read_cycles() - c0;
+        busy = busy || replied || sent;
+        if (device_port.blocked()) {
+          break;
+        }
+      }
+      uint32_t c0 = read_cycles();
+      pending = xfer_poll_tty();
+      stage_cycles[BENCH_SERIAL_OUT] += read_cycles() - c0;
+    }
+
+    // serial-RX
+    if (device_rx.length() > 0) {
+      uint32_t c0 = read_cycles();
+      xfer_tty2can();
+      stage_cycles[BENCH_SERIAL_IN] += read_cycles() - c0;
+      busy = true;
+    }
+
+    bool in_flight = busy || pending || !bus.rx_queue.is_empty() || !to_host.fifo.is_empty()
+                     || !to_device.fifo.is_empty() || !device_rx.is_empty();
+    if (!in_flight && seq >= config.frames) {
+      break;
+    }
+    if (st.t_ns - last_offer_ns > BENCH_DRAIN_NS) {
+      break;
+    }
+
+    // Skip ahead over idle stretches between frames.
+    int64_t dt = BENCH_STEP_NS;
+    if (!in_flight && next_ns > st.t_ns + dt) {
+      dt = next_ns - st.t_ns;
+    }
+    st.t_ns += dt;
+    run_link(dt);
+  }
+
+  result->bridge_drops = result->offered - result->bus_drops - result->delivered;
+  if (st.last_delivery_ns > 0) {
+    result->fps = (uint64_t)result->delivered * 1000000000ULL / st.last_delivery_ns;
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < BENCH_STAGES; i++) {
+    result->cycles[i] = result->delivered ? stage_cycles[i] / result->delivered : 0;
+    total += result->cycles[i];
+  }
+  if (total > 0) {
+    result->cpu_fps = (uint64_t)config.cycles_per_us * 1000000 / total;
+  }
+  percentiles(st.to_host_us, result->delivered, &result->bus_to_host);
+  percentiles(st.round_trip_us, result->transmitted, &result->round_trip);
+
+  delete[] st.sent_ns;
+  delete[] st.to_host_us;
+  delete[] st.round_trip_us;
+}
+
+void bench_report(const BenchConfig& config, const BenchResult& r, ByteSink* out) {
+  out->printf("%4luk %3lu%% fps=%lu cpu_fps=%lu drop=%lu/%lu ",
+              (unsigned long)config.bitrate / 1000, (unsigned long)config.load_pct,
+              (unsigned long)r.fps, (unsigned long)r.cpu_fps,
+              (unsigned long)r.bus_drops, (unsigned long)r.bridge_drops);
+  out->printf("cyc=%lu/%lu/%lu/%lu ",
+              (unsigned long)r.cycles[BENCH_CAN_RX], (unsigned long)r.cycles[BENCH_ENCODE],
+              (unsigned long)r.cycles[BENCH_SERIAL_OUT], (unsigned long)r.cycles[BENCH_SERIAL_IN]);
+  out->printf("host_us=%lu/%lu/%lu rtt_us=%lu/%lu/%lu\r\n",
+              (unsigned long)r.bus_to_host.p50_us, (unsigned long)r.bus_to_host.p99_us,
+              (unsigned long)r.bus_to_host.max_us, (unsigned long)r.round_trip.p50_us,
+              (unsigned long)r.round_trip.p99_us, (unsigned long)r.round_trip.max_us);
+}
+
+void bench_run_all(ByteSink* out, uint32_t (*cycles)(), uint32_t cycles_per_us) {
+  static const uint32_t BITRATES[] = { 125000, 500000, 1000000 };
+  BenchConfig config;
+  BenchResult result;
+
+  out->println("rate load fps cpu_fps drop=bus/bridge cyc=rx/encode/out/in "
+               "host_us=p50/p99/max rtt_us=p50/p99/max");
+  for (uint32_t bitrate : BITRATES) {
+    for (uint32_t load = 10; load <= 100; load += 10) {
+      bench_default_config(&config, bitrate, load);
+      config.cycles = cycles;
+      config.cycles_per_us = cycles_per_us;
+      bench_run(config, &result);
+      bench_report(config, result, out);
+    }
+  }
+}
@@ -0,0 +1,73 @@
+// Deterministic throughput and latency benchmark for the whole bridge.
+//
+// Synthetic traffic is replayed through the real core functions on a simulated clock:
+// frames arrive on a simulated bus at a given bitrate and load, go through xfer_can2ring()
+// and xfer_can2tty() onto a simulated serial link, are read back by a simulated host and
+// sent again as transmit commands through xfer_tty2can() and send_canmsg().  The result
+// only depends on the configuration, except for the cycle counts which come from a real
+// counter supplied by the caller.
+//
+// The benchmark takes over the SLCAN core (see slcan_begin()), so it must run while none
+// of the bridge tasks do.
+//
+// On the device it runs from setup() in a build with SLCAN_BENCHMARK defined; on the
+// development machine test/test_bench runs it (pio test -e native).
+
+#ifndef slcan_bench_h_included
+#define slcan_bench_h_included
+
+#include <stdint.h>
+#include "byte_stream.h"
+
+// Stages timed separately, in pipeline order.
+enum BenchStage {
+  BENCH_CAN_RX,      // xfer_can2ring()
+  BENCH_ENCODE,      // xfer_can2tty()
+  BENCH_SERIAL_OUT,  // xfer_reply2tty() and xfer_poll_tty()
+  BENCH_SERIAL_IN,   // xfer_tty2can(), ie command parse and transmit
+  BENCH_STAGES
+};
+
+struct BenchConfig {
+  uint32_t bitrate;               // Bus bitrate, bit/s
+  uint32_t load_pct;              // Offered bus load, 1-100
+  uint32_t frames;                // Frames offered
+  uint32_t link_bytes_per_s;      // Serial link speed in each direction
+  uint32_t rx_queue_len;          // Simulated driver RX queue
+  uint32_t seed;                  // Traffic generator seed
+  uint32_t (*cycles)();           // Free-running cycle counter, or nullptr
+  uint32_t cycles_per_us;         // Rate of the above
+};
+
+struct BenchLatency {
+  uint32_t p50_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+};
+
+struct BenchResult {
+  uint32_t offered;               // Frames put on the simulated bus
+  uint32_t delivered;             // Frames that reached the host
+  uint32_t transmitted;           // Frames the host sent back that reached the bus
+  uint32_t bus_drops;             // Lost because the driver RX queue was full
+  uint32_t bridge_drops;          // Lost inside the bridge
+  uint32_t fps;                   // Frames delivered per simulated second
+  uint32_t cpu_fps;               // Frames per second the CPU could carry through all stages
+  uint32_t cycles[BENCH_STAGES];  // Mean cycles per frame in each stage
+  BenchLatency bus_to_host;       // Bus arrival to last byte at the host
+  BenchLatency round_trip;        // Bus arrival to retransmission of the host's copy
+};
+
+// Defaults: 1000 frames, 1 MB/s link (USB), driver queue of 5, fixed seed.
+void bench_default_config(BenchConfig* config, uint32_t bitrate, uint32_t load_pct);
+
+// Run one configuration.
+void bench_run(const BenchConfig& config, BenchResult* result);
+
+// Print `result` as one line.
+void bench_report(const BenchConfig& config, const BenchResult& result, ByteSink* out);
+
+// Run and report 10-100% load in steps of 10 at 125k, 500k and 1M.
+void bench_run_all(ByteSink* out, uint32_t (*cycles)(), uint32_t cycles_per_us);
+
+#endif // !slcan_bench_h_included
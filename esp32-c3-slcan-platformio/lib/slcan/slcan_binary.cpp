@@ -0,0 +1,132 @@
+// Compact binary framing, an alternative to ASCII SLCAN.
+
+#include "slcan_binary.h"
+#include <string.h>
+
+// CRC-16/CCITT-FALSE, a nibble at a time.
+static const uint16_t CRC16_NIBBLE[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static uint16_t crc16(const uint8_t* p, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len-- > 0) {
+    crc = (crc << 4) ^ CRC16_NIBBLE[(crc >> 12) ^ (*p >> 4)];
+    crc = (crc << 4) ^ CRC16_NIBBLE[(crc >> 12) ^ (*p & 0x0F)];
+    p++;
+  }
+  return crc;
+}
+
+// Append the CRC to the `len` byte record in `raw`, then COBS encode it into `out` with a
+// terminating zero.  Records are always shorter than 254 bytes, so a single code block
+// never spans more than one run.
+static size_t finish_record(uint8_t* raw, size_t len, uint8_t* out) {
+  uint16_t crc = crc16(raw, len);
+  raw[len++] = crc;
+  raw[len++] = crc >> 8;
+
+  uint8_t* code = out;
+  uint8_t* p = out + 1;
+  for (size_t i = 0; i < len; i++) {
+    if (raw[i] == 0) {
+      *code = p - code;
+      code = p++;
+    } else {
+      *p++ = raw[i];
+    }
+  }
+  *code = p - code;
+  *p++ = 0;
+  return p - out;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t slcan_bin_encode_frame(const twai_message_t* msg, uint32_t ts, uint8_t* out) {
+  uint8_t raw[1 + 4 + 4 + TWAI_FRAME_MAX_DLC + 2];
+  uint8_t dlc = msg->data_length_code > TWAI_FRAME_MAX_DLC ? TWAI_FRAME_MAX_DLC
+                                                           : msg->data_length_code;
+  size_t len = msg->rtr ? 0 : dlc;
+
+  raw[0] = SLCAN_BIN_FRAME | (msg->rtr << 5) | (msg->extd << 4) | dlc;
+  put_le32(&raw[1], msg->identifier);
+  put_le32(&raw[5], ts);
+  memcpy(&raw[9], msg->data, len);
+  return finish_record(raw, 9 + len, out);
+}
+
+size_t slcan_bin_encode_text(const uint8_t* text, size_t len, uint8_t* out) {
+  uint8_t raw[1 + SLCAN_BIN_MAX_TEXT + 2];
+
+  if (len > SLCAN_BIN_MAX_TEXT) {
+    len = SLCAN_BIN_MAX_TEXT;
+  }
+  raw[0] = SLCAN_BIN_TEXT;
+  memcpy(&raw[1], text, len);
+  return finish_record(raw, 1 + len, out);
+}
+
+int slcan_bin_decode(uint8_t* buf, size_t len, twai_message_t* msg, const char** text,
+                     size_t* text_len) {
+  // COBS decode in place; the output is always one byte shorter than the input.
+  size_t in = 0;
+  size_t out = 0;
+  while (in < len) {
+    uint8_t code = buf[in++];
+    if (code == 0 || in + code - 1 > len) {
+      return -1;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      buf[out++] = buf[in++];
+    }
+    if (code < 0xFF && in < len) {
+      buf[out++] = 0;
+    }
+  }
+
+  if (out < 3) {
+    return -1;
+  }
+  out -= 2;
+  if (crc16(buf, out) != (buf[out] | (buf[out + 1] << 8))) {
+    return -1;
+  }
+
+  uint8_t header = buf[0];
+  switch (header & SLCAN_BIN_TYPE_MASK) {
+    case SLCAN_BIN_FRAME: {
+      uint8_t dlc = header & 0x0F;
+      bool rtr = header & 0x20;
+      if (dlc > TWAI_FRAME_MAX_DLC || out != 9u + (rtr ? 0 : dlc)) {
+        return -1;
+      }
+      msg->flags = 0;
+      msg->extd = (header >> 4) & 1;
+      msg->rtr = rtr;
+      msg->identifier = get_le32(&buf[1]);
+      msg->data_length_code = dlc;
+      if (msg->identifier > (msg->extd ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK)) {
+        return -1;
+      }
+      memcpy(msg->data, &buf[9], rtr ? 0 : dlc);
+      return SLCAN_BIN_FRAME;
+    }
+    case SLCAN_BIN_TEXT:
+      *text = (const char*)&buf[1];
+      *text_len = out - 1;
+      return SLCAN_BIN_TEXT;
+    default:
+      return -1;
+  }
+}
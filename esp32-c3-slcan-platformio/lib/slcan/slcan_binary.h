@@ -0,0 +1,45 @@
+// Compact binary framing, an alternative to ASCII SLCAN (see the `x` command).
+//
+// Every record is COBS encoded and terminated by a zero byte, so a receiver can always
+// resynchronise on the next zero.  Before encoding a record is
+//
+//   header  1  bits 0-3 DLC, bit 4 extended ID, bit 5 RTR, bits 6-7 record type
+//   id      4  identifier, little endian               (frame records only)
+//   ts      4  receive time in us, little endian       (frame records only, 0 from host)
+//   body       DLC data bytes, or the text of a text record
+//   crc     2  CRC-16/CCITT-FALSE of all of the above, little endian
+//
+// Frame records carry CAN frames in both directions.  Text records carry ordinary SLCAN
+// commands to the bridge, each ending in '\r', and the bridge's replies back.
+
+#ifndef slcan_binary_h_included
+#define slcan_binary_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+
+#define SLCAN_BIN_FRAME       0x00    // Record types, in header bits 6-7
+#define SLCAN_BIN_TEXT        0x40
+#define SLCAN_BIN_TYPE_MASK   0xC0
+
+// Longest text carried by one text record.
+#define SLCAN_BIN_MAX_TEXT    64
+
+// Room for the longest encoded record, delimiter included: header, text, CRC, COBS overhead.
+#define SLCAN_BIN_MAX_RECORD  (1 + SLCAN_BIN_MAX_TEXT + 2 + 1 + 1)
+
+// Encode a frame record into `out`, which must hold SLCAN_BIN_MAX_RECORD bytes.  Returns the
+// number of bytes written, including the terminating zero.
+size_t slcan_bin_encode_frame(const twai_message_t* msg, uint32_t ts, uint8_t* out);
+
+// Encode `len` (at most SLCAN_BIN_MAX_TEXT) bytes of text as a text record, see above.
+size_t slcan_bin_encode_text(const uint8_t* text, size_t len, uint8_t* out);
+
+// Decode the record in `buf`, `len` bytes without the terminating zero, in place.  Returns
+// the record type, with *msg filled in for frame records and *text/*text_len pointing into
+// `buf` for text records, or -1 if the record is malformed or its CRC is wrong.
+int slcan_bin_decode(uint8_t* buf, size_t len, twai_message_t* msg, const char** text,
+                     size_t* text_len);
+
+#endif // !slcan_binary_h_included
@@ -0,0 +1,82 @@
+// Decoding of SLCAN transmit commands into TWAI messages.
+
+#include "slcan_decode.h"
+
+// Value of each character as a hex digit, or 0xFF if it is not one.  Or-ing the looked-up
+// values of a run of digits and testing bit 7 validates the whole run with one branch.
+#define X 0xFF
+static const uint8_t HEX_NIBBLE[256] = {
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,    X,    X,    X,    X,    X,    X,
+     X, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+     X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,    X,
+};
+#undef X
+
+bool slcan_decode_hex(const char* p, size_t n, uint32_t* value)
+{
+  uint32_t v = 0;
+  uint8_t bad = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    uint8_t d = HEX_NIBBLE[(uint8_t)p[i]];
+    bad |= d;
+    v = (v << 4) | (d & 0x0F);
+  }
+  if (bad & 0x80)
+    return false;
+
+  *value = v;
+  return true;
+}
+
+bool slcan_decode_frame(const char* buf, size_t len, bool ext, bool rtr, twai_message_t* msg)
+{
+  size_t id_len = ext ? 8 : 3;
+  uint32_t id;
+
+  // Identifier and DLC must be present before we know how long the rest is.
+  if (len < id_len + 1)
+    return false;
+  if (!slcan_decode_hex(buf, id_len, &id))
+    return false;
+  if (id > (ext ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK))
+    return false;
+
+  uint8_t dlc = HEX_NIBBLE[(uint8_t)buf[id_len]];
+  if (dlc > TWAI_FRAME_MAX_DLC)
+    return false;
+  if (len != id_len + 1 + (rtr ? 0 : 2 * dlc))
+    return false;
+
+  msg->flags = 0;
+  msg->extd = ext;
+  msg->rtr = rtr;
+  msg->identifier = id;
+  msg->data_length_code = dlc;
+
+  if (rtr)
+    return true;
+
+  const uint8_t* p = (const uint8_t*)buf + id_len + 1;
+  uint8_t bad = 0;
+  for (uint8_t i = 0; i < dlc; i++, p += 2) {
+    uint8_t hi = HEX_NIBBLE[p[0]];
+    uint8_t lo = HEX_NIBBLE[p[1]];
+    bad |= hi | lo;
+    msg->data[i] = (uint8_t)((hi << 4) | (lo & 0x0F));
+  }
+  return !(bad & 0x80);
+}
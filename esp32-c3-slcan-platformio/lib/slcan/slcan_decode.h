@@ -0,0 +1,27 @@
+// Decoding of SLCAN transmit commands into TWAI messages.
+//
+// Table driven and free of sscanf; every character is validated.  Depends only on the
+// TWAI message type so that it also builds on the host.
+
+#ifndef slcan_decode_h_included
+#define slcan_decode_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+
+// Parse exactly `n` hex digits (n <= 8) at `p` into *value.  Returns false, leaving *value
+// alone, if any of them is not a hex digit.
+
+bool slcan_decode_hex(const char* p, size_t n, uint32_t* value);
+
+// Decode the body of a `t`, `T`, `r` or `R` command, ie everything after the command letter
+// and before the '\r', `len` characters in all, into *msg.  `ext` selects a 29-bit
+// identifier and `rtr` a remote frame without data.
+//
+// Returns false if the length does not match the DLC, the identifier is out of range,
+// the DLC is above 8, or any character is not a hex digit.  *msg is undefined on failure.
+
+bool slcan_decode_frame(const char* buf, size_t len, bool ext, bool rtr, twai_message_t* msg);
+
+#endif // !slcan_decode_h_included
@@ -0,0 +1,46 @@
+// Encoding of received TWAI messages as SLCAN lines.
+
+#include "slcan_encode.h"
+
+static const char HEX_DIGIT[16] = {
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+char* slcan_encode_hex(char* buf, uint32_t value, size_t digits)
+{
+  for (size_t i = digits; i > 0; i--) {
+    buf[i - 1] = HEX_DIGIT[value & 0x0F];
+    value >>= 4;
+  }
+  return buf + digits;
+}
+
+size_t slcan_encode_frame(const twai_message_t* msg, uint32_t ts, size_t ts_digits, char* buf)
+{
+  char* p = buf;
+  uint8_t dlc = msg->data_length_code;
+
+  if (dlc > TWAI_FRAME_MAX_DLC)
+    dlc = TWAI_FRAME_MAX_DLC;
+
+  if (msg->extd) {
+    *p++ = msg->rtr ? 'R' : 'T';
+    p = slcan_encode_hex(p, msg->identifier & TWAI_EXTD_ID_MASK, 8);
+  } else {
+    *p++ = msg->rtr ? 'r' : 't';
+    p = slcan_encode_hex(p, msg->identifier & TWAI_STD_ID_MASK, 3);
+  }
+  *p++ = HEX_DIGIT[dlc];
+
+  if (!msg->rtr) {
+    for (uint8_t i = 0; i < dlc; i++) {
+      *p++ = HEX_DIGIT[msg->data[i] >> 4];
+      *p++ = HEX_DIGIT[msg->data[i] & 0x0F];
+    }
+  }
+
+  if (ts_digits > 0)
+    p = slcan_encode_hex(p, ts, ts_digits);
+
+  return p - buf;
+}
@@ -0,0 +1,30 @@
+// Encoding of received TWAI messages as SLCAN lines.
+//
+// No printf; hex digits come from a lookup table and the whole line is built in a
+// caller-owned buffer so it can be handed to the serial driver in a single write.
+// Depends only on the TWAI message type so that it also builds on the host.
+
+#ifndef slcan_encode_h_included
+#define slcan_encode_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+
+// Room for the longest line: 'T', 8 identifier digits, DLC, 16 data digits, up to 8
+// timestamp digits and a "\r\r\n" terminator, rounded up.
+#define SLCAN_MAX_LINE 40
+
+// Write `digits` hex digits of `value`, most significant first, at `buf`.  Returns `buf`
+// advanced past them.
+
+char* slcan_encode_hex(char* buf, uint32_t value, size_t digits);
+
+// Encode `msg` as `tIIILDD..`, `TIIIIIIIILDD..`, `rIIIL` or `RIIIIIIIIL` at `buf`, followed by
+// the low `ts_digits` hex digits of `ts` (none if ts_digits is 0).  The line terminator is
+// left to the caller.  `buf` must hold SLCAN_MAX_LINE bytes.  Returns the number of bytes
+// written.
+
+size_t slcan_encode_frame(const twai_message_t* msg, uint32_t ts, size_t ts_digits, char* buf);
+
+#endif // !slcan_encode_h_included
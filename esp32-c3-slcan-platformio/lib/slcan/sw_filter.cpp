@@ -0,0 +1,221 @@
+// Software acceptance filter for received frames.
+
+#include "sw_filter.h"
+#include <math.h>
+#include <string.h>
+
+void SwFilter::clear() {
+  memset(std_bits, 0, sizeof(std_bits));
+  ext_set.clear();
+  std_count = 0;
+  range_count = 0;
+}
+
+bool SwFilter::add_std(uint32_t lo, uint32_t hi) {
+  if (lo > hi || hi > TWAI_STD_ID_MASK)
+    return false;
+  for (uint32_t id = lo; id <= hi; id++) {
+    uint32_t bit = 1u << (id & 31);
+    if (!(std_bits[id >> 5] & bit)) {
+      std_bits[id >> 5] |= bit;
+      std_count++;
+    }
+  }
+  return true;
+}
+
+bool SwFilter::add_ext(uint32_t lo, uint32_t hi) {
+  if (lo > hi || hi > TWAI_EXTD_ID_MASK)
+    return false;
+
+  if (lo != hi) {
+    if (range_count == SW_FILTER_EXT_RANGES)
+      return false;
+    size_t i = range_count++;
+    while (i > 0 && ext_ranges[i - 1].lo > lo) {
+      ext_ranges[i] = ext_ranges[i - 1];
+      i--;
+    }
+    ext_ranges[i] = Range{lo, hi};
+    return true;
+  }
+
+  bool added;
+  return ext_set.insert(lo, &added) != nullptr;
+}
+
+bool SwFilter::has_ext(uint32_t id) const {
+  if (ext_set.find(id))
+    return true;
+  for (size_t i = 0; i < range_count && ext_ranges[i].lo <= id; i++) {
+    if (id <= ext_ranges[i].hi)
+      return true;
+  }
+  return false;
+}
+
+// Hardware filter fitting.
+//
+// In single filter mode the acceptance code is compared with the standard ID in bits 31-21,
+// followed by RTR and the first two data bytes, or with the extended ID in bits 31-3,
+// followed by RTR.  Mask bits that are set are don't-care.
+//
+// In dual filter mode each half of the register is a filter of its own.  For standard frames
+// both compare the ID in their bits 15-5 and RTR in bit 4, the upper one also the first data
+// byte in its bits 3-0 and in bits 3-0 of the lower half.  For extended frames both compare
+// only ID bits 28-13, in all 16 bits; so the lower filter loses ID bits 16-13 whenever the
+// upper one has to ignore the data byte.
+//
+// A set is fitted by trying the single filter and every way of splitting the set on one
+// bit of the 16 bit dual key into two disjoint groups, and keeping whichever lets the
+// fewest unwanted IDs through.  Two disjoint subcubes always differ in some bit they both
+// fix, so this finds the best pair of non-overlapping dual filters.  Leakage into the frame
+// format the set does not use is not counted, since real buses rarely mix the two.
+
+#define STD_SHIFT      21
+#define STD_DONT_CARE  0x001FFFFF
+#define EXT_SHIFT      3
+#define EXT_DONT_CARE  0x00000007
+
+#define DUAL_STD_SHIFT      5
+#define DUAL_STD_DONT_CARE  0x001F
+#define DUAL_EXT_SHIFT      13
+#define DUAL_DATA_NIBBLE    0x000F
+
+// The smallest code/mask pair letting a group of keys through.
+struct Cover {
+  bool any = false;
+  bool has_std = false;
+  uint32_t first = 0;
+  uint32_t mask = 0;
+
+  void add(uint32_t key, uint32_t dont_care, bool std) {
+    if (!any) {
+      any = true;
+      first = key;
+    }
+    mask |= (key ^ first) | dont_care;
+    has_std |= std;
+  }
+  uint32_t code() const {
+    return first & ~mask;
+  }
+};
+
+// Every bit below the highest one in which lo and hi differ takes both values in lo..hi.
+static uint32_t range_bits(uint32_t lo, uint32_t hi) {
+  uint32_t diff = lo ^ hi;
+  return diff == 0 ? 0 : 0xFFFFFFFF >> __builtin_clz(diff);
+}
+
+static double pow2(int n) {
+  return ldexp(1.0, n);
+}
+
+static int bits(uint32_t v) {
+  return __builtin_popcount(v);
+}
+
+template<typename F>
+void SwFilter::for_each_key(F visit) const {
+  for (uint32_t id = 0; id <= TWAI_STD_ID_MASK; id++) {
+    if ((std_bits[id >> 5] >> (id & 31)) & 1)
+      visit(id, id, true);
+  }
+  for (size_t i = 0; i < SW_FILTER_EXT_SLOTS; i++) {
+    if (const ExtId* e = ext_set.slot(i))
+      visit(e->key, e->key, false);
+  }
+  for (size_t i = 0; i < range_count; i++)
+    visit(ext_ranges[i].lo, ext_ranges[i].hi, false);
+}
+
+// The dual filter key of IDs lo..hi and the key bits that vary across them.
+static void dual_key(uint32_t lo, uint32_t hi, bool std, uint32_t* key, uint32_t* dont_care) {
+  if (std) {
+    *key = lo << DUAL_STD_SHIFT;
+    *dont_care = DUAL_STD_DONT_CARE;
+  } else {
+    *key = lo >> DUAL_EXT_SHIFT;
+    *dont_care = range_bits(lo >> DUAL_EXT_SHIFT, hi >> DUAL_EXT_SHIFT);
+  }
+}
+
+// Expected IDs let through by a dual filter pair, `upper` in the upper half of the register.
+static void dual_passed(const Cover& upper, const Cover& lower, bool has_std, bool has_ext,
+                        double* std_passed, double* ext_passed) {
+  uint32_t c1 = upper.code(), m1 = upper.mask;
+  uint32_t m2 = lower.mask | (has_std ? DUAL_DATA_NIBBLE : 0);
+  uint32_t c2 = lower.first & ~m2;
+  bool overlap = ((c1 ^ c2) & ~m1 & ~m2 & 0xFFFF) == 0;
+
+  *std_passed = 0;
+  if (has_std) {
+    // Fraction of frames whose RTR and data bits the filter lets through.
+    double f1 = pow2(bits(m1 & DUAL_STD_DONT_CARE) - 5) * pow2(bits(m2 & DUAL_DATA_NIBBLE) - 4);
+    double f2 = pow2(bits(m2 & 0x10) - 1);
+    *std_passed = pow2(bits(m1 >> DUAL_STD_SHIFT)) * f1 + pow2(bits(m2 >> DUAL_STD_SHIFT)) * f2;
+    if (((c1 ^ c2) & ~m1 & ~m2 & ~DUAL_STD_DONT_CARE & 0xFFFF) == 0)
+      *std_passed -= pow2(bits(m1 & m2 & ~DUAL_STD_DONT_CARE & 0xFFFF)) * (f1 < f2 ? f1 : f2);
+  }
+  *ext_passed = 0;
+  if (has_ext) {
+    *ext_passed = pow2(bits(m1)) + pow2(bits(m2)) - (overlap ? pow2(bits(m1 & m2)) : 0);
+    *ext_passed *= pow2(DUAL_EXT_SHIFT);
+  }
+}
+
+HwFilterFit SwFilter::hw_filter() const {
+  HwFilterFit fit;
+  bool has_std = std_count > 0;
+  bool has_ext = ext_set.size() + range_count > 0;
+
+  fit.wanted = std_count + ext_set.size();
+  for (size_t i = 0; i < range_count; i++)
+    fit.wanted += ext_ranges[i].hi - ext_ranges[i].lo + 1.0;
+
+  // Single filter over the full 29-bit IDs.
+  Cover single;
+  for_each_key([&](uint32_t lo, uint32_t hi, bool std) {
+    if (std)
+      single.add(lo << STD_SHIFT, STD_DONT_CARE, true);
+    else
+      single.add(lo << EXT_SHIFT, EXT_DONT_CARE | range_bits(lo, hi) << EXT_SHIFT, false);
+  });
+  uint32_t m = single.mask;
+  fit.config.acceptance_code = single.code();
+  fit.config.acceptance_mask = m;
+  fit.config.single_filter = true;
+  fit.std_passed = has_std ? pow2(bits(m >> STD_SHIFT)) * pow2(bits(m & STD_DONT_CARE) - 21) : 0;
+  fit.ext_passed = has_ext ? pow2(bits(m >> EXT_SHIFT)) * pow2(bits(m & EXT_DONT_CARE) - 3) : 0;
+
+  // Dual filters, split on bit `split` of the key, or one group in both filters for -1.
+  for (int split = -1; split < 16; split++) {
+    Cover group[2];
+    for_each_key([&](uint32_t lo, uint32_t hi, bool std) {
+      uint32_t key, dont_care;
+      dual_key(lo, hi, std, &key, &dont_care);
+      group[split >= 0 && ((key >> split) & 1)].add(key, dont_care, std);
+    });
+    if (split < 0)
+      group[1] = group[0];
+    else if (!group[0].any || !group[1].any || ((group[0].mask | group[1].mask) >> split) & 1)
+      continue;
+
+    for (int upper = 0; upper < 2; upper++) {
+      double std_passed, ext_passed;
+      dual_passed(group[upper], group[!upper], has_std, has_ext, &std_passed, &ext_passed);
+      if (std_passed + ext_passed < fit.std_passed + fit.ext_passed) {
+        uint32_t m1 = group[upper].mask;
+        uint32_t m2 = group[!upper].mask | (has_std ? DUAL_DATA_NIBBLE : 0);
+        uint32_t mask = m1 << 16 | m2;
+        fit.config.acceptance_code = (group[upper].first << 16 | group[!upper].first) & ~mask;
+        fit.config.acceptance_mask = mask;
+        fit.config.single_filter = false;
+        fit.std_passed = std_passed;
+        fit.ext_passed = ext_passed;
+      }
+    }
+  }
+  return fit;
+}
@@ -0,0 +1,97 @@
+// Software acceptance filter for received frames.
+//
+// The TWAI controller has a single code/mask pair, which either lets through far more than
+// is wanted or loses IDs.  This filter holds an exact set: standard IDs and ranges in a
+// 2048 bit bitmap, extended IDs in a hash set (see id_table.h), and extended ranges in a
+// short sorted list.  A lookup is a bit test or, for extended IDs, usually a single probe,
+// so unwanted frames are dropped on CAN-RX before they cost ring space, encoding or serial
+// bandwidth.  The controller is still programmed with the single or dual filter setting
+// that best covers the set (see hw_filter()), so most of them never even raise an interrupt.
+
+#ifndef sw_filter_h_included
+#define sw_filter_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+#include "id_table.h"
+
+// Slots in the extended ID hash set, a power of two.  It is kept at most 3/4 full.
+#define SW_FILTER_EXT_SLOTS   512
+#define SW_FILTER_EXT_IDS     (SW_FILTER_EXT_SLOTS * 3 / 4)
+
+// Extended ID ranges.
+#define SW_FILTER_EXT_RANGES  16
+
+// A controller filter setting fitted to the set, and how well it fits.  The pass counts
+// assume every ID and every data byte value is equally likely.
+struct HwFilterFit {
+  twai_filter_config_t config;
+  double std_passed;          // Standard IDs the controller lets through
+  double ext_passed;          // Extended IDs the controller lets through
+  double wanted;              // IDs in the set
+};
+
+class SwFilter {
+  struct Range {
+    uint32_t lo, hi;
+  };
+
+  struct ExtId {
+    uint32_t key;             // The ID
+  };
+
+  uint32_t std_bits[(TWAI_STD_ID_MASK + 1) / 32];
+  IdTable<ExtId, SW_FILTER_EXT_SLOTS> ext_set;
+  Range ext_ranges[SW_FILTER_EXT_RANGES];   // Sorted by lo, possibly overlapping
+  size_t std_count;
+  size_t range_count;
+
+  bool has_ext(uint32_t id) const;
+
+  // Call visit(lo, hi, std) for every ID and range in the set.
+  template<typename F> void for_each_key(F visit) const;
+
+public:
+  SwFilter() {
+    clear();
+  }
+
+  // Remove all entries, which turns the filter off.
+  void clear();
+
+  // Accept standard IDs lo..hi inclusive.  Returns false if the IDs are out of range.
+  bool add_std(uint32_t lo, uint32_t hi);
+
+  // Accept extended IDs lo..hi inclusive.  A single ID goes into the hash set, a range into
+  // the range list.  Returns false if the IDs are out of range or there is no room.
+  bool add_ext(uint32_t lo, uint32_t hi);
+
+  // True once anything has been added.  An empty filter is off, ie accepts everything.
+  bool active() const {
+    return std_count + ext_set.size() + range_count > 0;
+  }
+
+  // Does the filter let `msg` through?
+  bool match(const twai_message_t& msg) const {
+    if (msg.extd)
+      return has_ext(msg.identifier);
+    return (std_bits[msg.identifier >> 5] >> (msg.identifier & 31)) & 1;
+  }
+
+  // The single or dual controller filter that lets everything in the set through and the
+  // fewest other IDs.  Only meaningful when the filter is active.
+  HwFilterFit hw_filter() const;
+
+  size_t std_ids() const {
+    return std_count;
+  }
+  size_t ext_ids() const {
+    return ext_set.size();
+  }
+  size_t ext_ranges_used() const {
+    return range_count;
+  }
+};
+
+#endif // !sw_filter_h_included
@@ -0,0 +1,108 @@
+// Trigger for capturing rare events with their context.
+
+#include "trigger.h"
+
+void Trigger::clear() {
+  id_mask = 0;
+  id_code = 0;
+  for (size_t i = 0; i < TWAI_FRAME_MAX_DLC; i++)
+    tests[i] = {};
+  min_dlc = 0;
+  pre_len = 0;
+  post_len = 0;
+  arm();
+}
+
+bool Trigger::set_id(uint32_t code, uint32_t mask, bool ext) {
+  uint32_t limit = ext ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK;
+  if (code > limit || mask > limit)
+    return false;
+  id_mask = mask | RX_FRAME_EXTD;
+  id_code = (code & mask) | (ext ? RX_FRAME_EXTD : 0);
+  return true;
+}
+
+bool Trigger::set_byte(size_t n, char op, uint8_t value, uint8_t mask) {
+  if (n >= TWAI_FRAME_MAX_DLC || (op != '=' && op != '!' && op != '<' && op != '>'))
+    return false;
+  tests[n] = {(uint8_t)op, mask, value};
+  if (n + 1 > min_dlc)
+    min_dlc = n + 1;
+  return true;
+}
+
+bool Trigger::set_window(uint32_t pre, uint32_t post) {
+  if (pre > TRIGGER_MAX_PRE)
+    return false;
+  pre_len = pre;
+  post_len = post;
+  return true;
+}
+
+void Trigger::arm() {
+  pre_head = 0;
+  pre_count = 0;
+  post_left = 0;
+}
+
+bool Trigger::match(const RxFrame& frame) const {
+  if ((frame.id_flags & id_mask) != id_code)
+    return false;
+  if (min_dlc == 0)
+    return true;
+  if (frame.dlc < min_dlc || (frame.id_flags & RX_FRAME_RTR))
+    return false;
+  for (size_t i = 0; i < min_dlc; i++) {
+    const ByteTest& t = tests[i];
+    uint8_t b = frame.data[i] & t.mask;
+    switch (t.op) {
+      case '=': if (b != t.value) return false; break;
+      case '!': if (b == t.value) return false; break;
+      case '<': if (b >= t.value) return false; break;
+      case '>': if (b <= t.value) return false; break;
+    }
+  }
+  return true;
+}
+
+TriggerAction Trigger::feed(const RxFrame& frame) {
+  if (post_left > 0) {
+    post_left--;
+    return TRIGGER_PASS;
+  }
+  if (match(frame)) {
+    fires++;
+    post_left = post_len;
+    return TRIGGER_FIRE;
+  }
+  if (pre_len > 0) {
+    pre[pre_head++ & (TRIGGER_MAX_PRE - 1)] = frame;
+    if (pre_count < pre_len)
+      pre_count++;
+  }
+  return TRIGGER_HOLD;
+}
+
+bool Trigger::pop_pre(RxFrame* frame) {
+  if (pre_count == 0)
+    return false;
+  *frame = pre[(pre_head - pre_count) & (TRIGGER_MAX_PRE - 1)];
+  pre_count--;
+  return true;
+}
+
+void Trigger::describe(ByteSink& out) const {
+  if (id_mask != 0) {
+    if (id_code & RX_FRAME_EXTD)
+      out.printf(" e%08lX,%08lX", (unsigned long)(id_code & TWAI_EXTD_ID_MASK),
+                 (unsigned long)(id_mask & TWAI_EXTD_ID_MASK));
+    else
+      out.printf(" s%03lX,%03lX", (unsigned long)id_code,
+                 (unsigned long)(id_mask & TWAI_EXTD_ID_MASK));
+  }
+  for (size_t i = 0; i < TWAI_FRAME_MAX_DLC; i++) {
+    if (tests[i].op)
+      out.printf(" b%u%c%02X,%02X", (unsigned)i, tests[i].op, tests[i].value, tests[i].mask);
+  }
+  out.printf(" w%lu,%lu", (unsigned long)pre_len, (unsigned long)post_len);
+}
@@ -0,0 +1,84 @@
+// Trigger for capturing rare events with their context.
+//
+// While armed, received frames are not forwarded but kept in a rolling pre-trigger buffer.
+// When a frame matches the trigger condition, the buffered frames, the trigger frame itself
+// and the next frames of the post-trigger window are forwarded, after which the trigger is
+// armed again with an empty buffer.  So the host sees every occurrence with the traffic
+// around it, and otherwise nothing.
+//
+// The condition is an ID code/mask, optionally tied to standard or extended frames, and a
+// test on any of the eight data bytes: (byte & mask) compared to a value with =, !=, < or >.
+// A frame matches when the ID and every test match; a test on a byte past the frame's DLC
+// fails.  Only CAN-RX may call feed() and pop_pre(), and the rest only while it does not.
+
+#ifndef trigger_h_included
+#define trigger_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "byte_stream.h"
+#include "slcan.h"
+
+// Longest pre-trigger window, a power of two.
+#define TRIGGER_MAX_PRE   256
+
+// What to do with a frame fed to the trigger.
+enum TriggerAction {
+  TRIGGER_HOLD,               // Keep back; it is buffered in case a trigger follows
+  TRIGGER_FIRE,               // Trigger: forward pop_pre() frames, then this one
+  TRIGGER_PASS,               // Forward; it is in the post-trigger window
+};
+
+class Trigger {
+  struct ByteTest {
+    uint8_t op;               // 0 = none, else one of = ! < >
+    uint8_t mask;
+    uint8_t value;
+  };
+
+  uint32_t id_mask = 0;       // Applied to RxFrame::id_flags
+  uint32_t id_code = 0;
+  ByteTest tests[TWAI_FRAME_MAX_DLC] = {};
+  uint8_t min_dlc = 0;        // Bytes the tests look at
+
+  uint32_t pre_len = 0;
+  uint32_t post_len = 0;
+
+  RxFrame pre[TRIGGER_MAX_PRE];
+  uint32_t pre_head = 0;      // Total frames ever buffered, the newest is pre_head - 1
+  uint32_t pre_count = 0;     // Frames in the buffer, at most pre_len
+  uint32_t post_left = 0;
+
+public:
+  uint32_t fires = 0;         // Times the trigger fired (CAN-RX)
+
+  // Match every frame, with no pre- or post-trigger window.
+  void clear();
+
+  // Match IDs whose bits under `mask` equal those of `code`, of standard or extended frames.
+  // Returns false if the ID is out of range.
+  bool set_id(uint32_t code, uint32_t mask, bool ext);
+
+  // Test data byte `n` with `op` ('=', '!', '<' or '>').  Returns false if either is invalid.
+  bool set_byte(size_t n, char op, uint8_t value, uint8_t mask);
+
+  // Forward `pre` frames before and `post` frames after a trigger.  Returns false if `pre`
+  // is over TRIGGER_MAX_PRE.
+  bool set_window(uint32_t pre, uint32_t post);
+
+  // Empty the buffer and wait for the next trigger.
+  void arm();
+
+  bool match(const RxFrame& frame) const;
+
+  TriggerAction feed(const RxFrame& frame);
+
+  // After TRIGGER_FIRE, take the buffered frames oldest first.  Returns false once they are
+  // all taken.
+  bool pop_pre(RxFrame* frame);
+
+  // Print the condition and window to `out` in the form of the commands that set them.
+  void describe(ByteSink& out) const;
+};
+
+#endif // !trigger_h_included
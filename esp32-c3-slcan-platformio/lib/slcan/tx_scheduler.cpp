@@ -0,0 +1,100 @@
+// Periodic transmission of frames from a table on the device.
+
+#include "tx_scheduler.h"
+
+static uint8_t crc8_j1850(const uint8_t* data, size_t len, int skip) {
+  uint8_t crc = 0xFF;
+  for (size_t i = 0; i < len; i++) {
+    if ((int)i == skip)
+      continue;
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x1D : crc << 1;
+  }
+  return crc ^ 0xFF;
+}
+
+void TxScheduler::clear_config(TxSlotConfig* config) {
+  *config = {};
+  config->counter_byte = -1;
+  config->check_byte = -1;
+}
+
+void TxScheduler::update(const TxSlotUpdate& update, int64_t now_us) {
+  if (update.slot >= TX_SCHED_SLOTS)
+    return;
+  Slot& slot = slots[update.slot];
+  const TxSlotConfig& config = update.config;
+
+  bool restart = config.enabled && (!slot.config.enabled
+                                    || config.period_us != slot.config.period_us
+                                    || config.offset_us != slot.config.offset_us);
+  if (!config.has_frame && slot.config.has_frame)
+    stats[update.slot] = {};
+  slot.config = config;
+  if (restart)
+    slot.next_us = now_us + config.offset_us;
+}
+
+void TxScheduler::send(Slot& slot) {
+  TxSlotConfig& config = slot.config;
+  twai_message_t& msg = config.msg;
+  size_t n = &slot - slots;
+
+  if (config.counter_byte >= 0 && config.counter_byte < msg.data_length_code) {
+    uint8_t& b = msg.data[config.counter_byte];
+    uint8_t mask = config.counter_mask;
+    // Add one at the lowest bit of the mask, carrying only within the mask.
+    uint8_t one = mask & -mask;
+    b = (b & ~mask) | ((b + one) & mask);
+  }
+
+  if (config.check_byte >= 0 && config.check_byte < msg.data_length_code) {
+    uint8_t sum = 0;
+    if (config.check_type == TX_CHECK_J1850) {
+      sum = crc8_j1850(msg.data, msg.data_length_code, config.check_byte);
+    } else {
+      for (int i = 0; i < msg.data_length_code; i++) {
+        if (i == config.check_byte)
+          continue;
+        sum = config.check_type == TX_CHECK_XOR ? sum ^ msg.data[i] : sum + msg.data[i];
+      }
+    }
+    msg.data[config.check_byte] = sum;
+  }
+
+  // Never waits for the controller: the next slot is due too.
+  if (transmit(msg))
+    stats[n].sent++;
+  else
+    stats[n].failed++;
+}
+
+uint32_t TxScheduler::run(int64_t now_us) {
+  if (!started) {
+    for (size_t i = 0; i < TX_SCHED_SLOTS; i++)
+      slots[i].next_us = now_us + slots[i].config.offset_us;
+    started = true;
+  }
+
+  int64_t wait_us = -1;
+  for (size_t i = 0; i < TX_SCHED_SLOTS; i++) {
+    Slot& slot = slots[i];
+    if (!slot.config.enabled)
+      continue;
+    if (slot.next_us <= now_us) {
+      send(slot);
+      slot.next_us += slot.config.period_us;
+      if (slot.next_us <= now_us) {
+        // Skip the periods that were missed, keeping the phase.
+        uint32_t missed = (now_us - slot.next_us) / slot.config.period_us + 1;
+        stats[i].late += missed;
+        slot.next_us += (int64_t)missed * slot.config.period_us;
+      }
+    }
+    int64_t until = slot.next_us - now_us;
+    if (wait_us < 0 || until < wait_us)
+      wait_us = until;
+  }
+  return wait_us < 0 ? 0 : wait_us;
+}
@@ -0,0 +1,98 @@
+// Periodic transmission of frames from a table on the device.
+//
+// Each slot holds a frame, its period and its phase offset, and optionally a rolling
+// counter and a checksum byte that are updated before every transmission, as ECUs do for
+// their cyclic messages.  run() is called from a timer and sends whatever is due, so the
+// cycle times do not depend on the host or the serial link.  A slot falls behind only if
+// the timer is held up for over a period, in which case it skips ahead rather than sending
+// a burst, and the slot's `late` count goes up.
+//
+// The table is only used by the timer; other tasks hand it new slot settings through
+// update() calls made on the timer as well (see xfer_schedule()).
+
+#ifndef tx_scheduler_h_included
+#define tx_scheduler_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/twai.h"
+#include "can_port.h"
+
+// Slots in the table.
+#define TX_SCHED_SLOTS    32
+
+// Checksums over the other data bytes (TxSlotConfig::check_type).
+#define TX_CHECK_NONE     0
+#define TX_CHECK_XOR      'x'           // XOR of the bytes
+#define TX_CHECK_SUM      's'           // Sum of the bytes, modulo 256
+#define TX_CHECK_J1850    'j'           // CRC-8 SAE J1850 (poly 1D, init and xorout FF)
+
+// What the host sets for a slot.
+struct TxSlotConfig {
+  twai_message_t msg;
+  uint32_t period_us;         // 0 = no period set yet
+  uint32_t offset_us;         // Phase relative to the open or to enabling the slot
+  int8_t counter_byte;        // -1 = none
+  uint8_t counter_mask;       // Bits of the counter byte that count, eg 0F for a nibble
+  int8_t check_byte;          // -1 = none
+  uint8_t check_type;         // TX_CHECK_*
+  bool enabled;
+  bool has_frame;
+};
+
+// How a slot has fared.  Written by the timer, others may see slightly stale values.
+struct TxSlotStats {
+  uint32_t sent;              // Frames the controller queued
+  uint32_t failed;            // Frames the controller refused
+  uint32_t late;              // Periods skipped because the timer fell behind
+};
+
+// A slot's settings as passed from the command task to the timer.
+struct TxSlotUpdate {
+  uint8_t slot;
+  TxSlotConfig config;
+};
+
+class TxScheduler {
+  struct Slot {
+    TxSlotConfig config;
+    int64_t next_us;
+  };
+
+  Slot slots[TX_SCHED_SLOTS];
+  bool started = false;       // Phases have been set from an open
+  CanTransmitFn transmit = nullptr;
+
+  void send(Slot& slot);
+
+public:
+  TxSlotStats stats[TX_SCHED_SLOTS];
+
+  TxScheduler() {
+    for (size_t i = 0; i < TX_SCHED_SLOTS; i++)
+      clear_config(&slots[i].config);
+  }
+
+  // Send the frames through `send`.  Must be called before run().
+  void begin(CanTransmitFn send) {
+    transmit = send;
+  }
+
+  // Set `config` to an empty, disabled slot.
+  static void clear_config(TxSlotConfig* config);
+
+  // Take new settings for a slot.  A slot that is newly enabled or gets a new period or
+  // offset starts its phase over at `now_us`; one that is cleared has its stats reset.
+  void update(const TxSlotUpdate& update, int64_t now_us);
+
+  // Send everything due at `now_us`.  Returns the microseconds until the next frame is due, or
+  // 0 if no slot is enabled.
+  uint32_t run(int64_t now_us);
+
+  // The channel was closed: phases start over on the next run().
+  void stop() {
+    started = false;
+  }
+};
+
+#endif // !tx_scheduler_h_included
@@ -0,0 +1,187 @@
+// CanPort on top of the ESP-IDF TWAI driver.
+
+#include "twai_port.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "bus_supervisor.h"
+
+void TwaiPort::begin(gpio_num_t tx_io, gpio_num_t rx_io, TaskHandle_t rx_task) {
+  g_config = TWAI_GENERAL_CONFIG_DEFAULT(tx_io, rx_io, TWAI_MODE_NORMAL);
+  g_config.alerts_enabled = BUS_SUPERVISOR_ALERTS;
+  g_config.rx_queue_len = TWAI_RX_QUEUE_LEN;
+  g_config.tx_queue_len = TWAI_TX_QUEUE_LEN;
+  lock = xSemaphoreCreateMutex();
+  receiver = rx_task;
+}
+
+bool TwaiPort::is_installed_as(twai_mode_t mode, const twai_timing_config_t& timing,
+                               const twai_filter_config_t& filter) {
+  return installed && !queues_changed && g_config.mode == mode
+         && t_config.brp == timing.brp && t_config.tseg_1 == timing.tseg_1
+         && t_config.tseg_2 == timing.tseg_2 && t_config.sjw == timing.sjw
+         && t_config.triple_sampling == timing.triple_sampling
+         && f_config.acceptance_code == filter.acceptance_code
+         && f_config.acceptance_mask == filter.acceptance_mask
+         && f_config.single_filter == filter.single_filter;
+}
+
+// Remove the driver, with `lock` held.  The driver only goes while it is stopped or bus-off,
+// so a recovery under way (eg `C` came in while it ran, and twai_stop() was refused) is left
+// to finish first.  On failure the driver stays installed and the error is in `last_error`.
+bool TwaiPort::uninstall() {
+  twai_status_info_t info;
+  esp_err_t err;
+
+  if (twai_get_status_info(&info) == ESP_OK && info.state == TWAI_STATE_RECOVERING) {
+    int64_t give_up_us = esp_timer_get_time() + TWAI_RECOVERY_WAIT_MS * 1000;
+    uint32_t alerts = 0;
+    while (!(alerts & TWAI_ALERT_BUS_RECOVERED) && esp_timer_get_time() < give_up_us) {
+      if (twai_read_alerts(&alerts, pdMS_TO_TICKS(10)) != ESP_OK)
+        alerts = 0;
+    }
+  }
+  if ((err = twai_driver_uninstall()) != ESP_OK) {
+    last_error = err;
+    return false;
+  }
+  installed = false;
+  return true;
+}
+
+bool TwaiPort::start(twai_mode_t mode, const twai_timing_config_t& timing,
+                     const twai_filter_config_t& filter) {
+  esp_err_t err;
+
+  if (running)
+    return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (is_installed_as(mode, timing, filter)) {
+    // Whatever arrived before the last stop() is stale now.
+    twai_clear_receive_queue();
+    if ((err = twai_start()) == ESP_OK) {
+      running = true;
+      xSemaphoreGive(lock);
+      xTaskNotifyGive(receiver);
+      return true;
+    }
+    // Eg still bus-off; start over with a fresh driver.
+    last_error = err;
+  }
+
+  if (installed && !uninstall()) {
+    xSemaphoreGive(lock);
+    return false;
+  }
+  g_config.mode = mode;
+  t_config = timing;
+  f_config = filter;
+  if ((err = twai_driver_install(&g_config, &t_config, &f_config)) != ESP_OK) {
+    last_error = err;
+    xSemaphoreGive(lock);
+    return false;
+  }
+  installed = true;
+  installs++;
+  queues_changed = false;
+
+  if ((err = twai_start()) != ESP_OK) {
+    uninstall();
+    last_error = err;
+    xSemaphoreGive(lock);
+    return false;
+  }
+
+  running = true;
+  xSemaphoreGive(lock);
+  xTaskNotifyGive(receiver);
+  return true;
+}
+
+void TwaiPort::stop() {
+  esp_err_t err;
+
+  // Clearing `running` first makes CAN-RX park itself instead of re-entering
+  // twai_receive() once it releases the lock.
+  running = false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (installed && (err = twai_stop()) != ESP_OK)
+    last_error = err;
+  xSemaphoreGive(lock);
+}
+
+bool TwaiPort::transmit(const twai_message_t& msg, uint32_t timeout_ms) {
+  return twai_transmit(&msg, pdMS_TO_TICKS(timeout_ms)) == ESP_OK;
+}
+
+bool TwaiPort::receive(twai_message_t* msg, uint32_t timeout_ms) {
+  bool received = false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (running)
+    received = twai_receive(msg, pdMS_TO_TICKS(timeout_ms)) == ESP_OK;
+  xSemaphoreGive(lock);
+  return received;
+}
+
+bool TwaiPort::set_queue_lengths(uint32_t rx_len, uint32_t tx_len) {
+  if (rx_len == 0 || tx_len == 0)
+    return false;
+
+  // Queues already installed are freed before the new ones are allocated.  In 64 bits, since
+  // the host may ask for anything up to 2^32 - 1 of each.
+  uint64_t entry = sizeof(twai_message_t);
+  uint64_t free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  if (installed)
+    free += ((uint64_t)g_config.rx_queue_len + g_config.tx_queue_len) * entry;
+  if (((uint64_t)rx_len + tx_len) * entry > free / TWAI_QUEUE_RAM_DIVISOR)
+    return false;
+
+  if (rx_len != g_config.rx_queue_len || tx_len != g_config.tx_queue_len) {
+    g_config.rx_queue_len = rx_len;
+    g_config.tx_queue_len = tx_len;
+    queues_changed = true;
+  }
+  return true;
+}
+
+void TwaiPort::get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) {
+  *rx_len = g_config.rx_queue_len;
+  *tx_len = g_config.tx_queue_len;
+}
+
+uint32_t TwaiPort::read_alerts() {
+  uint32_t alerts = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (installed && twai_read_alerts(&alerts, 0) != ESP_OK)
+    alerts = 0;
+  xSemaphoreGive(lock);
+  return alerts;
+}
+
+bool TwaiPort::initiate_recovery() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ok = running && twai_initiate_recovery() == ESP_OK;
+  xSemaphoreGive(lock);
+  return ok;
+}
+
+bool TwaiPort::resume() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ok = running && twai_start() == ESP_OK;
+  xSemaphoreGive(lock);
+  return ok;
+}
+
+bool TwaiPort::get_status(twai_status_info_t* info) {
+  return running && twai_get_status_info(info) == ESP_OK;
+}
+
+int64_t TwaiPort::now_us() {
+  return esp_timer_get_time();
+}
+
+void TwaiPort::delay_ms(uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
@@ -0,0 +1,9 @@
+// Host stand-in for the ESP-IDF build configuration, for the native test env.  The core
+// sizes its buffers per target; the tests build it as for the ESP32-C3.
+
+#ifndef sdkconfig_h_included
+#define sdkconfig_h_included
+
+#define CONFIG_IDF_TARGET_ESP32C3 1
+
+#endif // !sdkconfig_h_included
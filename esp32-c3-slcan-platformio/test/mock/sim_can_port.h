@@ -0,0 +1,144 @@
+// Simulated CAN controller and host link for the native tests.
+//
+// SimCanPort stands in for the TWAI driver behind the SLCAN core: frames the core transmits
+// are collected in `tx`, frames pushed onto `rx` are received, and time only moves when a
+// test moves it.  SimHost is both ends of the serial link: commands are appended to `in`
+// and everything the core writes ends up in `out`.
+
+#ifndef sim_can_port_h_included
+#define sim_can_port_h_included
+
+#include <deque>
+#include <string>
+#include "byte_stream.h"
+#include "can_port.h"
+
+class SimCanPort : public CanPort {
+public:
+  std::deque<twai_message_t> rx;
+  std::deque<twai_message_t> tx;
+  twai_mode_t mode = TWAI_MODE_NORMAL;
+  twai_timing_config_t timing = {};
+  twai_filter_config_t filter = {};
+  twai_status_info_t status = {};
+  uint32_t alerts = 0;
+  uint32_t rx_len = 64;
+  uint32_t tx_len = 16;
+  size_t tx_room = SIZE_MAX;     // Frames the TX queue still takes
+  int64_t t_us = 0;
+  bool running = false;
+  uint32_t epoch = 0;            // Every start() clears `status`, as a driver reinstall does
+
+  bool start(twai_mode_t mode, const twai_timing_config_t& timing,
+             const twai_filter_config_t& filter) override {
+    this->mode = mode;
+    this->timing = timing;
+    this->filter = filter;
+    status = {};
+    status.state = TWAI_STATE_RUNNING;
+    epoch++;
+    running = true;
+    return true;
+  }
+  void stop() override {
+    status.state = TWAI_STATE_STOPPED;
+    running = false;
+  }
+  bool is_running() override {
+    return running;
+  }
+  bool transmit(const twai_message_t& msg, uint32_t) override {
+    if (!running || tx.size() >= tx_room) {
+      return false;
+    }
+    tx.push_back(msg);
+    return true;
+  }
+  bool receive(twai_message_t* msg, uint32_t) override {
+    if (!running || rx.empty()) {
+      return false;
+    }
+    *msg = rx.front();
+    rx.pop_front();
+    return true;
+  }
+  bool set_queue_lengths(uint32_t rx_len, uint32_t tx_len) override {
+    if (rx_len == 0 || tx_len == 0) {
+      return false;
+    }
+    this->rx_len = rx_len;
+    this->tx_len = tx_len;
+    return true;
+  }
+  void get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) override {
+    *rx_len = this->rx_len;
+    *tx_len = this->tx_len;
+  }
+  uint32_t read_alerts() override {
+    uint32_t a = alerts;
+    alerts = 0;
+    return running ? a : 0;
+  }
+  bool initiate_recovery() override {
+    return status.state == TWAI_STATE_BUS_OFF;
+  }
+  bool resume() override {
+    return running;
+  }
+  bool get_status(twai_status_info_t* info) override {
+    *info = status;
+    return running;
+  }
+  uint32_t status_epoch() override {
+    return epoch;
+  }
+  int64_t now_us() override {
+    return t_us;
+  }
+  void delay_ms(uint32_t ms) override {
+    t_us += (int64_t)ms * 1000;
+  }
+
+  // Put a frame on the bus for the core to receive.
+  void inject(uint32_t id, bool extd, const uint8_t* data, uint8_t dlc) {
+    twai_message_t msg = {};
+    msg.identifier = id;
+    msg.extd = extd;
+    msg.data_length_code = dlc;
+    for (uint8_t i = 0; i < dlc && i < TWAI_FRAME_MAX_DLC; i++) {
+      msg.data[i] = data[i];
+    }
+    rx.push_back(msg);
+  }
+};
+
+class SimHost : public ByteSource, public ByteSink {
+public:
+  std::string in;
+  std::string out;
+  size_t pos = 0;
+
+  int available() override {
+    return in.size() - pos;
+  }
+  int read() override {
+    return pos < in.size() ? (uint8_t)in[pos++] : -1;
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    out.append((const char*)buf, len);
+    return len;
+  }
+  int available_for_write() override {
+    return 256;
+  }
+  using ByteSink::write;
+
+  // Everything written so far, and forget it.
+  std::string take() {
+    std::string s;
+    s.swap(out);
+    return s;
+  }
+};
+
+#endif // !sim_can_port_h_included
@@ -0,0 +1,97 @@
+// Native runner for the bridge benchmark (see slcan_bench.h).
+//
+// Prints the full bench_run_all() table, with the host's clock standing in for the cycle
+// counter, and checks what must hold whatever the machine: the simulation is repeatable and
+// a bridge that keeps up loses nothing.
+
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "slcan.h"
+#include "slcan_bench.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Nanoseconds, reported as cycles of a 1 GHz clock.
+static uint32_t host_cycles() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class StdoutSink : public ByteSink {
+public:
+  size_t write(const uint8_t* buf, size_t len) override {
+    return fwrite(buf, 1, len, stdout);
+  }
+  int available_for_write() override {
+    return 1024;
+  }
+  using ByteSink::write;
+};
+
+static void test_run_all() {
+  StdoutSink out;
+  bench_run_all(&out, host_cycles, 1000);
+  fflush(stdout);
+}
+
+// Everything but the cycle counts follows from the configuration.
+static void test_repeatable() {
+  BenchConfig config;
+  BenchResult a, b;
+
+  bench_default_config(&config, 500000, 80);
+  bench_run(config, &a);
+  bench_run(config, &b);
+  TEST_ASSERT_EQUAL(a.offered, b.offered);
+  TEST_ASSERT_EQUAL(a.delivered, b.delivered);
+  TEST_ASSERT_EQUAL(a.transmitted, b.transmitted);
+  TEST_ASSERT_EQUAL(a.fps, b.fps);
+  TEST_ASSERT_EQUAL(a.bus_to_host.p99_us, b.bus_to_host.p99_us);
+  TEST_ASSERT_EQUAL(a.round_trip.max_us, b.round_trip.max_us);
+}
+
+// Over USB a full 1 Mbit/s bus fits on the link with room to spare, so every frame offered
+// reaches the host and comes back, within a couple of milliseconds.
+static void test_full_bus_delivered() {
+  static const uint32_t BITRATES[] = { 125000, 500000, 1000000 };
+  BenchConfig config;
+  BenchResult result;
+
+  for (uint32_t bitrate : BITRATES) {
+    bench_default_config(&config, bitrate, 100);
+    bench_run(config, &result);
+    TEST_ASSERT_EQUAL(config.frames, result.offered);
+    TEST_ASSERT_EQUAL(0, result.bus_drops);
+    TEST_ASSERT_EQUAL(0, result.bridge_drops);
+    TEST_ASSERT_EQUAL(config.frames, result.delivered);
+    TEST_ASSERT_EQUAL(config.frames, result.transmitted);
+    TEST_ASSERT_LESS_OR_EQUAL(2000, result.bus_to_host.max_us);
+  }
+}
+
+// A link slower than the bus has to lose frames once the frame ring is full, and must say so.
+static void test_slow_link_counts_drops() {
+  BenchConfig config;
+  BenchResult result;
+
+  bench_default_config(&config, 1000000, 100);
+  config.frames = 2 * RX_RING_LEN;
+  config.link_bytes_per_s = 11520;           // 115200 baud UART
+  bench_run(config, &result);
+  TEST_ASSERT_GREATER_THAN(0, result.bus_drops + result.bridge_drops);
+  TEST_ASSERT_EQUAL(result.offered, result.delivered + result.bus_drops + result.bridge_drops);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_run_all);
+  RUN_TEST(test_repeatable);
+  RUN_TEST(test_full_bus_delivered);
+  RUN_TEST(test_slow_link_counts_drops);
+  return UNITY_END();
+}
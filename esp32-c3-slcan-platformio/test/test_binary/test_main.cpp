@@ -0,0 +1,162 @@
+// Binary framing: COBS and CRC-16 round trips, records full of zero bytes, the longest
+// record, and damaged or cut short records, which must all be refused.
+
+#include <unity.h>
+#include <string.h>
+#include "slcan_binary.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Only the terminator of an encoded record may be zero.
+static void assert_framed(const uint8_t* rec, size_t len) {
+  TEST_ASSERT_TRUE(len >= 2);
+  TEST_ASSERT_EQUAL(0, rec[len - 1]);
+  for (size_t i = 0; i < len - 1; i++) {
+    TEST_ASSERT_TRUE(rec[i] != 0);
+  }
+}
+
+static void assert_frame_round_trip(const twai_message_t& msg, uint32_t ts) {
+  uint8_t rec[SLCAN_BIN_MAX_RECORD];
+  twai_message_t out = {};
+  const char* text;
+  size_t text_len;
+
+  size_t len = slcan_bin_encode_frame(&msg, ts, rec);
+  TEST_ASSERT_LESS_OR_EQUAL(SLCAN_BIN_MAX_RECORD, len);
+  assert_framed(rec, len);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_FRAME, slcan_bin_decode(rec, len - 1, &out, &text, &text_len));
+  TEST_ASSERT_EQUAL_HEX32(msg.identifier, out.identifier);
+  TEST_ASSERT_EQUAL(msg.extd, out.extd);
+  TEST_ASSERT_EQUAL(msg.rtr, out.rtr);
+  TEST_ASSERT_EQUAL(msg.data_length_code, out.data_length_code);
+  if (!msg.rtr) {
+    TEST_ASSERT_EQUAL_MEMORY(msg.data, out.data, msg.data_length_code);
+  }
+}
+
+static void test_frame_round_trip() {
+  twai_message_t msg = {};
+
+  // Zero bytes everywhere: in the ID, the time and the data.
+  msg.identifier = 0x100;
+  msg.data_length_code = 8;
+  assert_frame_round_trip(msg, 0);
+
+  msg.extd = 1;
+  msg.identifier = 0x1FFFFFFF;
+  for (int i = 0; i < 8; i++) {
+    msg.data[i] = i % 2 ? 0xFF : 0x00;
+  }
+  assert_frame_round_trip(msg, 0xFFFFFFFF);
+
+  for (uint8_t dlc = 0; dlc <= TWAI_FRAME_MAX_DLC; dlc++) {
+    msg.data_length_code = dlc;
+    msg.extd = dlc % 2;
+    msg.identifier = msg.extd ? 0x18DAF110 : 0x7E8;
+    assert_frame_round_trip(msg, dlc * 1000);
+  }
+
+  msg.rtr = 1;
+  msg.data_length_code = 3;
+  assert_frame_round_trip(msg, 12345);
+}
+
+// A text record of SLCAN_BIN_MAX_TEXT bytes, zeros among them, is the longest record there is.
+static void test_longest_text() {
+  uint8_t text[SLCAN_BIN_MAX_TEXT + 8];
+  uint8_t rec[SLCAN_BIN_MAX_RECORD];
+  twai_message_t msg;
+  const char* out;
+  size_t out_len;
+
+  for (size_t i = 0; i < sizeof(text); i++) {
+    text[i] = i % 5 == 0 ? 0 : 'a' + i % 26;
+  }
+  size_t len = slcan_bin_encode_text(text, SLCAN_BIN_MAX_TEXT, rec);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_MAX_RECORD, len);
+  assert_framed(rec, len);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_TEXT, slcan_bin_decode(rec, len - 1, &msg, &out, &out_len));
+  TEST_ASSERT_EQUAL(SLCAN_BIN_MAX_TEXT, out_len);
+  TEST_ASSERT_EQUAL_MEMORY(text, out, SLCAN_BIN_MAX_TEXT);
+
+  // Longer text is cut to fit.
+  len = slcan_bin_encode_text(text, sizeof(text), rec);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_MAX_RECORD, len);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_TEXT, slcan_bin_decode(rec, len - 1, &msg, &out, &out_len));
+  TEST_ASSERT_EQUAL(SLCAN_BIN_MAX_TEXT, out_len);
+
+  // A record of all zeros but its header.
+  memset(text, 0, sizeof(text));
+  len = slcan_bin_encode_text(text, 16, rec);
+  assert_framed(rec, len);
+  TEST_ASSERT_EQUAL(SLCAN_BIN_TEXT, slcan_bin_decode(rec, len - 1, &msg, &out, &out_len));
+  TEST_ASSERT_EQUAL(16, out_len);
+  TEST_ASSERT_EQUAL_MEMORY(text, out, 16);
+}
+
+// Any one byte of a record changed, short of it becoming a terminator, fails the check.
+static void test_bad_crc() {
+  static const uint8_t TEXT[] = "t1232AABB\r";
+  uint8_t rec[SLCAN_BIN_MAX_RECORD];
+  uint8_t copy[SLCAN_BIN_MAX_RECORD];
+  twai_message_t msg;
+  const char* text;
+  size_t text_len;
+
+  size_t len = slcan_bin_encode_text(TEXT, sizeof(TEXT) - 1, rec);
+  for (size_t i = 0; i < len - 1; i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      memcpy(copy, rec, len);
+      copy[i] ^= 1 << bit;
+      if (copy[i] == 0) {
+        continue;
+      }
+      TEST_ASSERT_EQUAL(-1, slcan_bin_decode(copy, len - 1, &msg, &text, &text_len));
+    }
+  }
+
+  // The CRC's bytes swapped.
+  twai_message_t frame = {};
+  frame.identifier = 0x123;
+  frame.data_length_code = 2;
+  frame.data[0] = 0xAA;
+  frame.data[1] = 0xBB;
+  len = slcan_bin_encode_frame(&frame, 0, rec);
+  uint8_t t = rec[len - 2];
+  rec[len - 2] = rec[len - 3];
+  rec[len - 3] = t;
+  TEST_ASSERT_EQUAL(-1, slcan_bin_decode(rec, len - 1, &msg, &text, &text_len));
+}
+
+// A record cut short anywhere, as when the link drops bytes before a terminator, is refused.
+static void test_truncated() {
+  uint8_t rec[SLCAN_BIN_MAX_RECORD];
+  uint8_t copy[SLCAN_BIN_MAX_RECORD];
+  twai_message_t msg = {};
+  const char* text;
+  size_t text_len;
+
+  msg.identifier = 0x18DAF110;
+  msg.extd = 1;
+  msg.data_length_code = 8;
+  memcpy(msg.data, "\x02\x10\x03\x00\x00\x00\x00\x00", 8);
+  size_t len = slcan_bin_encode_frame(&msg, 0x01000000, rec);
+  for (size_t cut = 0; cut < len - 1; cut++) {
+    memcpy(copy, rec, len);
+    TEST_ASSERT_EQUAL(-1, slcan_bin_decode(copy, cut, &msg, &text, &text_len));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_round_trip);
+  RUN_TEST(test_longest_text);
+  RUN_TEST(test_bad_crc);
+  RUN_TEST(test_truncated);
+  return UNITY_END();
+}
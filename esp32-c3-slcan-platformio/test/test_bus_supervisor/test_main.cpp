@@ -0,0 +1,122 @@
+// Bus-off supervisor against the simulated controller's alerts: the recovery backoff doubling
+// up to its limit, starting over once the bus has been stable, and a longer backoff set by
+// the host being kept.
+
+#include <unity.h>
+#include "bus_supervisor.h"
+#include "sim_can_port.h"
+
+static SimCanPort port;
+static BusSupervisor supervisor;
+
+void setUp() {
+  port = SimCanPort();
+  port.running = true;
+  port.status.state = TWAI_STATE_RUNNING;
+  port.t_us = 1000000;
+  supervisor.backoff_ms = BUS_SUPERVISOR_BACKOFF_MS;
+  supervisor.reset();
+  supervisor.bus_offs = 0;
+  supervisor.recoveries = 0;
+  supervisor.seen = 0;
+}
+
+void tearDown() {
+}
+
+// Let `ms` pass, polling every millisecond as CAN-RX does when idle.
+static void run_for(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    port.t_us += 1000;
+    supervisor.poll(&port, port.t_us);
+  }
+}
+
+// Take the controller bus-off and return the milliseconds until the supervisor starts the
+// recovery, or 0 if it has not within a minute.
+static uint32_t bus_off() {
+  port.status.state = TWAI_STATE_BUS_OFF;
+  port.alerts = TWAI_ALERT_BUS_OFF;
+  run_for(1);
+  TEST_ASSERT_EQUAL(BUS_OFF, supervisor.state);
+  for (uint32_t ms = 0; ms < 60000; ms++) {
+    if (supervisor.state == BUS_RECOVERING) {
+      return ms;
+    }
+    run_for(1);
+  }
+  return 0;
+}
+
+// The controller finishes its recovery sequence.
+static void recovered() {
+  port.status.state = TWAI_STATE_RUNNING;
+  port.alerts = TWAI_ALERT_BUS_RECOVERED;
+  run_for(1);
+  TEST_ASSERT_EQUAL(BUS_ACTIVE, supervisor.state);
+}
+
+static void test_backoff_doubles() {
+  static const uint32_t EXPECTED[] = { 100, 200, 400, 800, 1600, 3200, 5000, 5000 };
+
+  for (uint32_t ms : EXPECTED) {
+    TEST_ASSERT_EQUAL(ms, bus_off());
+    recovered();
+  }
+  TEST_ASSERT_EQUAL(8, supervisor.bus_offs);
+  TEST_ASSERT_EQUAL(8, supervisor.recoveries);
+}
+
+// After BUS_SUPERVISOR_STABLE_MS without bus-off the backoff starts over; before that it
+// keeps growing.
+static void test_backoff_resets_when_stable() {
+  TEST_ASSERT_EQUAL(100, bus_off());
+  recovered();
+  TEST_ASSERT_EQUAL(200, bus_off());
+  recovered();
+  run_for(BUS_SUPERVISOR_STABLE_MS - 100);
+  TEST_ASSERT_EQUAL(400, bus_off());
+  recovered();
+  run_for(BUS_SUPERVISOR_STABLE_MS + 1);
+  TEST_ASSERT_EQUAL(100, bus_off());
+  recovered();
+  TEST_ASSERT_EQUAL(200, bus_off());
+}
+
+// A backoff set longer than BUS_SUPERVISOR_BACKOFF_MAX_MS does not shrink to it.
+static void test_long_backoff_kept() {
+  supervisor.backoff_ms = 8000;
+  supervisor.reset();
+  TEST_ASSERT_EQUAL(8000, bus_off());
+  recovered();
+  TEST_ASSERT_EQUAL(8000, bus_off());
+  recovered();
+
+  setUp();
+  supervisor.backoff_ms = 3000;
+  supervisor.reset();
+  TEST_ASSERT_EQUAL(3000, bus_off());
+  recovered();
+  TEST_ASSERT_EQUAL(5000, bus_off());
+  recovered();
+  TEST_ASSERT_EQUAL(5000, bus_off());
+}
+
+// With recovery off the controller stays bus-off for the host to deal with.
+static void test_recovery_off() {
+  supervisor.backoff_ms = 0;
+  supervisor.reset();
+  TEST_ASSERT_EQUAL(0, bus_off());
+  TEST_ASSERT_EQUAL(BUS_OFF, supervisor.state);
+  TEST_ASSERT_EQUAL(0, supervisor.recoveries);
+  TEST_ASSERT_TRUE(supervisor.seen & TWAI_ALERT_BUS_OFF);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_backoff_doubles);
+  RUN_TEST(test_backoff_resets_when_stable);
+  RUN_TEST(test_long_backoff_kept);
+  RUN_TEST(test_recovery_off);
+  return UNITY_END();
+}
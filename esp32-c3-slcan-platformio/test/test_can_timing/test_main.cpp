@@ -0,0 +1,186 @@
+// Bit timing calculator, table driven over the rates from 10k to 1M.
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "can_timing.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct TimingCase {
+  uint32_t bitrate;           // Requested
+  uint32_t sample_point;      // Requested, 1/1000 of a bit
+  uint32_t brp;               // Expected timing
+  uint8_t tseg_1;
+  uint8_t tseg_2;
+  uint32_t actual_sp;         // Sample point it gives
+  uint32_t error_ppm;         // Bitrate error it gives, at most
+};
+
+static const TimingCase CASES[] = {
+  // Default sample point
+  {   10000, 875, 500, 13, 2, 875, 0 },
+  {   20000, 875, 250, 13, 2, 875, 0 },
+  {   33333, 875, 150, 13, 2, 875, 10 },      // 33.3k, really 33333.3
+  {   50000, 875, 100, 13, 2, 875, 0 },
+  {   83333, 875,  60, 13, 2, 875, 4 },       // 83.3k, really 83333.3
+  {  100000, 875,  50, 13, 2, 875, 0 },
+  {  125000, 875,  40, 13, 2, 875, 0 },
+  {  250000, 875,  20, 13, 2, 875, 0 },
+  {  500000, 875,  10, 13, 2, 875, 0 },
+  {  800000, 875,  10,  8, 1, 900, 0 },       // 10 quanta: 80 or 90% only
+  { 1000000, 875,  10,  6, 1, 875, 0 },
+  // Early sample point for long lines
+  {   10000, 750, 400, 14, 5, 750, 0 },
+  {   33333, 750, 120, 14, 5, 750, 10 },
+  {   83333, 750,  48, 14, 5, 750, 4 },
+  {  125000, 750,  32, 14, 5, 750, 0 },
+  {  500000, 750,   8, 14, 5, 750, 0 },
+  {  800000, 750,  10,  6, 3, 700, 0 },
+  { 1000000, 750,   4, 14, 5, 750, 0 },
+  // The ESP-IDF defaults' 80%
+  {   50000, 800,  80, 15, 4, 800, 0 },
+  {  250000, 800,  16, 15, 4, 800, 0 },
+  {  800000, 800,  10,  7, 2, 800, 0 },
+  { 1000000, 800,   4, 15, 4, 800, 0 },
+};
+
+// Bitrate error of `t` against `bitrate` in ppm, exact rather than via the rounded
+// can_timing_bitrate().
+static uint32_t error_ppm(const twai_timing_config_t& t, uint32_t bitrate) {
+  uint64_t cycles = (uint64_t)t.brp * (1 + t.tseg_1 + t.tseg_2) * bitrate;
+  uint64_t diff = cycles > CAN_TIMING_CLOCK_HZ ? cycles - CAN_TIMING_CLOCK_HZ
+                                               : CAN_TIMING_CLOCK_HZ - cycles;
+  return diff * 1000000 / cycles;
+}
+
+static void test_table() {
+  for (const TimingCase& c : CASES) {
+    twai_timing_config_t t = {};
+    char what[96];
+
+    snprintf(what, sizeof(what), "%lu bit/s at %lu/1000", (unsigned long)c.bitrate,
+             (unsigned long)c.sample_point);
+    TEST_ASSERT_TRUE_MESSAGE(can_timing_calc(c.bitrate, c.sample_point, &t), what);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(c.brp, t.brp, what);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(c.tseg_1, t.tseg_1, what);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(c.tseg_2, t.tseg_2, what);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(c.actual_sp, can_timing_sample_point(t), what);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(c.error_ppm, error_ppm(t, c.bitrate), what);
+
+    // What the controller can take.
+    TEST_ASSERT_EQUAL_MESSAGE(0, t.brp % 2, what);
+    TEST_ASSERT_TRUE_MESSAGE(t.brp >= CAN_TIMING_BRP_MIN && t.brp <= CAN_TIMING_BRP_MAX, what);
+    TEST_ASSERT_TRUE_MESSAGE(t.tseg_1 >= 1 && t.tseg_1 <= CAN_TIMING_TSEG1_MAX, what);
+    TEST_ASSERT_TRUE_MESSAGE(t.tseg_2 >= 1 && t.tseg_2 <= CAN_TIMING_TSEG2_MAX, what);
+    TEST_ASSERT_TRUE_MESSAGE(t.sjw >= 1 && t.sjw <= t.tseg_2 && t.sjw <= CAN_TIMING_SJW_MAX,
+                             what);
+  }
+}
+
+// Every rate from 10k to 1M in 1k steps is either within the error limit or refused.  With
+// an even prescaler on 80 MHz many odd rates are out of reach, and the bitrate comes before
+// the sample point, which can then move a long way; both are reported.
+static void test_sweep() {
+  uint32_t rates = 0;
+  uint32_t refused = 0;
+  uint32_t worst_sp = CAN_TIMING_SAMPLE_POINT;
+  char report[128];
+
+  for (uint32_t bitrate = 10000; bitrate <= 1000000; bitrate += 1000) {
+    twai_timing_config_t t = {};
+    rates++;
+    if (!can_timing_calc(bitrate, CAN_TIMING_SAMPLE_POINT, &t)) {
+      TEST_ASSERT_EQUAL(0, t.brp);
+      refused++;
+      continue;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(CAN_TIMING_MAX_ERROR_PPM, error_ppm(t, bitrate));
+    uint32_t sp = can_timing_sample_point(t);
+    TEST_ASSERT_TRUE(sp > 500 && sp < 1000);
+    if (abs((int)sp - CAN_TIMING_SAMPLE_POINT) > abs((int)worst_sp - CAN_TIMING_SAMPLE_POINT)) {
+      worst_sp = sp;
+    }
+  }
+  snprintf(report, sizeof(report), "sweep: %lu of %lu rates within %d ppm, sample point %lu "
+           "at worst", (unsigned long)(rates - refused), (unsigned long)rates,
+           CAN_TIMING_MAX_ERROR_PPM, (unsigned long)worst_sp);
+  TEST_MESSAGE(report);
+}
+
+// The ESP-IDF presets are what the calculator reports them as.
+static void test_presets() {
+  static const twai_timing_config_t PRESETS[] = {
+    TWAI_TIMING_CONFIG_10KBITS(), TWAI_TIMING_CONFIG_25KBITS(), TWAI_TIMING_CONFIG_50KBITS(),
+    TWAI_TIMING_CONFIG_100KBITS(), TWAI_TIMING_CONFIG_125KBITS(),
+    TWAI_TIMING_CONFIG_250KBITS(), TWAI_TIMING_CONFIG_500KBITS(),
+    TWAI_TIMING_CONFIG_800KBITS(), TWAI_TIMING_CONFIG_1MBITS(),
+  };
+  static const uint32_t RATES[] = {
+    10000, 25000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000
+  };
+
+  for (size_t i = 0; i < sizeof(RATES) / sizeof(RATES[0]); i++) {
+    TEST_ASSERT_EQUAL_UINT32(RATES[i], can_timing_bitrate(PRESETS[i]));
+  }
+}
+
+static void test_refused() {
+  twai_timing_config_t t = {};
+
+  TEST_ASSERT_FALSE(can_timing_calc(0, 875, &t));
+  TEST_ASSERT_FALSE(can_timing_calc(500000, 0, &t));
+  TEST_ASSERT_FALSE(can_timing_calc(500000, 1000, &t));
+  TEST_ASSERT_FALSE(can_timing_calc(10000000, 875, &t));   // Fewer quanta than allowed
+  TEST_ASSERT_FALSE(can_timing_calc(100, 875, &t));        // Prescaler too large
+  TEST_ASSERT_FALSE(can_timing_calc(113000, 875, &t));     // No even prescaler within 0.5%
+  TEST_ASSERT_EQUAL(0, t.brp);
+}
+
+// The usual Lawicel `s` values for the SJA1000 at 16 MHz translate exactly.
+static void test_btr() {
+  static const struct {
+    uint8_t btr0, btr1;
+    uint32_t bitrate, sample_point;
+  } BTR[] = {
+    { 0x31, 0x1C,   10000, 875 },
+    { 0x18, 0x1C,   20000, 875 },
+    { 0x09, 0x1C,   50000, 875 },
+    { 0x04, 0x1C,  100000, 875 },
+    { 0x03, 0x1C,  125000, 875 },
+    { 0x01, 0x1C,  250000, 875 },
+    { 0x00, 0x1C,  500000, 875 },
+    { 0x00, 0x16,  800000, 800 },
+    { 0x00, 0x14, 1000000, 750 },
+  };
+
+  for (auto& b : BTR) {
+    twai_timing_config_t t;
+    can_timing_from_btr(b.btr0, b.btr1, &t);
+    TEST_ASSERT_EQUAL_UINT32(b.bitrate, can_timing_bitrate(t));
+    TEST_ASSERT_EQUAL_UINT32(b.sample_point, can_timing_sample_point(t));
+    TEST_ASSERT_EQUAL(1, t.sjw);
+    TEST_ASSERT_FALSE(t.triple_sampling);
+  }
+
+  // SJW in the top bits of BTR0, triple sampling in the top bit of BTR1.
+  twai_timing_config_t t;
+  can_timing_from_btr(0xC3, 0x9C, &t);
+  TEST_ASSERT_EQUAL(4, t.sjw);
+  TEST_ASSERT_TRUE(t.triple_sampling);
+  TEST_ASSERT_EQUAL_UINT32(125000, can_timing_bitrate(t));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_table);
+  RUN_TEST(test_sweep);
+  RUN_TEST(test_presets);
+  RUN_TEST(test_refused);
+  RUN_TEST(test_btr);
+  return UNITY_END();
+}
@@ -0,0 +1,277 @@
+// Table decoder for t/T/r/R commands, and a benchmark against the sscanf path it replaced.
+
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include "slcan_decode.h"
+
+// Commands decoded per benchmark run.
+#define BENCH_FRAMES 200000
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static bool decode(const char* body, bool ext, bool rtr, twai_message_t* msg) {
+  return slcan_decode_frame(body, strlen(body), ext, rtr, msg);
+}
+
+static void test_hex() {
+  uint32_t v = 0x55;
+
+  TEST_ASSERT_TRUE(slcan_decode_hex("0", 1, &v));
+  TEST_ASSERT_EQUAL_HEX32(0, v);
+  TEST_ASSERT_TRUE(slcan_decode_hex("1aBf", 4, &v));
+  TEST_ASSERT_EQUAL_HEX32(0x1ABF, v);
+  TEST_ASSERT_TRUE(slcan_decode_hex("FFFFFFFF", 8, &v));
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, v);
+
+  v = 0x55;
+  TEST_ASSERT_FALSE(slcan_decode_hex("12G4", 4, &v));
+  TEST_ASSERT_FALSE(slcan_decode_hex("g", 1, &v));
+  TEST_ASSERT_FALSE(slcan_decode_hex("1 2", 3, &v));
+  TEST_ASSERT_FALSE(slcan_decode_hex("\xC1", 1, &v));
+  TEST_ASSERT_EQUAL_HEX32(0x55, v);
+}
+
+// Every byte value outside 0-9, A-F and a-f is refused, in every position.
+static void test_hex_rejects_every_non_digit() {
+  for (int c = 0; c < 256; c++) {
+    char s[3] = { '0', '0', 0 };
+    bool digit = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+    uint32_t v;
+
+    s[0] = (char)c;
+    TEST_ASSERT_EQUAL(digit, slcan_decode_hex(s, 2, &v));
+    s[0] = '0';
+    s[1] = (char)c;
+    TEST_ASSERT_EQUAL(digit, slcan_decode_hex(s, 2, &v));
+  }
+}
+
+static void test_standard_frame() {
+  twai_message_t msg;
+
+  TEST_ASSERT_TRUE(decode("7FF80011223344556677", false, false, &msg));
+  TEST_ASSERT_EQUAL_HEX32(0x7FF, msg.identifier);
+  TEST_ASSERT_FALSE(msg.extd);
+  TEST_ASSERT_FALSE(msg.rtr);
+  TEST_ASSERT_EQUAL(8, msg.data_length_code);
+  for (int i = 0; i < 8; i++) {
+    TEST_ASSERT_EQUAL_HEX8(i * 0x11, msg.data[i]);
+  }
+
+  TEST_ASSERT_TRUE(decode("1230", false, false, &msg));
+  TEST_ASSERT_EQUAL_HEX32(0x123, msg.identifier);
+  TEST_ASSERT_EQUAL(0, msg.data_length_code);
+
+  TEST_ASSERT_TRUE(decode("0012abCD", false, false, &msg));
+  TEST_ASSERT_EQUAL_HEX8(0xAB, msg.data[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xCD, msg.data[1]);
+}
+
+static void test_extended_frame() {
+  twai_message_t msg;
+
+  TEST_ASSERT_TRUE(decode("1FFFFFFF1A5", true, false, &msg));
+  TEST_ASSERT_EQUAL_HEX32(0x1FFFFFFF, msg.identifier);
+  TEST_ASSERT_TRUE(msg.extd);
+  TEST_ASSERT_EQUAL(1, msg.data_length_code);
+  TEST_ASSERT_EQUAL_HEX8(0xA5, msg.data[0]);
+
+  TEST_ASSERT_TRUE(decode("000000000", true, false, &msg));
+  TEST_ASSERT_EQUAL_HEX32(0, msg.identifier);
+  TEST_ASSERT_EQUAL(0, msg.data_length_code);
+}
+
+static void test_remote_frame() {
+  twai_message_t msg;
+
+  TEST_ASSERT_TRUE(decode("1238", false, true, &msg));
+  TEST_ASSERT_TRUE(msg.rtr);
+  TEST_ASSERT_EQUAL(8, msg.data_length_code);
+  TEST_ASSERT_TRUE(decode("1ABCDEF04", true, true, &msg));
+  TEST_ASSERT_TRUE(msg.rtr);
+  TEST_ASSERT_TRUE(msg.extd);
+  TEST_ASSERT_EQUAL(4, msg.data_length_code);
+
+  // A remote frame carries no data, whatever its DLC.
+  TEST_ASSERT_FALSE(decode("1231AA", false, true, &msg));
+}
+
+static void test_rejects_bad_length() {
+  twai_message_t msg;
+
+  TEST_ASSERT_FALSE(decode("", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("123", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1231", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1231A", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1231AAB", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("12345678", true, false, &msg));
+}
+
+static void test_rejects_out_of_range() {
+  twai_message_t msg;
+
+  TEST_ASSERT_FALSE(decode("8000", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("200000000", true, false, &msg));
+  TEST_ASSERT_FALSE(decode("1239001122334455667788", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("123F", false, true, &msg));
+}
+
+static void test_rejects_bad_characters() {
+  twai_message_t msg;
+
+  TEST_ASSERT_FALSE(decode("12G0", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("123X", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1232AAZZ", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1232A AB", false, false, &msg));
+  TEST_ASSERT_FALSE(decode("1ABCDEFG0", true, false, &msg));
+  TEST_ASSERT_FALSE(decode("-120", false, false, &msg));
+}
+
+// Every data byte value comes back as it was written, in upper and lower case.
+static void test_all_byte_values() {
+  for (int b = 0; b < 256; b++) {
+    char body[8];
+    twai_message_t msg;
+
+    snprintf(body, sizeof(body), "1001%02X", b);
+    TEST_ASSERT_TRUE(decode(body, false, false, &msg));
+    TEST_ASSERT_EQUAL_HEX8(b, msg.data[0]);
+    snprintf(body, sizeof(body), "1001%02x", b);
+    TEST_ASSERT_TRUE(decode(body, false, false, &msg));
+    TEST_ASSERT_EQUAL_HEX8(b, msg.data[0]);
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Benchmark
+
+// The decoder send_canmsg() used before the table: one sscanf per field and per data byte.
+static bool sscanf_decode(const char* buf, bool ext, bool rtr, twai_message_t* msg) {
+  int dlc = 0;
+  int msg_id = 0;
+  int value = 0;
+
+  if (ext) {
+    sscanf(&buf[0], "%08X", &msg_id);
+    sscanf(&buf[8], "%01X", &dlc);
+    buf += 9;
+  } else {
+    sscanf(&buf[0], "%03X", &msg_id);
+    sscanf(&buf[3], "%01X", &dlc);
+    buf += 4;
+  }
+  if (dlc > 8) {
+    return false;
+  }
+  msg->flags = 0;
+  msg->identifier = msg_id;
+  msg->extd = ext;
+  msg->rtr = rtr;
+  msg->data_length_code = dlc;
+  if (!rtr) {
+    for (int i = 0; i < dlc; i++, buf += 2) {
+      sscanf(&buf[0], "%02X", &value);
+      msg->data[i] = value;
+    }
+  }
+  return true;
+}
+
+// A mix of standard and extended 0-8 byte frames as a host would send them.
+struct BenchLine {
+  char body[32];
+  bool ext;
+};
+
+static BenchLine lines[64];
+
+static void make_lines() {
+  uint32_t r = 0x2208;
+
+  for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    r = r * 1103515245 + 12345;
+    bool ext = (r >> 16) % 4 == 0;
+    int dlc = (r >> 8) % 9;
+    char* p = lines[i].body;
+    if (ext) {
+      p += sprintf(p, "%08X%d", (unsigned)(r & TWAI_EXTD_ID_MASK), dlc);
+    } else {
+      p += sprintf(p, "%03X%d", (unsigned)(r & TWAI_STD_ID_MASK), dlc);
+    }
+    for (int b = 0; b < dlc; b++) {
+      p += sprintf(p, "%02X", (unsigned)((r >> b) & 0xFF));
+    }
+    lines[i].ext = ext;
+  }
+}
+
+template<typename F>
+static double ns_per_frame(F decode_one) {
+  const size_t count = sizeof(lines) / sizeof(lines[0]);
+  uint32_t sink = 0;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+    twai_message_t msg;
+    const BenchLine& line = lines[i % count];
+    if (decode_one(line, &msg)) {
+      sink += msg.identifier + msg.data[0];
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  // Keep the loop from being optimised away.
+  TEST_ASSERT_TRUE(sink != 0x12345678);
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_FRAMES;
+}
+
+static void test_same_result_as_sscanf() {
+  make_lines();
+  for (const BenchLine& line : lines) {
+    twai_message_t a = {}, b = {};
+    TEST_ASSERT_TRUE(slcan_decode_frame(line.body, strlen(line.body), line.ext, false, &a));
+    TEST_ASSERT_TRUE(sscanf_decode(line.body, line.ext, false, &b));
+    TEST_ASSERT_EQUAL_HEX32(b.identifier, a.identifier);
+    TEST_ASSERT_EQUAL(b.extd, a.extd);
+    TEST_ASSERT_EQUAL(b.data_length_code, a.data_length_code);
+    TEST_ASSERT_EQUAL_MEMORY(b.data, a.data, a.data_length_code);
+  }
+}
+
+static void test_benchmark_vs_sscanf() {
+  char report[128];
+
+  make_lines();
+  double table_ns = ns_per_frame([](const BenchLine& line, twai_message_t* msg) {
+    return slcan_decode_frame(line.body, strlen(line.body), line.ext, false, msg);
+  });
+  double sscanf_ns = ns_per_frame([](const BenchLine& line, twai_message_t* msg) {
+    return sscanf_decode(line.body, line.ext, false, msg);
+  });
+  snprintf(report, sizeof(report), "decode: table %.1f ns/frame, sscanf %.1f ns/frame, %.1fx",
+           table_ns, sscanf_ns, sscanf_ns / table_ns);
+  TEST_MESSAGE(report);
+  TEST_ASSERT_TRUE(table_ns < sscanf_ns);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hex);
+  RUN_TEST(test_hex_rejects_every_non_digit);
+  RUN_TEST(test_standard_frame);
+  RUN_TEST(test_extended_frame);
+  RUN_TEST(test_remote_frame);
+  RUN_TEST(test_rejects_bad_length);
+  RUN_TEST(test_rejects_out_of_range);
+  RUN_TEST(test_rejects_bad_characters);
+  RUN_TEST(test_all_byte_values);
+  RUN_TEST(test_same_result_as_sscanf);
+  RUN_TEST(test_benchmark_vs_sscanf);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+// Table encoder for received frames, and a frames per second benchmark against the printf
+// path it replaced.
+
+#include <unity.h>
+#include <chrono>
+#include <initializer_list>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "byte_stream.h"
+#include "slcan_encode.h"
+
+// Frames encoded per benchmark run.
+#define BENCH_FRAMES 200000
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static twai_message_t make_msg(uint32_t id, bool extd, bool rtr, uint8_t dlc) {
+  twai_message_t msg = {};
+  msg.identifier = id;
+  msg.extd = extd;
+  msg.rtr = rtr;
+  msg.data_length_code = dlc;
+  for (int i = 0; i < TWAI_FRAME_MAX_DLC; i++) {
+    msg.data[i] = 0x10 * i + 0x0F - i;
+  }
+  return msg;
+}
+
+static std::string encode(const twai_message_t& msg, uint32_t ts = 0, size_t ts_digits = 0) {
+  char line[SLCAN_MAX_LINE];
+  size_t len = slcan_encode_frame(&msg, ts, ts_digits, line);
+  TEST_ASSERT_LESS_OR_EQUAL(SLCAN_MAX_LINE, len);
+  return std::string(line, len);
+}
+
+static void test_hex() {
+  char buf[9] = {};
+
+  TEST_ASSERT_TRUE(slcan_encode_hex(buf, 0x1ABCDEF0, 8) == buf + 8);
+  TEST_ASSERT_EQUAL_STRING("1ABCDEF0", buf);
+  memset(buf, 0, sizeof(buf));
+  slcan_encode_hex(buf, 0xFFFF12, 3);
+  TEST_ASSERT_EQUAL_STRING("F12", buf);
+}
+
+static void test_standard_frame() {
+  TEST_ASSERT_EQUAL_STRING("t7FF80F1E2D3C4B5A6978",
+                           encode(make_msg(0x7FF, false, false, 8)).c_str());
+  TEST_ASSERT_EQUAL_STRING("t0010", encode(make_msg(0x001, false, false, 0)).c_str());
+  TEST_ASSERT_EQUAL_STRING("t12320F1E", encode(make_msg(0x123, false, false, 2)).c_str());
+}
+
+static void test_extended_frame() {
+  TEST_ASSERT_EQUAL_STRING("T1FFFFFFF10F",
+                           encode(make_msg(0x1FFFFFFF, true, false, 1)).c_str());
+  TEST_ASSERT_EQUAL_STRING("T000012340", encode(make_msg(0x1234, true, false, 0)).c_str());
+}
+
+static void test_remote_frame() {
+  TEST_ASSERT_EQUAL_STRING("r1238", encode(make_msg(0x123, false, true, 8)).c_str());
+  TEST_ASSERT_EQUAL_STRING("R1ABCDEF04", encode(make_msg(0x1ABCDEF0, true, true, 4)).c_str());
+}
+
+static void test_timestamp() {
+  twai_message_t msg = make_msg(0x100, false, false, 1);
+
+  TEST_ASSERT_EQUAL_STRING("t10010FEA5F", encode(msg, 59999, 4).c_str());
+  TEST_ASSERT_EQUAL_STRING("t10010FDEADBEEF", encode(msg, 0xDEADBEEF, 8).c_str());
+}
+
+// Out of range fields are clipped rather than overrunning the line.
+static void test_clips_bad_fields() {
+  twai_message_t msg = make_msg(0xFFFFFFFF, true, false, 15);
+
+  TEST_ASSERT_EQUAL_STRING("T1FFFFFFF80F1E2D3C4B5A6978", encode(msg).c_str());
+  msg = make_msg(0xFFFF, false, false, 0);
+  TEST_ASSERT_EQUAL_STRING("t7FF0", encode(msg).c_str());
+
+  // The longest line there is still fits with its timestamp and terminator.
+  msg = make_msg(0x1FFFFFFF, true, false, 8);
+  TEST_ASSERT_LESS_OR_EQUAL(SLCAN_MAX_LINE, encode(msg, 0xFFFFFFFF, 8).size() + 3);
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Benchmark
+
+// Stands in for the serial driver: every call copies into its buffer, as a push into the
+// USB-CDC or UART driver would.
+class DriverSink : public ByteSink {
+public:
+  char buf[4096];
+  size_t len = 0;
+  uint32_t calls = 0;
+
+  size_t write(const uint8_t* data, size_t n) override {
+    if (len + n > sizeof(buf)) {
+      len = 0;
+    }
+    memcpy(&buf[len], data, n);
+    len += n;
+    calls++;
+    return n;
+  }
+  int available_for_write() override {
+    return sizeof(buf);
+  }
+  using ByteSink::write;
+};
+
+// What xfer_can2tty() did before the encoder: a formatted write for the header, one for
+// each data byte and one for the timestamp, then the terminator on its own.  Identifiers
+// are upper case here, as the encoder writes them, so the two outputs compare.
+static void printf_encode(const twai_message_t& msg, uint32_t ts, bool timestamp,
+                          ByteSink* out) {
+  if (msg.rtr) {
+    if (msg.extd) {
+      out->printf("R%08X%d", (unsigned)msg.identifier, msg.data_length_code);
+    } else {
+      out->printf("r%03X%d", (unsigned)msg.identifier, msg.data_length_code);
+    }
+  } else {
+    if (msg.extd) {
+      out->printf("T%08X%d", (unsigned)msg.identifier, msg.data_length_code);
+    } else {
+      out->printf("t%03X%d", (unsigned)msg.identifier, msg.data_length_code);
+    }
+    for (int i = 0; i < msg.data_length_code; i++) {
+      out->printf("%02X", msg.data[i]);
+    }
+  }
+  if (timestamp) {
+    out->printf("%04X", (unsigned)ts);
+  }
+  out->write("\r", 1);
+}
+
+static void table_encode(const twai_message_t& msg, uint32_t ts, bool timestamp,
+                         ByteSink* out) {
+  char line[SLCAN_MAX_LINE];
+  size_t len = slcan_encode_frame(&msg, ts, timestamp ? 4 : 0, line);
+  line[len++] = '\r';
+  out->write(line, len);
+}
+
+static twai_message_t bench_msgs[64];
+
+static void make_bench_msgs() {
+  uint32_t r = 0x2208;
+
+  for (twai_message_t& msg : bench_msgs) {
+    r = r * 1103515245 + 12345;
+    bool ext = (r >> 16) % 4 == 0;
+    msg = make_msg(r & (ext ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK), ext, false, (r >> 8) % 9);
+  }
+}
+
+template<typename F>
+static double frames_per_s(F encode_one, bool timestamp, uint32_t* calls) {
+  const size_t count = sizeof(bench_msgs) / sizeof(bench_msgs[0]);
+  DriverSink sink;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+    encode_one(bench_msgs[i % count], i, timestamp, &sink);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  *calls = sink.calls;
+  return BENCH_FRAMES / std::chrono::duration<double>(t1 - t0).count();
+}
+
+static void test_same_output_as_printf() {
+  make_bench_msgs();
+  for (const twai_message_t& msg : bench_msgs) {
+    DriverSink a, b;
+    table_encode(msg, 0x1234, true, &a);
+    printf_encode(msg, 0x1234, true, &b);
+    TEST_ASSERT_EQUAL(b.len, a.len);
+    TEST_ASSERT_EQUAL_MEMORY(b.buf, a.buf, a.len);
+  }
+}
+
+static void test_benchmark_vs_printf() {
+  char report[160];
+
+  make_bench_msgs();
+  for (bool timestamp : { false, true }) {
+    uint32_t table_calls, printf_calls;
+    double table_fps = frames_per_s(table_encode, timestamp, &table_calls);
+    double printf_fps = frames_per_s(printf_encode, timestamp, &printf_calls);
+    snprintf(report, sizeof(report),
+             "encode%s: table %.0f frames/s (%.1f writes/frame), "
+             "printf %.0f frames/s (%.1f writes/frame), %.1fx",
+             timestamp ? " with timestamp" : "", table_fps,
+             (double)table_calls / BENCH_FRAMES, printf_fps,
+             (double)printf_calls / BENCH_FRAMES, table_fps / printf_fps);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_EQUAL(BENCH_FRAMES, table_calls);
+    TEST_ASSERT_TRUE(table_fps > printf_fps);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hex);
+  RUN_TEST(test_standard_frame);
+  RUN_TEST(test_extended_frame);
+  RUN_TEST(test_remote_frame);
+  RUN_TEST(test_timestamp);
+  RUN_TEST(test_clips_bad_fields);
+  RUN_TEST(test_same_output_as_printf);
+  RUN_TEST(test_benchmark_vs_printf);
+  return UNITY_END();
+}
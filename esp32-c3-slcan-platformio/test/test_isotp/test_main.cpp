@@ -0,0 +1,357 @@
+// ISO-TP engine against a simulated ECU on the other end of the bus: single frames, multi-frame
+// transfers with flow control both ways, flow control waits and the timeouts.
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+#include "isotp.h"
+#include "sim_can_port.h"
+
+#define TESTER_ID   0x7E0       // The engine sends with this ID...
+#define ECU_ID      0x7E8       // ...and receives with this one
+
+// Time steps of the simulation.
+#define STEP_US     100
+
+// What the engine reported.
+class Results : public IsoTpListener {
+public:
+  std::vector<std::vector<uint8_t>> pdus;
+  uint32_t sent = 0;
+  std::vector<IsoTpError> errors;
+  std::vector<bool> error_tx;
+
+  void on_pdu(const uint8_t* pdu, size_t len) override {
+    pdus.push_back(std::vector<uint8_t>(pdu, pdu + len));
+  }
+  void on_sent() override {
+    sent++;
+  }
+  void on_error(IsoTpError error, bool tx) override {
+    errors.push_back(error);
+    error_tx.push_back(tx);
+  }
+};
+
+static SimCanPort port;
+static IsoTp isotp;
+static Results results;
+
+// The other end, with a small ISO-TP of its own.  It takes the engine's frames off the
+// simulated bus and answers them, its frames reaching the engine when they are due.
+class SimEcu {
+  struct Due {
+    int64_t at_us;
+    twai_message_t msg;
+  };
+  std::vector<Due> due;
+
+  // Receiving
+  size_t rx_len = 0;
+  uint8_t rx_sn = 0;
+  uint8_t rx_block_left = 0;
+
+  // Sending
+  std::vector<uint8_t> tx_pdu;
+  size_t tx_pos = 0;
+  uint8_t tx_sn = 0;
+
+  void send(int64_t at_us, const uint8_t* data, size_t len) {
+    Due d = { at_us, {} };
+    d.msg.identifier = ECU_ID;
+    d.msg.data_length_code = len;
+    memcpy(d.msg.data, data, len);
+    due.push_back(d);
+  }
+
+  // Answer a first frame or a finished block: wait as often as asked, then continue.
+  void send_fc(int64_t now_us) {
+    int64_t at_us = now_us + STEP_US;
+    for (int i = 0; i < waits; i++) {
+      uint8_t wait[3] = { 0x31, 0, 0 };
+      send(at_us, wait, 3);
+      at_us += wait_gap_us;
+    }
+    uint8_t cts[3] = { (uint8_t)(0x30 | flow_status), block_size, st_min };
+    send(at_us, cts, 3);
+  }
+
+  // Queue the consecutive frames the engine's flow control lets through.
+  void send_block(int64_t now_us, uint8_t bs) {
+    int64_t at_us = now_us + STEP_US;
+    for (int n = 0; tx_pos < tx_pdu.size() && (bs == 0 || n < bs); n++) {
+      uint8_t cf[8] = { (uint8_t)(0x20 | tx_sn) };
+      size_t len = tx_pdu.size() - tx_pos < 7 ? tx_pdu.size() - tx_pos : 7;
+      memcpy(&cf[1], &tx_pdu[tx_pos], len);
+      send(at_us, cf, len + 1);
+      tx_pos += len;
+      tx_sn = (tx_sn + 1) & 0x0F;
+      at_us += STEP_US;
+    }
+  }
+
+public:
+  // Flow control the ECU answers with.
+  uint8_t block_size = 0;
+  uint8_t st_min = 0;
+  uint8_t flow_status = 0;     // Of the flow control that continues
+  int waits = 0;               // Waits before each continue, wait_gap_us apart
+  int64_t wait_gap_us = 0;
+  bool silent = false;         // Answers nothing at all
+  bool stop_after_ff = false;  // Sends its first frame and nothing after
+
+  std::vector<uint8_t> received;
+  bool complete = false;
+  std::vector<int64_t> cf_us;  // When each consecutive frame from the engine came
+  std::vector<twai_message_t> fcs;  // Flow control frames from the engine
+
+  void reset() {
+    *this = SimEcu();
+  }
+
+  // Send `pdu` to the engine.
+  void send_pdu(const std::vector<uint8_t>& pdu, int64_t now_us) {
+    tx_pdu = pdu;
+    if (pdu.size() <= 7) {
+      uint8_t sf[8] = { (uint8_t)pdu.size() };
+      memcpy(&sf[1], pdu.data(), pdu.size());
+      send(now_us, sf, pdu.size() + 1);
+      return;
+    }
+    uint8_t ff[8] = { (uint8_t)(0x10 | pdu.size() >> 8), (uint8_t)pdu.size() };
+    memcpy(&ff[2], pdu.data(), 6);
+    tx_pos = 6;
+    tx_sn = 1;
+    send(now_us, ff, 8);
+  }
+
+  // Take the engine's frames off the bus, and hand it the ECU's that are due.
+  void service(int64_t now_us) {
+    while (!port.tx.empty()) {
+      twai_message_t msg = port.tx.front();
+      port.tx.pop_front();
+      TEST_ASSERT_EQUAL_HEX32(TESTER_ID, msg.identifier);
+      if (silent) {
+        continue;
+      }
+      const uint8_t* data = msg.data;
+      switch (data[0] & 0xF0) {
+        case 0x00:
+          received.assign(&data[1], &data[1] + (data[0] & 0x0F));
+          complete = true;
+          break;
+        case 0x10:
+          rx_len = (data[0] & 0x0F) << 8 | data[1];
+          received.assign(&data[2], &data[8]);
+          rx_sn = 1;
+          rx_block_left = block_size;
+          send_fc(now_us);
+          break;
+        case 0x20: {
+          TEST_ASSERT_EQUAL(rx_sn, data[0] & 0x0F);
+          cf_us.push_back(now_us);
+          size_t n = rx_len - received.size() < 7 ? rx_len - received.size() : 7;
+          received.insert(received.end(), &data[1], &data[1] + n);
+          rx_sn = (rx_sn + 1) & 0x0F;
+          if (received.size() == rx_len) {
+            complete = true;
+          } else if (block_size && --rx_block_left == 0) {
+            rx_block_left = block_size;
+            send_fc(now_us);
+          }
+          break;
+        }
+        case 0x30:
+          fcs.push_back(msg);
+          if (!stop_after_ff && (data[0] & 0x0F) == 0) {
+            send_block(now_us, data[1]);
+          }
+          break;
+      }
+    }
+    for (size_t i = 0; i < due.size();) {
+      if (due[i].at_us <= now_us) {
+        twai_message_t msg = due[i].msg;
+        due.erase(due.begin() + i);
+        isotp.on_frame(msg, now_us);
+      } else {
+        i++;
+      }
+    }
+  }
+};
+
+static SimEcu ecu;
+
+static bool transmit(const twai_message_t& msg) {
+  return port.transmit(msg, 0);
+}
+
+static IsoTpConfig config(uint8_t block_size, uint8_t st_min) {
+  IsoTpConfig c = { TESTER_ID, ECU_ID, false, block_size, st_min, -1 };
+  return c;
+}
+
+static std::vector<uint8_t> make_pdu(size_t len) {
+  std::vector<uint8_t> pdu(len);
+  for (size_t i = 0; i < len; i++) {
+    pdu[i] = (uint8_t)(i * 7 + 1);
+  }
+  return pdu;
+}
+
+// Run the engine and the ECU for `us` of simulated time.
+static void run_for(int64_t us) {
+  int64_t end = port.t_us + us;
+  while (port.t_us < end) {
+    ecu.service(port.t_us);
+    isotp.poll(port.t_us);
+    ecu.service(port.t_us);
+    port.t_us += STEP_US;
+  }
+}
+
+void setUp() {
+  port = SimCanPort();
+  port.running = true;
+  results = Results();
+  ecu.reset();
+  isotp = IsoTp();
+  isotp.begin(transmit, &results);
+  isotp.configure(config(0, 0));
+}
+
+void tearDown() {
+}
+
+static void test_single_frame() {
+  std::vector<uint8_t> request = { 0x22, 0xF1, 0x90 };
+
+  TEST_ASSERT_TRUE(isotp.send(request.data(), request.size(), port.t_us));
+  run_for(1000);
+  TEST_ASSERT_EQUAL(1, results.sent);
+  TEST_ASSERT_TRUE(ecu.complete);
+  TEST_ASSERT_TRUE(ecu.received == request);
+
+  std::vector<uint8_t> response = make_pdu(7);
+  ecu.send_pdu(response, port.t_us);
+  run_for(1000);
+  TEST_ASSERT_EQUAL(1, results.pdus.size());
+  TEST_ASSERT_TRUE(results.pdus[0] == response);
+  TEST_ASSERT_EQUAL(0, results.errors.size());
+  TEST_ASSERT_EQUAL(0, ecu.fcs.size());
+}
+
+// The ECU asks for blocks of 4 frames at least 2 ms apart, and gets them.
+static void test_multi_frame_send() {
+  std::vector<uint8_t> pdu = make_pdu(100);
+
+  ecu.block_size = 4;
+  ecu.st_min = 2;
+  TEST_ASSERT_TRUE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  TEST_ASSERT_FALSE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  run_for(100000);
+  TEST_ASSERT_EQUAL(1, results.sent);
+  TEST_ASSERT_EQUAL(0, results.errors.size());
+  TEST_ASSERT_TRUE(ecu.complete);
+  TEST_ASSERT_TRUE(ecu.received == pdu);
+  // 6 bytes in the first frame, 7 in each consecutive one.
+  TEST_ASSERT_EQUAL(14, ecu.cf_us.size());
+  // STmin holds within a block; the first frame of the next one follows the flow control.
+  for (size_t i = 1; i < ecu.cf_us.size(); i++) {
+    if (i % 4 != 0) {
+      TEST_ASSERT_GREATER_OR_EQUAL(2000, ecu.cf_us[i] - ecu.cf_us[i - 1]);
+    }
+  }
+}
+
+// The engine asks for blocks of 3 and keeps asking until the PDU is in.
+static void test_multi_frame_receive() {
+  std::vector<uint8_t> pdu = make_pdu(300);
+
+  isotp.configure(config(3, 0));
+  ecu.send_pdu(pdu, port.t_us);
+  run_for(100000);
+  TEST_ASSERT_EQUAL(1, results.pdus.size());
+  TEST_ASSERT_TRUE(results.pdus[0] == pdu);
+  TEST_ASSERT_EQUAL(0, results.errors.size());
+  // One flow control after the first frame, then one after each block of 3 but the last:
+  // 294 bytes take 42 consecutive frames.
+  TEST_ASSERT_EQUAL(14, ecu.fcs.size());
+  TEST_ASSERT_EQUAL_HEX8(0x30, ecu.fcs[0].data[0]);
+  TEST_ASSERT_EQUAL(3, ecu.fcs[0].data[1]);
+}
+
+// Waits restart the flow control timeout, up to ISOTP_MAX_WAIT in a row.
+static void test_flow_control_wait() {
+  std::vector<uint8_t> pdu = make_pdu(20);
+
+  ecu.waits = 3;
+  ecu.wait_gap_us = ISOTP_TIMEOUT_US * 3 / 4;
+  TEST_ASSERT_TRUE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  run_for(4 * ISOTP_TIMEOUT_US);
+  TEST_ASSERT_EQUAL(1, results.sent);
+  TEST_ASSERT_EQUAL(0, results.errors.size());
+  TEST_ASSERT_TRUE(ecu.received == pdu);
+
+  setUp();
+  ecu.waits = ISOTP_MAX_WAIT + 1;
+  ecu.wait_gap_us = 10000;
+  TEST_ASSERT_TRUE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  run_for(ISOTP_TIMEOUT_US);
+  TEST_ASSERT_EQUAL(0, results.sent);
+  TEST_ASSERT_EQUAL(1, results.errors.size());
+  TEST_ASSERT_EQUAL(ISOTP_ERR_WAIT, results.errors[0]);
+  TEST_ASSERT_TRUE(results.error_tx[0]);
+  TEST_ASSERT_FALSE(isotp.sending());
+}
+
+// An ECU that never sends flow control, or stops after its first frame, times out.
+static void test_timeouts() {
+  std::vector<uint8_t> pdu = make_pdu(20);
+
+  ecu.silent = true;
+  TEST_ASSERT_TRUE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  run_for(ISOTP_TIMEOUT_US - STEP_US);
+  TEST_ASSERT_EQUAL(0, results.errors.size());
+  run_for(2 * STEP_US);
+  TEST_ASSERT_EQUAL(1, results.errors.size());
+  TEST_ASSERT_EQUAL(ISOTP_ERR_TIMEOUT_FC, results.errors[0]);
+  TEST_ASSERT_TRUE(results.error_tx[0]);
+  TEST_ASSERT_FALSE(isotp.sending());
+
+  setUp();
+  ecu.stop_after_ff = true;
+  ecu.send_pdu(pdu, port.t_us);
+  run_for(ISOTP_TIMEOUT_US + 2 * STEP_US);
+  TEST_ASSERT_EQUAL(0, results.pdus.size());
+  TEST_ASSERT_EQUAL(1, results.errors.size());
+  TEST_ASSERT_EQUAL(ISOTP_ERR_TIMEOUT_CF, results.errors[0]);
+  TEST_ASSERT_FALSE(results.error_tx[0]);
+  TEST_ASSERT_FALSE(isotp.receiving());
+}
+
+// A reserved flow status ends the transfer at once rather than at the N_Bs timeout.
+static void test_reserved_flow_status() {
+  std::vector<uint8_t> pdu = make_pdu(20);
+
+  ecu.flow_status = 3;
+  TEST_ASSERT_TRUE(isotp.send(pdu.data(), pdu.size(), port.t_us));
+  run_for(10 * STEP_US);
+  TEST_ASSERT_EQUAL(1, results.errors.size());
+  TEST_ASSERT_EQUAL(ISOTP_ERR_FLOW_STATUS, results.errors[0]);
+  TEST_ASSERT_TRUE(results.error_tx[0]);
+  TEST_ASSERT_FALSE(isotp.sending());
+  TEST_ASSERT_EQUAL(0, ecu.cf_us.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_frame);
+  RUN_TEST(test_multi_frame_send);
+  RUN_TEST(test_multi_frame_receive);
+  RUN_TEST(test_flow_control_wait);
+  RUN_TEST(test_timeouts);
+  RUN_TEST(test_reserved_flow_status);
+  return UNITY_END();
+}
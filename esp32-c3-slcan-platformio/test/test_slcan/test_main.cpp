@@ -0,0 +1,325 @@
+// SLCAN core against a simulated bus and host: commands in, frames out and back.
+
+#include <unity.h>
+#include "sim_can_port.h"
+#include "slcan.h"
+
+static SimCanPort port;
+static SimHost host;
+
+// Run every task function until nothing moves any more.
+static void pump() {
+  xfer_tty2can();
+  while (xfer_can2ring(0)) {
+  }
+  while (xfer_reply2tty() || xfer_can2tty()) {
+  }
+  while (xfer_poll_tty()) {
+    port.t_us += 1000;
+  }
+}
+
+static std::string command(const char* cmd) {
+  host.in += cmd;
+  pump();
+  return host.take();
+}
+
+void setUp() {
+  port = SimCanPort();
+  host = SimHost();
+  slcan_begin(&port, &host, &host);
+  command("C\rZ0\rS6\r");
+}
+
+void tearDown() {
+}
+
+static void test_open_close() {
+  TEST_ASSERT_EQUAL_STRING("Z\r", command("O\r").c_str());
+  TEST_ASSERT_TRUE(port.running);
+  TEST_ASSERT_EQUAL(TWAI_MODE_NORMAL, port.mode);
+  TEST_ASSERT_EQUAL(8, port.timing.brp);
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("O\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("Z\r", command("C\r").c_str());
+  TEST_ASSERT_FALSE(port.running);
+  TEST_ASSERT_EQUAL_STRING("Z\r", command("L\r").c_str());
+  TEST_ASSERT_EQUAL(TWAI_MODE_LISTEN_ONLY, port.mode);
+}
+
+static void test_transmit() {
+  command("O\r");
+  TEST_ASSERT_EQUAL_STRING("Z\rZ\rZ\r", command("t1232AABB\rT1ABCDEF0111\rr7FF3\r").c_str());
+  TEST_ASSERT_EQUAL(3, port.tx.size());
+
+  TEST_ASSERT_EQUAL_HEX32(0x123, port.tx[0].identifier);
+  TEST_ASSERT_FALSE(port.tx[0].extd);
+  TEST_ASSERT_EQUAL(2, port.tx[0].data_length_code);
+  TEST_ASSERT_EQUAL_HEX8(0xAA, port.tx[0].data[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xBB, port.tx[0].data[1]);
+
+  TEST_ASSERT_EQUAL_HEX32(0x1ABCDEF0, port.tx[1].identifier);
+  TEST_ASSERT_TRUE(port.tx[1].extd);
+  TEST_ASSERT_EQUAL(1, port.tx[1].data_length_code);
+
+  TEST_ASSERT_EQUAL_HEX32(0x7FF, port.tx[2].identifier);
+  TEST_ASSERT_TRUE(port.tx[2].rtr);
+  TEST_ASSERT_EQUAL(3, port.tx[2].data_length_code);
+}
+
+static void test_malformed_transmit() {
+  command("O\r");
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("t12G1AA\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("t1239\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("t1232AA\r").c_str());
+  TEST_ASSERT_EQUAL(0, port.tx.size());
+}
+
+static void test_transmit_closed() {
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("t1230\r").c_str());
+  TEST_ASSERT_EQUAL(0, port.tx.size());
+}
+
+// The autobaud dwell is 1 to SLCAN_AUTOBAUD_MAX_DWELL_MS ms; outside that nothing is probed.
+static void test_autobaud_dwell_range() {
+  uint32_t epoch = port.epoch;
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("a0\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("a1001\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("a4294967296\r").c_str());
+  TEST_ASSERT_EQUAL(epoch, port.epoch);
+
+  // The longest dwell is taken; with nothing on the bus no rate is found.
+  int64_t start_us = port.t_us;
+  TEST_ASSERT_EQUAL_STRING("\a\r", command("a1000\r").c_str());
+  TEST_ASSERT_TRUE(port.epoch > epoch);
+  TEST_ASSERT_TRUE(port.t_us - start_us >= 1000000);
+  TEST_ASSERT_FALSE(port.running);
+}
+
+static void test_receive() {
+  static const uint8_t DATA[] = { 0x01, 0xFE, 0x10 };
+
+  command("O\r");
+  port.inject(0x7FF, false, DATA, 3);
+  port.inject(0x1ABCDEF, true, DATA, 2);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t7FF301FE10\rT01ABCDEF201FE\r", host.take().c_str());
+}
+
+static void test_receive_timestamp() {
+  static const uint8_t DATA[] = { 0x55 };
+
+  command("O\rZ1\r");
+  port.t_us = 61234000;      // 1.234 s into the minute
+  port.inject(0x100, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t10015504D2\r", host.take().c_str());
+}
+
+// `cc` is carried out by serial-TX, the capture ring's consumer, yet a report right after it
+// already sees the ring empty, and frames recorded since are kept.
+static void test_capture_clear() {
+  static uint32_t mem[256];
+  static const uint8_t DATA[] = { 0xAA };
+
+  slcan_capture_memory(mem, sizeof(mem));
+  command("O\rc1\r");
+  // CAN-RX only wakes serial-TX for a recorded frame while dumping, so pump() takes one in.
+  port.inject(0x100, false, DATA, 1);
+  pump();
+  port.inject(0x101, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("c on n=2 cap=32 dump=0 drops=0Z\r", command("c\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("Z\rZ\rc off n=0 cap=32 dump=0 drops=0Z\r",
+                           command("c0\rcc\rc\r").c_str());
+
+  command("c1\r");
+  port.inject(0x102, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("Z\rZ\rt1021AA\r", command("c0\rcd\r").c_str());
+}
+
+// Periodic frames go out as the host's do: self received in self-test mode, and counted.
+static void test_periodic_self_test() {
+  uint32_t frames = slcan_counters.timer_tx_frames;
+  uint32_t full = slcan_counters.timer_tx_queue_full;
+  bool wake;
+
+  command("Y\rF\rp0=t1231AA\rp0@10\rp0+\r");
+  xfer_schedule(&wake);
+  TEST_ASSERT_EQUAL(1, port.tx.size());
+  TEST_ASSERT_TRUE(port.tx[0].self);
+  TEST_ASSERT_EQUAL(frames + 1, slcan_counters.timer_tx_frames);
+
+  port.tx_room = 0;
+  port.t_us += 10000;
+  xfer_schedule(&wake);
+  TEST_ASSERT_EQUAL(full + 1, slcan_counters.timer_tx_queue_full);
+  TEST_ASSERT_EQUAL_STRING("F02\r", command("F\r").c_str());
+  command("pc\r");
+}
+
+// `o1` after `o0` starts over: CAN-RX clears the table before it next looks a frame up.
+static void test_on_change_restart() {
+  static const uint8_t DATA[] = { 0x42 };
+
+  command("O\ro1\r");
+  port.inject(0x321, false, DATA, 1);
+  port.inject(0x321, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t321142\r", host.take().c_str());
+
+  command("o0\ro1\r");
+  port.inject(0x321, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t321142\r", host.take().c_str());
+  TEST_ASSERT_TRUE(command("o\r").find(" ids=1 held=0 ") != std::string::npos);
+  command("o0\r");
+}
+
+// `d1` after `d0` starts over in the same way.
+static void test_rate_limit_restart() {
+  static const uint8_t DATA[] = { 0x42 };
+
+  command("O\rds321,7FF,1\rd1\r");
+  port.inject(0x321, false, DATA, 1);
+  port.inject(0x321, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t321142\r", host.take().c_str());
+
+  command("d0\rd1\r");
+  port.inject(0x321, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t321142\r", host.take().c_str());
+  TEST_ASSERT_TRUE(command("d\r").find(" ids=1 dropped=0 ") != std::string::npos);
+  command("d0\rdc\r");
+}
+
+// And so does `u1` after `u0`.
+static void test_bus_stats_restart() {
+  static const uint8_t DATA[] = { 0x42 };
+
+  command("O\ru1\r");
+  port.inject(0x321, false, DATA, 1);
+  port.inject(0x322, false, DATA, 1);
+  pump();
+  host.take();
+  TEST_ASSERT_TRUE(command("u\r").find("u on ids=2 frames=2 ") == 0);
+
+  command("u0\ru1\r");
+  port.inject(0x321, false, DATA, 1);
+  pump();
+  host.take();
+  TEST_ASSERT_TRUE(command("u\r").find("u on ids=1 frames=1 ") == 0);
+  command("u0\r");
+}
+
+// The software filter is set up while closed and drops what it does not hold on CAN-RX.
+static void test_sw_filter_commands() {
+  static const uint8_t DATA[] = { 0x42 };
+  uint32_t filtered = slcan_counters.rx_filtered;
+
+  TEST_ASSERT_EQUAL_STRING("Z\rZ\r", command("fs123\rfe18DAF110-18DAF11F\r").c_str());
+  TEST_ASSERT_EQUAL_STRING("\a\r\a\r", command("fs80\rfe20000000\r").c_str());
+  TEST_ASSERT_TRUE(command("f\r").find("f std=1 ext=0 ranges=1 ") == 0);
+
+  command("O\r");
+  TEST_ASSERT_EQUAL_STRING("\a\r\a\r", command("fs124\rfc\r").c_str());
+  // A dropped frame ends pump()'s CAN-RX loop, so one frame at a time.
+  static const struct {
+    uint32_t id;
+    bool ext;
+  } FRAMES[] = { { 0x123, false }, { 0x124, false }, { 0x18DAF115, true }, { 0x123, true } };
+  for (const auto& f : FRAMES) {
+    port.inject(f.id, f.ext, DATA, 1);
+    pump();
+  }
+  TEST_ASSERT_EQUAL_STRING("t123142\rT18DAF115142\r", host.take().c_str());
+  TEST_ASSERT_EQUAL(filtered + 2, slcan_counters.rx_filtered);
+
+  TEST_ASSERT_EQUAL_STRING("Z\rZ\r", command("C\rfc\r").c_str());
+  TEST_ASSERT_TRUE(command("f\r").find("f std=0 ext=0 ranges=0 ") == 0);
+  command("O\r");
+  port.inject(0x124, false, DATA, 1);
+  pump();
+  TEST_ASSERT_EQUAL_STRING("t124142\r", host.take().c_str());
+}
+
+// `f` reports the controller filter fitted to the set and how many IDs it lets through per
+// wanted one.
+static void test_sw_filter_fit_report() {
+  command("fs100\rfs6FF\r");
+  std::string report = command("f\r");
+  TEST_ASSERT_TRUE(report.find(" dual ") != std::string::npos);
+  TEST_ASSERT_TRUE(report.find(" pass=1.00 std_pass=2 ext_pass=0 ") != std::string::npos);
+
+  command("fc\rfe18DAF110\rfe18DAF1FF\r");
+  report = command("f\r");
+  TEST_ASSERT_TRUE(report.find(" single code=C6D78880 mask=0000077F ") != std::string::npos);
+  TEST_ASSERT_TRUE(report.find(" pass=64.00 std_pass=0 ext_pass=128 ") != std::string::npos);
+  command("fc\r");
+}
+
+// `iw` takes 128 PDU bytes at a time.
+static void test_isotp_long_write() {
+  std::string cmd = "iw";
+
+  for (int i = 0; i < 128; i++) {
+    cmd += "5A";
+  }
+  TEST_ASSERT_EQUAL_STRING("Z\r", command((cmd + "\r").c_str()).c_str());
+  TEST_ASSERT_TRUE(command("i\r").find(" pdu=128 ") != std::string::npos);
+  // Other commands keep the shorter limit.
+  std::string frame = "t" + cmd.substr(0, SLCAN_MAX_CMD - 2) + "\r";
+  TEST_ASSERT_EQUAL_STRING("\a\r", command(frame.c_str()).c_str());
+  command("ix\r");
+}
+
+// The help is the longest reply there is, and still fits the reply ring whole.
+static void test_help_fits() {
+  uint32_t drops = slcan_counters.reply_drops;
+  std::string help = command("h\r");
+
+  TEST_ASSERT_EQUAL(drops, slcan_counters.reply_drops);
+  TEST_ASSERT_TRUE(help.find("CAN_SPEED:") != std::string::npos);
+}
+
+// Reopening reinstalls the driver, which clears its counters; the counts kept against them
+// start over too rather than wrapping.
+static void test_counts_after_reinstall() {
+  command("O\rF\r");
+  port.status.bus_error_count = 5;
+  command("u1\r");
+  port.status.bus_error_count = 7;
+  TEST_ASSERT_TRUE(command("u\r").find(" bus_err=2 ") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("F80\r", command("F\r").c_str());
+
+  command("C\rO\r");
+  TEST_ASSERT_EQUAL_STRING("F00\r", command("F\r").c_str());
+  port.status.bus_error_count = 1;
+  TEST_ASSERT_TRUE(command("u\r").find(" bus_err=1 ") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("F80\r", command("F\r").c_str());
+  command("u0\r");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_open_close);
+  RUN_TEST(test_transmit);
+  RUN_TEST(test_malformed_transmit);
+  RUN_TEST(test_transmit_closed);
+  RUN_TEST(test_autobaud_dwell_range);
+  RUN_TEST(test_receive);
+  RUN_TEST(test_receive_timestamp);
+  RUN_TEST(test_capture_clear);
+  RUN_TEST(test_periodic_self_test);
+  RUN_TEST(test_on_change_restart);
+  RUN_TEST(test_rate_limit_restart);
+  RUN_TEST(test_bus_stats_restart);
+  RUN_TEST(test_sw_filter_commands);
+  RUN_TEST(test_sw_filter_fit_report);
+  RUN_TEST(test_isotp_long_write);
+  RUN_TEST(test_help_fits);
+  RUN_TEST(test_counts_after_reinstall);
+  return UNITY_END();
+}
@@ -0,0 +1,275 @@
+// Software filter: the standard ID bitmap, the extended ID hash set and the extended ranges,
+// and the controller filter fitted to them.  The fit is checked against a model of the
+// controller's acceptance filter: every wanted ID must get through, and the pass counts it
+// claims must be what the model lets through.
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "sw_filter.h"
+
+static SwFilter filter;
+
+void setUp() {
+  filter.clear();
+}
+
+void tearDown() {
+}
+
+static bool match(uint32_t id, bool ext) {
+  twai_message_t msg = {};
+  msg.identifier = id;
+  msg.extd = ext;
+  return filter.match(msg);
+}
+
+static void test_std_bitmap() {
+  TEST_ASSERT_FALSE(filter.active());
+  TEST_ASSERT_TRUE(filter.add_std(0x100, 0x10F));
+  TEST_ASSERT_TRUE(filter.add_std(0x7FF, 0x7FF));
+  TEST_ASSERT_TRUE(filter.add_std(0x108, 0x110));
+  TEST_ASSERT_TRUE(filter.active());
+  TEST_ASSERT_EQUAL(18, filter.std_ids());
+
+  TEST_ASSERT_FALSE(match(0x0FF, false));
+  TEST_ASSERT_TRUE(match(0x100, false));
+  TEST_ASSERT_TRUE(match(0x110, false));
+  TEST_ASSERT_FALSE(match(0x111, false));
+  TEST_ASSERT_FALSE(match(0x7FE, false));
+  TEST_ASSERT_TRUE(match(0x7FF, false));
+  // Standard IDs say nothing about extended ones.
+  TEST_ASSERT_FALSE(match(0x100, true));
+
+  TEST_ASSERT_FALSE(filter.add_std(0x7FF, 0x800));
+  TEST_ASSERT_FALSE(filter.add_std(0x200, 0x1FF));
+  TEST_ASSERT_EQUAL(18, filter.std_ids());
+
+  filter.clear();
+  TEST_ASSERT_FALSE(filter.active());
+  TEST_ASSERT_FALSE(match(0x100, false));
+}
+
+// The hash set takes SW_FILTER_EXT_IDS IDs and refuses more, yet still finds those it has
+// and rejects others.
+static void test_ext_set_full() {
+  for (uint32_t i = 0; i < SW_FILTER_EXT_IDS; i++) {
+    TEST_ASSERT_TRUE(filter.add_ext(0x18DA0000 + i * 0x101, 0x18DA0000 + i * 0x101));
+  }
+  TEST_ASSERT_EQUAL(SW_FILTER_EXT_IDS, filter.ext_ids());
+  TEST_ASSERT_FALSE(filter.add_ext(0x0CF00400, 0x0CF00400));
+  // One it already has is no new entry.
+  TEST_ASSERT_TRUE(filter.add_ext(0x18DA0000, 0x18DA0000));
+  TEST_ASSERT_EQUAL(SW_FILTER_EXT_IDS, filter.ext_ids());
+
+  for (uint32_t i = 0; i < SW_FILTER_EXT_IDS; i++) {
+    TEST_ASSERT_TRUE(match(0x18DA0000 + i * 0x101, true));
+    TEST_ASSERT_FALSE(match(0x18DA0001 + i * 0x101, true));
+  }
+  TEST_ASSERT_FALSE(match(0x0CF00400, true));
+  TEST_ASSERT_FALSE(match(0x000, false));
+  TEST_ASSERT_FALSE(filter.add_ext(0x20000000, 0x20000000));
+
+  // Ranges have room of their own.
+  TEST_ASSERT_TRUE(filter.add_ext(0x0CF00400, 0x0CF004FF));
+  TEST_ASSERT_TRUE(match(0x0CF00480, true));
+}
+
+// Ranges are kept sorted whatever order they come in, and overlapping or nested ones do not
+// hide each other.
+static void test_ext_ranges() {
+  TEST_ASSERT_TRUE(filter.add_ext(0x3000, 0x3FFF));
+  TEST_ASSERT_TRUE(filter.add_ext(0x1000, 0x10FF));
+  TEST_ASSERT_TRUE(filter.add_ext(0x1080, 0x2800));
+  TEST_ASSERT_TRUE(filter.add_ext(0x5000, 0x9000));
+  TEST_ASSERT_TRUE(filter.add_ext(0x6000, 0x6001));
+  TEST_ASSERT_EQUAL(5, filter.ext_ranges_used());
+  TEST_ASSERT_EQUAL(0, filter.ext_ids());
+
+  TEST_ASSERT_FALSE(match(0x0FFF, true));
+  TEST_ASSERT_TRUE(match(0x1000, true));
+  TEST_ASSERT_TRUE(match(0x2000, true));
+  TEST_ASSERT_TRUE(match(0x2800, true));
+  TEST_ASSERT_FALSE(match(0x2801, true));
+  TEST_ASSERT_TRUE(match(0x3FFF, true));
+  TEST_ASSERT_FALSE(match(0x4000, true));
+  TEST_ASSERT_TRUE(match(0x6001, true));
+  TEST_ASSERT_TRUE(match(0x8000, true));
+  TEST_ASSERT_FALSE(match(0x9001, true));
+
+  for (size_t i = filter.ext_ranges_used(); i < SW_FILTER_EXT_RANGES; i++) {
+    TEST_ASSERT_TRUE(filter.add_ext(0x100000 * (i + 1), 0x100000 * (i + 1) + 1));
+  }
+  TEST_ASSERT_FALSE(filter.add_ext(0xA000, 0xAFFF));
+  TEST_ASSERT_FALSE(match(0xA000, true));
+  TEST_ASSERT_FALSE(filter.add_ext(0x1FFFFFFF, 0x20000000));
+}
+
+// The bits of `value` the filter compares, under a mask whose set bits are don't-care.
+static bool filter_match(uint32_t value, uint32_t code, uint32_t mask, uint32_t compared) {
+  return ((value ^ code) & ~mask & compared) == 0;
+}
+
+// Does the controller, set up as `c`, let the frame through?  The register layouts are those
+// described in sw_filter.cpp; bits 19-16 of the single filter and 1-0 of its extended form
+// compare nothing.
+static bool accepts(const twai_filter_config_t& c, uint32_t id, bool ext, bool rtr,
+                    uint8_t data0, uint8_t data1) {
+  uint32_t code = c.acceptance_code;
+  uint32_t mask = c.acceptance_mask;
+
+  if (c.single_filter) {
+    if (ext) {
+      return filter_match(id << 3 | rtr << 2, code, mask, 0xFFFFFFFC);
+    }
+    return filter_match(id << 21 | rtr << 20 | data0 << 8 | data1, code, mask, 0xFFF0FFFF);
+  }
+  if (ext) {
+    return filter_match((id >> 13) << 16, code, mask, 0xFFFF0000)
+           || filter_match(id >> 13, code, mask, 0x0000FFFF);
+  }
+  return filter_match(id << 21 | rtr << 20 | (data0 >> 4) << 16 | (data0 & 0x0F), code, mask,
+                      0xFFFF000F)
+         || filter_match(id << 5 | rtr << 4, code, mask, 0x0000FFF0);
+}
+
+// Standard IDs the controller lets through, taken over every RTR flag and first data byte.
+static double std_passed(const twai_filter_config_t& c) {
+  uint32_t passed = 0;
+  for (uint32_t id = 0; id <= TWAI_STD_ID_MASK; id++) {
+    for (int rtr = 0; rtr < 2; rtr++) {
+      for (int data = 0; data < 256; data++) {
+        passed += accepts(c, id, false, rtr, data, 0);
+      }
+    }
+  }
+  return passed / 512.0;
+}
+
+// Extended IDs the controller lets through, over both RTR flags.  What the filters compare
+// of ID bits 28-13 and of bits 12-0 is independent, so the two halves are counted apart.
+static double ext_passed(const twai_filter_config_t& c) {
+  if (!c.single_filter) {
+    uint32_t high = 0;
+    for (uint32_t k = 0; k < 0x10000; k++) {
+      high += accepts(c, k << 13, true, false, 0, 0);
+    }
+    return high * 8192.0;
+  }
+  uint32_t high = 0, low = 0;
+  for (uint32_t k = 0; k < 0x10000; k++) {
+    high += filter_match(k << 16, c.acceptance_code, c.acceptance_mask, 0xFFFF0000);
+  }
+  for (uint32_t k = 0; k < 0x2000; k++) {
+    for (uint32_t rtr = 0; rtr < 2; rtr++) {
+      low += filter_match(k << 3 | rtr << 2, c.acceptance_code, c.acceptance_mask, 0x0000FFFC);
+    }
+  }
+  return high * (low / 2.0);
+}
+
+struct Range {
+  uint32_t lo, hi;
+  bool ext;
+};
+
+// Fill the filter with `set`, fit it, and check the fit against the model.
+static HwFilterFit check_fit(const std::vector<Range>& set) {
+  static const uint8_t DATA[] = { 0x00, 0x5A, 0xA5, 0xFF };
+  bool has_std = false, has_ext = false;
+  double wanted = 0;
+
+  filter.clear();
+  for (const Range& r : set) {
+    TEST_ASSERT_TRUE(r.ext ? filter.add_ext(r.lo, r.hi) : filter.add_std(r.lo, r.hi));
+    has_std |= !r.ext;
+    has_ext |= r.ext;
+  }
+  HwFilterFit fit = filter.hw_filter();
+
+  for (const Range& r : set) {
+    wanted += r.hi - r.lo + 1.0;
+    uint32_t ids[] = { r.lo, r.lo + (r.hi - r.lo) / 2, r.hi };
+    for (uint32_t id : ids) {
+      for (int rtr = 0; rtr < 2; rtr++) {
+        for (uint8_t data : DATA) {
+          char what[64];
+          snprintf(what, sizeof(what), "%s %lX rtr %d data %02X", r.ext ? "ext" : "std",
+                   (unsigned long)id, rtr, data);
+          TEST_ASSERT_TRUE_MESSAGE(accepts(fit.config, id, r.ext, rtr, data, data), what);
+        }
+      }
+    }
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.5, wanted, fit.wanted);
+  if (has_std) {
+    double passed = std_passed(fit.config);
+    TEST_ASSERT_FLOAT_WITHIN(passed * 1e-6, passed, fit.std_passed);
+  }
+  if (has_ext) {
+    double passed = ext_passed(fit.config);
+    TEST_ASSERT_FLOAT_WITHIN(passed * 1e-6, passed, fit.ext_passed);
+  }
+  return fit;
+}
+
+static void test_fit_accepts_wanted() {
+  // OBD-II diagnostic requests and responses
+  check_fit({ { 0x7DF, 0x7DF, false }, { 0x7E0, 0x7EF, false } });
+  check_fit({ { 0x100, 0x100, false }, { 0x101, 0x101, false }, { 0x6FF, 0x6FF, false } });
+  // 29-bit ISO-TP and J1939
+  check_fit({ { 0x18DAF110, 0x18DAF110, true }, { 0x18DAF111, 0x18DAF111, true },
+              { 0x18DB33F1, 0x18DB33F1, true } });
+  check_fit({ { 0x18FEF000, 0x18FEF0FF, true }, { 0x0CF00400, 0x0CF00400, true } });
+  // Both formats
+  check_fit({ { 0x7E8, 0x7E8, false }, { 0x18DAF110, 0x18DAF110, true } });
+}
+
+// Sets with little structure still get a fit that lets them all through.
+static void test_fit_accepts_scattered() {
+  uint32_t seed = 12345;
+
+  for (int round = 0; round < 8; round++) {
+    std::vector<Range> set;
+    for (int i = 0; i < 12; i++) {
+      seed = seed * 1103515245 + 12345;
+      bool ext = round >= 4 && (seed >> 31);
+      uint32_t id = (seed >> 3) & (ext ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK);
+      set.push_back({ id, id, ext });
+    }
+    check_fit(set);
+  }
+}
+
+// Two IDs far apart only share a single filter that lets everything through; each gets a
+// dual filter of its own instead.
+static void test_dual_when_tighter() {
+  HwFilterFit fit = check_fit({ { 0x100, 0x100, false }, { 0x6FF, 0x6FF, false } });
+  TEST_ASSERT_FALSE(fit.config.single_filter);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 2, fit.std_passed);
+
+  fit = check_fit({ { 0x00000000, 0x00000000, true }, { 0x1FFFFFFF, 0x1FFFFFFF, true } });
+  TEST_ASSERT_FALSE(fit.config.single_filter);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 2 * 8192, fit.ext_passed);
+
+  // Neighbours fit a single filter exactly, which is kept.
+  fit = check_fit({ { 0x100, 0x101, false } });
+  TEST_ASSERT_TRUE(fit.config.single_filter);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 2, fit.std_passed);
+
+  // The dual filters only see extended ID bits 28-13, the single one all of them.
+  fit = check_fit({ { 0x18DAF110, 0x18DAF111, true } });
+  TEST_ASSERT_TRUE(fit.config.single_filter);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 2, fit.ext_passed);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_std_bitmap);
+  RUN_TEST(test_ext_set_full);
+  RUN_TEST(test_ext_ranges);
+  RUN_TEST(test_fit_accepts_wanted);
+  RUN_TEST(test_fit_accepts_scattered);
+  RUN_TEST(test_dual_when_tighter);
+  return UNITY_END();
+}
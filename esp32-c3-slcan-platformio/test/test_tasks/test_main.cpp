@@ -0,0 +1,407 @@
+// Frame rings and the CAN-RX / serial-RX / serial-TX task split.
+//
+// The ring tests check the single-producer single-consumer contract on its own.  The latency
+// test runs the three task loops of src/main.cpp on threads against a flooded simulated bus
+// while the host keeps sending, and checks that neither direction waits on the other.
+
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ring_buffer.h"
+#include "slcan.h"
+
+// Offered load for the latency test: a frame every FRAME_GAP_US on the bus and a transmit
+// command every COMMAND_GAP_US from the host, for RUN_MS.
+#define FRAME_GAP_US    125         // About a full bus at 1 Mbit/s
+#define COMMAND_GAP_US  1000
+#define RUN_MS          500
+
+// Worst case allowed in either direction.  The single loop this replaced could sit in
+// twai_receive() for 10 s; scheduling noise on a loaded build machine stays well below this.
+#define LATENCY_BOUND_US 100000
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Rings
+
+static void test_ring_fill_and_wrap() {
+  SpscRing<int, 8> ring;
+  int v;
+
+  TEST_ASSERT_TRUE(ring.is_empty());
+  TEST_ASSERT_FALSE(ring.pop(&v));
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 8; i++) {
+      TEST_ASSERT_TRUE(ring.push(round * 8 + i));
+    }
+    TEST_ASSERT_TRUE(ring.is_full());
+    TEST_ASSERT_FALSE(ring.push(-1));
+    TEST_ASSERT_EQUAL(8, ring.length());
+    for (int i = 0; i < 8; i++) {
+      TEST_ASSERT_TRUE(ring.pop(&v));
+      TEST_ASSERT_EQUAL(round * 8 + i, v);
+    }
+    TEST_ASSERT_TRUE(ring.is_empty());
+  }
+
+  ring.push(1);
+  ring.push(2);
+  ring.clear();
+  TEST_ASSERT_TRUE(ring.is_empty());
+  TEST_ASSERT_FALSE(ring.pop(&v));
+}
+
+static void test_span_ring_attach() {
+  static uint32_t mem[100];
+  SpscSpanRing<uint32_t> ring;
+  uint32_t v;
+
+  TEST_ASSERT_EQUAL(0, ring.capacity());
+  TEST_ASSERT_FALSE(ring.push(1));
+  ring.attach(mem, sizeof(mem));
+  TEST_ASSERT_EQUAL(64, ring.capacity());
+  for (uint32_t i = 0; i < 64; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+  TEST_ASSERT_FALSE(ring.push(64));
+  TEST_ASSERT_TRUE(ring.pop(&v));
+  TEST_ASSERT_EQUAL(0, v);
+  TEST_ASSERT_TRUE(ring.push(64));
+  ring.clear();
+  TEST_ASSERT_TRUE(ring.is_empty());
+
+  // Only what was there at end() goes, and only once.
+  ring.push(1);
+  ring.push(2);
+  size_t end = ring.end();
+  ring.push(3);
+  ring.discard_to(end);
+  TEST_ASSERT_EQUAL(1, ring.length());
+  ring.discard_to(end);
+  TEST_ASSERT_TRUE(ring.pop(&v));
+  TEST_ASSERT_EQUAL(3, v);
+  ring.discard_to(end);
+  TEST_ASSERT_TRUE(ring.is_empty());
+}
+
+// One thread pushes a counting sequence as fast as it can, another pops it; every value must
+// come out once and in order.
+static void test_ring_threads() {
+  static SpscRing<uint32_t, 64> ring;
+  const uint32_t count = 1000000;
+  uint32_t expect = 0;
+  bool in_order = true;
+
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count; ) {
+      if (ring.push(i)) {
+        i++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  while (expect < count) {
+    uint32_t v;
+    if (ring.pop(&v)) {
+      in_order = in_order && v == expect;
+      expect++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(in_order);
+  TEST_ASSERT_TRUE(ring.is_empty());
+}
+
+// ---------------------------------------------------------------------------------------
+//
+// Task split
+
+static int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sleep_us(int64_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static uint32_t hex_u32(const char* s) {
+  uint32_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v = v << 4 | (s[i] <= '9' ? s[i] - '0' : s[i] - 'A' + 10);
+  }
+  return v;
+}
+
+static uint32_t frame_seq(const twai_message_t& msg) {
+  return msg.data[0] << 24 | msg.data[1] << 16 | msg.data[2] << 8 | msg.data[3];
+}
+
+// The bus, shared between the CAN-RX and serial-RX threads and the test.  Frames the host
+// sends back are stamped with the time they reached the bus.
+class ThreadedPort : public CanPort {
+  std::mutex lock;
+  std::vector<twai_message_t> rx;
+  size_t rx_next = 0;
+  std::atomic<bool> running{false};
+
+public:
+  std::vector<int64_t> tx_us;        // By sequence number
+
+  bool start(twai_mode_t, const twai_timing_config_t&, const twai_filter_config_t&) override {
+    running = true;
+    return true;
+  }
+  void stop() override {
+    running = false;
+  }
+  bool is_running() override {
+    return running;
+  }
+  bool transmit(const twai_message_t& msg, uint32_t) override {
+    std::lock_guard<std::mutex> hold(lock);
+    uint32_t seq = frame_seq(msg);
+    if (seq < tx_us.size()) {
+      tx_us[seq] = now_us();
+    }
+    return true;
+  }
+  bool receive(twai_message_t* msg, uint32_t timeout_ms) override {
+    int64_t until = now_us() + (int64_t)timeout_ms * 1000;
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> hold(lock);
+        if (rx_next < rx.size()) {
+          *msg = rx[rx_next++];
+          return true;
+        }
+      }
+      if (now_us() >= until) {
+        return false;
+      }
+      sleep_us(20);
+    }
+  }
+  bool set_queue_lengths(uint32_t, uint32_t) override {
+    return false;
+  }
+  void get_queue_lengths(uint32_t* rx_len, uint32_t* tx_len) override {
+    *rx_len = 64;
+    *tx_len = 16;
+  }
+  uint32_t read_alerts() override {
+    return 0;
+  }
+  bool initiate_recovery() override {
+    return false;
+  }
+  bool resume() override {
+    return true;
+  }
+  bool get_status(twai_status_info_t* info) override {
+    *info = {};
+    info->state = running ? TWAI_STATE_RUNNING : TWAI_STATE_STOPPED;
+    return running;
+  }
+  int64_t now_us() override {
+    return ::now_us();
+  }
+  void delay_ms(uint32_t ms) override {
+    sleep_us((int64_t)ms * 1000);
+  }
+
+  void inject(const twai_message_t& msg) {
+    std::lock_guard<std::mutex> hold(lock);
+    rx.push_back(msg);
+  }
+};
+
+// The serial link, shared between the serial-RX and serial-TX threads and the test.
+class ThreadedHost : public ByteSource, public ByteSink {
+  std::mutex lock;
+  std::string in;
+  size_t in_pos = 0;
+  std::string out;
+
+public:
+  int available() override {
+    std::lock_guard<std::mutex> hold(lock);
+    return in.size() - in_pos;
+  }
+  int read() override {
+    std::lock_guard<std::mutex> hold(lock);
+    return in_pos < in.size() ? (uint8_t)in[in_pos++] : -1;
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    std::lock_guard<std::mutex> hold(lock);
+    out.append((const char*)buf, len);
+    return len;
+  }
+  int available_for_write() override {
+    return 4096;
+  }
+  using ByteSink::write;
+
+  void send(const char* cmd) {
+    std::lock_guard<std::mutex> hold(lock);
+    in += cmd;
+  }
+  std::string take() {
+    std::lock_guard<std::mutex> hold(lock);
+    std::string s;
+    s.swap(out);
+    return s;
+  }
+};
+
+static ThreadedPort port;
+static ThreadedHost host;
+static std::atomic<bool> stopping{false};
+
+// The task bodies of src/main.cpp, with notifications replaced by short sleeps.
+
+static void can_rx_task() {
+  while (!stopping) {
+    xfer_can2ring(10);
+    xfer_supervise();
+  }
+}
+
+static void serial_rx_task() {
+  while (!stopping) {
+    if (host.available() <= 0) {
+      sleep_us(50);
+      continue;
+    }
+    xfer_tty2can();
+  }
+}
+
+static void serial_tx_task() {
+  while (!stopping) {
+    bool moved = xfer_reply2tty();
+    while (xfer_can2tty()) {
+      xfer_reply2tty();
+      moved = true;
+    }
+    bool pending = xfer_poll_tty();
+    if (!moved && !pending) {
+      sleep_us(50);
+    }
+  }
+}
+
+// Take what the host has received and note when each of our frames arrived.
+static void collect(std::string* out, std::vector<int64_t>* seen) {
+  *out += host.take();
+  int64_t t = now_us();
+  size_t pos;
+  while ((pos = out->find('\r')) != std::string::npos) {
+    if (pos == 13 && out->compare(0, 5, "t1004") == 0) {
+      uint32_t seq = hex_u32(&(*out)[5]);
+      if (seq < seen->size() && (*seen)[seq] < 0) {
+        (*seen)[seq] = t;
+      }
+    }
+    out->erase(0, pos + 1);
+  }
+}
+
+static void report(const char* what, std::vector<int64_t>& lat) {
+  char line[128];
+  std::sort(lat.begin(), lat.end());
+  snprintf(line, sizeof(line), "%s: n=%zu p50=%lld p99=%lld max=%lld us", what, lat.size(),
+           (long long)lat[lat.size() / 2], (long long)lat[lat.size() * 99 / 100],
+           (long long)lat.back());
+  TEST_MESSAGE(line);
+}
+
+static void test_latency_both_directions() {
+  const uint32_t frames = RUN_MS * 1000 / FRAME_GAP_US;
+  const uint32_t commands = RUN_MS * 1000 / COMMAND_GAP_US;
+  std::vector<int64_t> rx_sent(frames);
+  std::vector<int64_t> rx_seen(frames, -1);
+  std::vector<int64_t> tx_sent(commands);
+  std::string out;
+
+  port.tx_us.assign(commands, -1);
+  slcan_begin(&port, &host, &host);
+  host.send("C\rZ0\rO\r");
+
+  std::thread can_rx(can_rx_task);
+  std::thread serial_rx(serial_rx_task);
+  std::thread serial_tx(serial_tx_task);
+
+  int64_t start = now_us();
+  uint32_t f = 0, c = 0;
+  while (f < frames || c < commands) {
+    int64_t t = now_us() - start;
+    while (f < frames && (int64_t)f * FRAME_GAP_US <= t) {
+      twai_message_t msg = {};
+      msg.identifier = 0x100;
+      msg.data_length_code = 4;
+      msg.data[0] = f >> 24;
+      msg.data[1] = f >> 16;
+      msg.data[2] = f >> 8;
+      msg.data[3] = f;
+      rx_sent[f++] = now_us();
+      port.inject(msg);
+    }
+    while (c < commands && (int64_t)c * COMMAND_GAP_US <= t) {
+      char cmd[16];
+      snprintf(cmd, sizeof(cmd), "t2004%08X\r", (unsigned)c);
+      tx_sent[c++] = now_us();
+      host.send(cmd);
+    }
+    collect(&out, &rx_seen);
+    sleep_us(20);
+  }
+
+  // Let the last of it through.
+  int64_t drain = now_us() + LATENCY_BOUND_US;
+  while (now_us() < drain) {
+    collect(&out, &rx_seen);
+    sleep_us(20);
+  }
+  stopping = true;
+  can_rx.join();
+  serial_rx.join();
+  serial_tx.join();
+
+  std::vector<int64_t> to_host, to_bus;
+  for (uint32_t i = 0; i < frames; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(rx_seen[i] >= 0, "frame never reached the host");
+    to_host.push_back(rx_seen[i] - rx_sent[i]);
+  }
+  for (uint32_t i = 0; i < commands; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(port.tx_us[i] >= 0, "command never reached the bus");
+    to_bus.push_back(port.tx_us[i] - tx_sent[i]);
+  }
+  report("bus to host", to_host);
+  report("host to bus", to_bus);
+  TEST_ASSERT_LESS_OR_EQUAL(LATENCY_BOUND_US, to_host.back());
+  TEST_ASSERT_LESS_OR_EQUAL(LATENCY_BOUND_US, to_bus.back());
+  TEST_ASSERT_EQUAL(0, slcan_counters.rx_ring_drops);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_fill_and_wrap);
+  RUN_TEST(test_span_ring_attach);
+  RUN_TEST(test_ring_threads);
+  RUN_TEST(test_latency_both_directions);
+  return UNITY_END();
+}
@@ -0,0 +1,235 @@
+// Trigger: each of the data byte tests with its mask, bytes past the DLC and remote frames,
+// the ID condition, and the frames forwarded around a trigger: the last ones held before it,
+// oldest first, and the post-trigger window after it.
+
+#include <unity.h>
+#include <string.h>
+#include "trigger.h"
+#include "sim_can_port.h"
+
+static Trigger trigger;
+
+void setUp() {
+  trigger.clear();
+  trigger.fires = 0;
+}
+
+void tearDown() {
+}
+
+// A standard data frame with `dlc` bytes of `data`; rx_us tells frames apart.
+static RxFrame frame(uint32_t id, const char* data, uint8_t dlc, uint32_t rx_us = 0) {
+  RxFrame f = {};
+  f.id_flags = id;
+  f.rx_us = rx_us;
+  f.dlc = dlc;
+  memcpy(f.data, data, dlc);
+  return f;
+}
+
+// A frame of ID 0x100 with `byte` in data byte 2, which is where the byte tests look.
+static RxFrame with_byte(uint8_t byte) {
+  char data[4] = { 0x11, 0x22, (char)byte, 0x44 };
+  return frame(0x100, data, 4);
+}
+
+static void test_byte_equal() {
+  TEST_ASSERT_TRUE(trigger.set_byte(2, '=', 0x30, 0xF0));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x30)));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x3F)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x40)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x20)));
+
+  trigger.set_byte(2, '=', 0x30, 0xFF);
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x30)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x31)));
+}
+
+static void test_byte_not_equal() {
+  TEST_ASSERT_TRUE(trigger.set_byte(2, '!', 0x01, 0x01));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x00)));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0xFE)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x01)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0xFF)));
+}
+
+// < and > are strict and compare the masked byte unsigned.
+static void test_byte_less() {
+  TEST_ASSERT_TRUE(trigger.set_byte(2, '<', 0x80, 0xFF));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x00)));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x7F)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x80)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0xFF)));
+
+  // Only the low nibble counts: 0xF3 is 3.
+  trigger.set_byte(2, '<', 0x04, 0x0F);
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0xF3)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x04)));
+}
+
+static void test_byte_greater() {
+  TEST_ASSERT_TRUE(trigger.set_byte(2, '>', 0x7F, 0xFF));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x80)));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0xFF)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x7F)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x00)));
+
+  // Only the high nibble counts: 0x1F is 0x10.
+  trigger.set_byte(2, '>', 0x10, 0xF0);
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x1F)));
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x20)));
+}
+
+// A frame matches only when every byte test does; bytes past its DLC and remote frames fail.
+static void test_byte_tests_combined() {
+  trigger.set_byte(0, '=', 0x11, 0xFF);
+  trigger.set_byte(2, '>', 0x10, 0xFF);
+  TEST_ASSERT_TRUE(trigger.match(with_byte(0x20)));
+  TEST_ASSERT_FALSE(trigger.match(with_byte(0x05)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x100, "\x12\x22\x20", 3)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x100, "\x11\x22", 2)));
+  TEST_ASSERT_TRUE(trigger.match(frame(0x100, "\x11\x22\x20", 3)));
+
+  RxFrame rtr = frame(0x100, "\x11\x22\x20", 3);
+  rtr.id_flags |= RX_FRAME_RTR;
+  TEST_ASSERT_FALSE(trigger.match(rtr));
+
+  // A test that can never fail still needs the byte.
+  trigger.clear();
+  trigger.set_byte(7, '=', 0x00, 0x00);
+  TEST_ASSERT_FALSE(trigger.match(frame(0x100, "\x00\x00\x00\x00\x00\x00\x00", 7)));
+  TEST_ASSERT_TRUE(trigger.match(frame(0x100, "\x00\x00\x00\x00\x00\x00\x00\x00", 8)));
+
+  TEST_ASSERT_FALSE(trigger.set_byte(8, '=', 0x00, 0xFF));
+  TEST_ASSERT_FALSE(trigger.set_byte(0, '~', 0x00, 0xFF));
+}
+
+static void test_id() {
+  TEST_ASSERT_TRUE(trigger.set_id(0x120, 0x7F0, false));
+  TEST_ASSERT_TRUE(trigger.match(frame(0x12A, "", 0)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x13A, "", 0)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x12A | RX_FRAME_EXTD, "", 0)));
+
+  TEST_ASSERT_TRUE(trigger.set_id(0x18DAF100, 0x1FFFFF00, true));
+  TEST_ASSERT_TRUE(trigger.match(frame(0x18DAF110 | RX_FRAME_EXTD, "", 0)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x18DAF110, "", 0)));
+  TEST_ASSERT_FALSE(trigger.match(frame(0x18DBF110 | RX_FRAME_EXTD, "", 0)));
+
+  TEST_ASSERT_FALSE(trigger.set_id(0x800, 0x7FF, false));
+  TEST_ASSERT_FALSE(trigger.set_id(0x20000000, 0x1FFFFFFF, true));
+}
+
+// Feed frames 0x100 numbered first to first + n - 1 by rx_us, which do not match.
+static void hold(uint32_t first, uint32_t n) {
+  for (uint32_t i = first; i < first + n; i++) {
+    TEST_ASSERT_EQUAL(TRIGGER_HOLD, trigger.feed(frame(0x100, "", 0, i)));
+  }
+}
+
+// Take the buffered frames and check they are numbered first to first + n - 1.
+static void assert_pre(uint32_t first, uint32_t n) {
+  RxFrame f;
+  for (uint32_t i = first; i < first + n; i++) {
+    TEST_ASSERT_TRUE(trigger.pop_pre(&f));
+    TEST_ASSERT_EQUAL(i, f.rx_us);
+  }
+  TEST_ASSERT_FALSE(trigger.pop_pre(&f));
+}
+
+// Only the last `pre` frames held back are forwarded, oldest first, and those after a
+// trigger are not buffered for the next one.
+static void test_pre_window() {
+  trigger.set_id(0x200, 0x7FF, false);
+  TEST_ASSERT_TRUE(trigger.set_window(3, 0));
+
+  hold(1, 10);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 11)));
+  assert_pre(8, 3);
+
+  // Fewer frames than the window.
+  hold(12, 2);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 14)));
+  assert_pre(12, 2);
+
+  // Two triggers in a row, nothing in between.
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 15)));
+  assert_pre(0, 0);
+  TEST_ASSERT_EQUAL(3, trigger.fires);
+}
+
+// The longest window, after the buffer has wrapped around more than once.
+static void test_pre_window_wraps() {
+  trigger.set_id(0x200, 0x7FF, false);
+  TEST_ASSERT_TRUE(trigger.set_window(TRIGGER_MAX_PRE, 0));
+  TEST_ASSERT_FALSE(trigger.set_window(TRIGGER_MAX_PRE + 1, 0));
+
+  hold(1000, 3 * TRIGGER_MAX_PRE + 5);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 0)));
+  assert_pre(1000 + 2 * TRIGGER_MAX_PRE + 5, TRIGGER_MAX_PRE);
+
+  // Without a pre-trigger window nothing is kept.
+  trigger.set_window(0, 0);
+  hold(1, 5);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 0)));
+  assert_pre(0, 0);
+}
+
+// The `post` frames after a trigger are forwarded, matching or not, without firing again;
+// then the trigger is armed again.
+static void test_post_window() {
+  trigger.set_id(0x200, 0x7FF, false);
+  trigger.set_window(2, 3);
+
+  hold(1, 4);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 5)));
+  assert_pre(3, 2);
+  TEST_ASSERT_EQUAL(TRIGGER_PASS, trigger.feed(frame(0x100, "", 0, 6)));
+  TEST_ASSERT_EQUAL(TRIGGER_PASS, trigger.feed(frame(0x200, "", 0, 7)));
+  TEST_ASSERT_EQUAL(TRIGGER_PASS, trigger.feed(frame(0x100, "", 0, 8)));
+  TEST_ASSERT_EQUAL(1, trigger.fires);
+
+  hold(9, 1);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 10)));
+  assert_pre(9, 1);
+  TEST_ASSERT_EQUAL(2, trigger.fires);
+
+  // Arming again drops what was buffered and what was left of the window.
+  TEST_ASSERT_EQUAL(TRIGGER_PASS, trigger.feed(frame(0x100, "", 0, 11)));
+  trigger.arm();
+  hold(12, 1);
+  TEST_ASSERT_EQUAL(TRIGGER_FIRE, trigger.feed(frame(0x200, "", 0, 13)));
+  assert_pre(12, 1);
+}
+
+static void test_describe() {
+  SimHost host;
+
+  trigger.describe(host);
+  TEST_ASSERT_EQUAL_STRING(" w0,0", host.take().c_str());
+
+  trigger.set_id(0x120, 0x7F0, false);
+  trigger.set_byte(0, '=', 0x11, 0xFF);
+  trigger.set_byte(3, '<', 0x04, 0x0F);
+  trigger.set_window(16, 4);
+  trigger.describe(host);
+  TEST_ASSERT_EQUAL_STRING(" s120,7F0 b0=11,FF b3<04,0F w16,4", host.take().c_str());
+
+  trigger.set_id(0x18DAF100, 0x1FFFFF00, true);
+  trigger.describe(host);
+  TEST_ASSERT_EQUAL_STRING(" e18DAF100,1FFFFF00 b0=11,FF b3<04,0F w16,4", host.take().c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_byte_equal);
+  RUN_TEST(test_byte_not_equal);
+  RUN_TEST(test_byte_less);
+  RUN_TEST(test_byte_greater);
+  RUN_TEST(test_byte_tests_combined);
+  RUN_TEST(test_id);
+  RUN_TEST(test_pre_window);
+  RUN_TEST(test_pre_window_wraps);
+  RUN_TEST(test_post_window);
+  RUN_TEST(test_describe);
+  return UNITY_END();
+}